@@ -0,0 +1,81 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "AudioPluginUtil.h"
+
+// Third order ambisonic encoding gains in the AmbiX convention: ACN channel order and SN3D normalization, as
+// expected by most external decoders.
+class AmbisonicEncoder
+{
+public:
+    enum { kOrder = 3, kChannels = (kOrder + 1) * (kOrder + 1) };
+
+    // Gains for a direction given in ambisonic coordinates (x front, y left, z up), which need not be normalized
+    static void Gains(float x, float y, float z, float* gains)
+    {
+        float length = sqrtf(x * x + y * y + z * z);
+        if (length < 1.0e-6f)
+        {
+            // No direction: only the omnidirectional component
+            for (int i = 0; i < kChannels; i++)
+                gains[i] = 0.0f;
+            gains[0] = 1.0f;
+            return;
+        }
+        x /= length;
+        y /= length;
+        z /= length;
+
+        const float x2 = x * x, y2 = y * y, z2 = z * z;
+        gains[0] = 1.0f;
+
+        gains[1] = y;
+        gains[2] = z;
+        gains[3] = x;
+
+        gains[4] = 1.7320508f * x * y;
+        gains[5] = 1.7320508f * y * z;
+        gains[6] = 0.5f * (3.0f * z2 - 1.0f);
+        gains[7] = 1.7320508f * x * z;
+        gains[8] = 0.8660254f * (x2 - y2);
+
+        gains[9] = 0.7905694f * y * (3.0f * x2 - y2);
+        gains[10] = 3.8729833f * x * y * z;
+        gains[11] = 0.6123724f * y * (5.0f * z2 - 1.0f);
+        gains[12] = 0.5f * z * (5.0f * z2 - 3.0f);
+        gains[13] = 0.6123724f * x * (5.0f * z2 - 1.0f);
+        gains[14] = 1.9364917f * z * (x2 - y2);
+        gains[15] = 0.7905694f * x * (x2 - 3.0f * y2);
+    }
+
+    // Gains for a direction in Unity's listener space (x right, y up, z forward)
+    static void GainsFromListenerSpace(const float* direction, float* gains)
+    {
+        Gains(direction[2], -direction[0], direction[1], gains);
+    }
+
+    // Gains for an azimuth (degrees clockwise from the front, as in Unity) and elevation (degrees up)
+    static void GainsFromAngles(float azimuth, float elevation, float* gains)
+    {
+        float az = azimuth * kPI / 180.0f, el = elevation * kPI / 180.0f;
+        float direction[3] = { cosf(el) * sinf(az), sinf(el), cosf(el) * cosf(az) };
+        GainsFromListenerSpace(direction, gains);
+    }
+};
@@ -1,5 +1,6 @@
 #include "AudioPluginUtil.h"
 #include <stdarg.h>
+#include <atomic>
 
 char* strnew(const char* src)
 {
@@ -57,24 +58,268 @@ static void FFTProcess(UnityComplexNumber* data, int numsamples, bool forward)
     }
 }
 
+FFTPlan::FFTPlan()
+    : numsamples(0)
+    , bitrev(NULL)
+    , twiddles(NULL)
+    , itwiddles(NULL)
+    , realtwiddles(NULL)
+{
+}
+
+FFTPlan::~FFTPlan()
+{
+    delete[] bitrev;
+    delete[] twiddles;
+    delete[] itwiddles;
+    delete[] realtwiddles;
+}
+
+void FFTPlan::Init(int _numsamples)
+{
+    assert(_numsamples >= 2 && _numsamples <= kMaxSize && (_numsamples & (_numsamples - 1)) == 0);
+    numsamples = _numsamples;
+    bitrev = new int[numsamples];
+    twiddles = new UnityComplexNumber[numsamples];
+    itwiddles = new UnityComplexNumber[numsamples];
+    realtwiddles = new UnityComplexNumber[numsamples];
+
+    int bits = 0;
+    while ((1 << bits) < numsamples)
+        bits++;
+    for (int i = 0; i < numsamples; i++)
+    {
+        int r = 0;
+        for (int b = 0; b < bits; b++)
+            r |= ((i >> b) & 1) << (bits - 1 - b);
+        bitrev[i] = r;
+    }
+
+    // Computed in double precision from the angle directly instead of by recurrence, so large sizes don't accumulate rounding errors
+    for (int j = 1; j < numsamples; j <<= 1)
+    {
+        for (int m = 0; m < j; m++)
+        {
+            double w = -3.14159265358979323846 * (double)m / (double)j;
+            twiddles[j - 1 + m].Set((float)cos(w), (float)sin(w));
+            itwiddles[j - 1 + m].Set((float)cos(w), (float)-sin(w));
+        }
+    }
+    for (int k = 0; k < numsamples; k++)
+    {
+        double w = -3.14159265358979323846 * (double)k / (double)numsamples;
+        realtwiddles[k].Set((float)cos(w), (float)sin(w));
+    }
+}
+
+void FFTPlan::Process(UnityComplexNumber* data, bool forward) const
+{
+    for (int i = 0; i < numsamples; i++)
+    {
+        int r = bitrev[i];
+        if (i < r)
+        {
+            UnitySwap(data[i].re, data[r].re);
+            UnitySwap(data[i].im, data[r].im);
+        }
+    }
+
+    // First stage has only trivial twiddles
+    for (int i = 0; i < numsamples; i += 2)
+    {
+        float ar = data[i].re, ai = data[i].im, br = data[i + 1].re, bi = data[i + 1].im;
+        data[i].Set(ar + br, ai + bi);
+        data[i + 1].Set(ar - br, ai - bi);
+    }
+
+    const UnityComplexNumber* table = (forward) ? twiddles : itwiddles;
+    for (int j = 2; j < numsamples; j <<= 1)
+    {
+        const UnityComplexNumber* w = table + j - 1;
+        for (int i = 0; i < numsamples; i += j << 1)
+        {
+            float* a = &data[i].re;
+            float* b = &data[i + j].re;
+            const float* c = &w[0].re;
+#if UNITY_SSE
+            // Two interleaved complex butterflies per iteration: t = b * w, a' = a + t, b' = a - t
+            const __m128 sign = _mm_set_ps(1.0f, -1.0f, 1.0f, -1.0f);
+            for (int m = 0; m < 2 * j; m += 4)
+            {
+                __m128 va = _mm_loadu_ps(a + m);
+                __m128 vb = _mm_loadu_ps(b + m);
+                __m128 vw = _mm_loadu_ps(c + m);
+                __m128 wre = _mm_shuffle_ps(vw, vw, _MM_SHUFFLE(2, 2, 0, 0));
+                __m128 wim = _mm_shuffle_ps(vw, vw, _MM_SHUFFLE(3, 3, 1, 1));
+                __m128 bswap = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 3, 0, 1));
+                __m128 t = _mm_add_ps(_mm_mul_ps(vb, wre), _mm_mul_ps(_mm_mul_ps(bswap, wim), sign));
+                _mm_storeu_ps(a + m, _mm_add_ps(va, t));
+                _mm_storeu_ps(b + m, _mm_sub_ps(va, t));
+            }
+#else
+            for (int m = 0; m < 2 * j; m += 2)
+            {
+                float tr = b[m] * c[m] - b[m + 1] * c[m + 1];
+                float ti = b[m] * c[m + 1] + b[m + 1] * c[m];
+                b[m] = a[m] - tr;
+                b[m + 1] = a[m + 1] - ti;
+                a[m] += tr;
+                a[m + 1] += ti;
+            }
+#endif
+        }
+    }
+}
+
+const FFTPlan* FFTPlan::Get(int numsamples)
+{
+    static std::atomic<FFTPlan*> plans[kMaxLog2Size + 1];
+    static Mutex mutex;
+
+    int log2n = 0;
+    while ((1 << log2n) < numsamples)
+        log2n++;
+    assert(log2n >= 1 && log2n <= kMaxLog2Size && (1 << log2n) == numsamples);
+
+    FFTPlan* plan = plans[log2n].load(std::memory_order_acquire);
+    if (plan == NULL)
+    {
+        MutexScopeLock lock(mutex);
+        plan = plans[log2n].load(std::memory_order_relaxed);
+        if (plan == NULL)
+        {
+            plan = new FFTPlan();
+            plan->Init(numsamples);
+            plans[log2n].store(plan, std::memory_order_release);
+        }
+    }
+    return plan;
+}
+
+static bool IsPowerOfTwo(int n)
+{
+    return n > 0 && (n & (n - 1)) == 0;
+}
+
 void FFT::Forward(UnityComplexNumber* data, int numsamples)
 {
-    FFTProcess(data, numsamples, true);
+    assert(IsPowerOfTwo(numsamples));
+    if (numsamples < 2 || !IsPowerOfTwo(numsamples))
+        return;
+    if (numsamples > FFTPlan::kMaxSize)
+    {
+        FFTProcess(data, numsamples, true);
+        return;
+    }
+    FFTPlan::Get(numsamples)->Process(data, true);
 }
 
 void FFT::Backward(UnityComplexNumber* data, int numsamples)
 {
-    for (int n = 0; n < numsamples; n++)
-        data[n].im = -data[n].im;
-    FFTProcess(data, numsamples, false);
+    assert(IsPowerOfTwo(numsamples));
+    if (numsamples < 2 || !IsPowerOfTwo(numsamples))
+        return;
+    if (numsamples > FFTPlan::kMaxSize)
+        FFTProcess(data, numsamples, false);
+    else
+        FFTPlan::Get(numsamples)->Process(data, false);
     const float scale = 1.0f / (float)numsamples;
     for (int n = 0; n < numsamples; n++)
     {
-        data[n].re =  scale * data[n].re;
-        data[n].im = -scale * data[n].im;
+        data[n].re *= scale;
+        data[n].im *= scale;
     }
 }
 
+// The half-size complex pass of the real transforms: the shared plan up to kMaxSize, the unplanned transform past it
+static void ProcessHalf(const FFTPlan* plan, UnityComplexNumber* z, int half, bool forward)
+{
+    if (plan != NULL)
+        plan->Process(z, forward);
+    else
+        FFTProcess(z, half, forward);
+}
+
+// W^k = exp(-i*pi*k/half), from the plan's table or computed when there is no plan
+static UnityComplexNumber RealTwiddle(const FFTPlan* plan, int k, int half)
+{
+    if (plan != NULL)
+        return plan->realtwiddles[k];
+    double phase = -3.14159265358979323846 * (double)k / (double)half;
+    UnityComplexNumber w;
+    w.Set((float)cos(phase), (float)sin(phase));
+    return w;
+}
+
+// Packs the even/odd samples into the real/imaginary parts of a half-size complex FFT and separates the two spectra afterwards:
+// X[k] = E + W^k * O and X[N/2 - k] = conj(E - W^k * O) with E = (Z[k] + conj(Z[N/2 - k])) / 2, O = -i * (Z[k] - conj(Z[N/2 - k])) / 2
+void FFT::ForwardReal(const float* input, UnityComplexNumber* spectrum, int numsamples)
+{
+    assert(numsamples >= 4 && IsPowerOfTwo(numsamples));
+    if (numsamples < 4 || !IsPowerOfTwo(numsamples))
+    {
+        if (numsamples > 0)
+            memset(spectrum, 0, sizeof(UnityComplexNumber) * (numsamples / 2 + 1));
+        return;
+    }
+    const int half = numsamples >> 1;
+    const FFTPlan* plan = (half <= FFTPlan::kMaxSize) ? FFTPlan::Get(half) : NULL;
+    if ((const float*)spectrum != input)
+        memmove(spectrum, input, sizeof(float) * numsamples);
+    ProcessHalf(plan, spectrum, half, true);
+
+    float z0re = spectrum[0].re, z0im = spectrum[0].im;
+    spectrum[0].Set(z0re + z0im, 0.0f);
+    spectrum[half].Set(z0re - z0im, 0.0f);
+    for (int k = 1; k <= half / 2; k++)
+    {
+        const UnityComplexNumber& zk = spectrum[k];
+        const UnityComplexNumber& zc = spectrum[half - k];
+        float ere = 0.5f * (zk.re + zc.re), eim = 0.5f * (zk.im - zc.im);
+        float ore = 0.5f * (zk.im + zc.im), oim = -0.5f * (zk.re - zc.re);
+        const UnityComplexNumber w = RealTwiddle(plan, k, half);
+        float tre = w.re * ore - w.im * oim;
+        float tim = w.re * oim + w.im * ore;
+        spectrum[k].Set(ere + tre, eim + tim);
+        spectrum[half - k].Set(ere - tre, tim - eim);
+    }
+}
+
+void FFT::BackwardReal(const UnityComplexNumber* spectrum, float* output, int numsamples)
+{
+    assert(numsamples >= 4 && IsPowerOfTwo(numsamples));
+    if (numsamples < 4 || !IsPowerOfTwo(numsamples))
+    {
+        if (numsamples > 0)
+            memset(output, 0, sizeof(float) * numsamples);
+        return;
+    }
+    const int half = numsamples >> 1;
+    const FFTPlan* plan = (half <= FFTPlan::kMaxSize) ? FFTPlan::Get(half) : NULL;
+    UnityComplexNumber* z = (UnityComplexNumber*)output;
+
+    // Inverse of the unpacking step above: E = (X[k] + conj(X[N/2 - k])) / 2, O = conj(W^k) * (X[k] - conj(X[N/2 - k])) / 2, Z[k] = E + i * O
+    float x0 = spectrum[0].re, xh = spectrum[half].re;
+    for (int k = 1; k <= half / 2; k++)
+    {
+        UnityComplexNumber xk = spectrum[k];
+        UnityComplexNumber xc = spectrum[half - k];
+        float ere = 0.5f * (xk.re + xc.re), eim = 0.5f * (xk.im - xc.im);
+        float dre = 0.5f * (xk.re - xc.re), dim = 0.5f * (xk.im + xc.im);
+        const UnityComplexNumber w = RealTwiddle(plan, k, half);
+        float ore = w.re * dre + w.im * dim;
+        float oim = w.re * dim - w.im * dre;
+        z[k].Set(ere - oim, eim + ore);
+        z[half - k].Set(ere + oim, ore - eim);
+    }
+    z[0].Set(0.5f * (x0 + xh), 0.5f * (x0 - xh));
+
+    ProcessHalf(plan, z, half, false);
+    const float scale = 1.0f / (float)half;
+    for (int n = 0; n < numsamples; n++)
+        output[n] *= scale;
+}
+
 void FFTAnalyzer::Cleanup()
 {
     delete[] window;
@@ -95,9 +340,10 @@ void FFTAnalyzer::AnalyzeInput(float* data, int numchannels, int numsamples, flo
         ibuffer[n] = ibuffer[n + numsamples];
     for (int n = 0; n < numsamples; n++)
         ibuffer[n + spectrumSize - numsamples] = data[n * numchannels];
+    float* windowed = (float*)cspec;
     for (int n = 0; n < spectrumSize; n++)
-        cspec[n].Set(ibuffer[n] * window[n], 0.0f);
-    Forward(cspec, spectrumSize);
+        windowed[n] = ibuffer[n] * window[n];
+    ForwardReal(windowed, cspec, spectrumSize);
     for (int n = 0; n < spectrumSize / 2; n++)
     {
         float a = cspec[n].Magnitude();
@@ -113,9 +359,10 @@ void FFTAnalyzer::AnalyzeOutput(float* data, int numchannels, int numsamples, fl
         obuffer[n] = obuffer[n + numsamples];
     for (int n = 0; n < numsamples; n++)
         obuffer[n + spectrumSize - numsamples] = data[n * numchannels];
+    float* windowed = (float*)cspec;
     for (int n = 0; n < spectrumSize; n++)
-        cspec[n].Set(obuffer[n] * window[n], 0.0f);
-    Forward(cspec, spectrumSize);
+        windowed[n] = obuffer[n] * window[n];
+    ForwardReal(windowed, cspec, spectrumSize);
     for (int n = 0; n < spectrumSize / 2; n++)
     {
         float a = cspec[n].Magnitude();
@@ -180,28 +427,50 @@ void FFTAnalyzer::ReadBuffer(float* buffer, int numsamples, bool readInputBuffer
 
 HistoryBuffer::HistoryBuffer()
     : length(0)
+    , mask(0)
     , writeindex(0)
     , data(NULL)
+    , owned(false)
 {
 }
 
 HistoryBuffer::~HistoryBuffer()
 {
-    delete[] data;
+    if (owned)
+        delete[] data;
+}
+
+int HistoryBuffer::GetLength(int _length)
+{
+    int n = 1;
+    while (n < _length)
+        n <<= 1;
+    return n;
 }
 
 void HistoryBuffer::Init(int _length)
 {
-    length = _length;
-    data = new float[length];
+    Init(_length, new float[GetLength(_length)]);
     memset(data, 0, sizeof(float) * length);
+    owned = true;
+}
+
+void HistoryBuffer::Init(int _length, float* memory)
+{
+    if (owned)
+        delete[] data;
+    length = GetLength(_length);
+    mask = length - 1;
+    writeindex.store(0, std::memory_order_relaxed);
+    data = memory;
+    owned = false;
 }
 
 void HistoryBuffer::ReadBuffer(float* buffer, int numsamplesTarget, int numsamplesSource, float offset)
 {
     numsamplesTarget--; // reserve last sample for count of how much we were able to read
     float speed = (float)numsamplesSource / (float)numsamplesTarget;
-    int n, w = writeindex; // since ReadBuffer is called from the GUI thread, writeindex may be modified by the DSP thread simultaneously
+    int n, w = GetWriteIndex(); // since ReadBuffer is called from the GUI thread, writeindex may be modified by the DSP thread simultaneously
     float p = offset;
     for (n = 0; n < numsamplesTarget; n++)
     {
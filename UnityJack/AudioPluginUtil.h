@@ -8,6 +8,14 @@
 #include <string.h>
 #include <assert.h>
 
+#include <algorithm>
+#include <atomic>
+
+#if defined(__SSE__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 1)
+#   define UNITY_SSE 1
+#   include <xmmintrin.h>
+#endif
+
 #if UNITY_WIN
 #   include <windows.h>
 #else
@@ -122,11 +130,45 @@ public:
     float re, im;
 };
 
+// Precomputed tables for a power-of-two FFT size: bit-reversal permutation, per-stage twiddles laid out contiguously
+// (stage with half-length j starts at offset j - 1) and the post-processing twiddles used to unpack a real-input transform.
+// Plans are immutable once built, so a single plan can be shared by any number of threads.
+class FFTPlan
+{
+public:
+    enum { kMaxLog2Size = 16, kMaxSize = 1 << kMaxLog2Size };
+
+    FFTPlan();
+    ~FFTPlan();
+
+    void Init(int numsamples);
+    void Process(UnityComplexNumber* data, bool forward) const;
+
+    // Returns the shared plan for numsamples (power of two, 2..kMaxSize), building it on first use.
+    // Building allocates, so call this once from a non-realtime thread before using a new size on the audio thread.
+    static const FFTPlan* Get(int numsamples);
+
+public:
+    int numsamples;
+    int* bitrev;
+    UnityComplexNumber* twiddles;       // Forward twiddles, exp(-i*pi*m/j) for every stage
+    UnityComplexNumber* itwiddles;      // Conjugated twiddles for the backward transform
+    UnityComplexNumber* realtwiddles;   // exp(-2*i*pi*k/(2*numsamples)), used when this plan is the half-size plan of a real FFT
+};
+
+// numsamples is a power of two at any size; sizes past FFTPlan::kMaxSize run unplanned. Other sizes assert, and in a
+// release build Forward and Backward leave the data as it is while the real transforms write zeros.
 class FFT
 {
 public:
     static void Forward(UnityComplexNumber* data, int numsamples);
+    // The inverse of Forward, scaled by 1 / numsamples
     static void Backward(UnityComplexNumber* data, int numsamples);
+
+    // Real-input transforms through a half-size complex FFT, numsamples at least 4. The spectrum holds numsamples / 2 + 1 bins (DC to Nyquist).
+    // ForwardReal may be called in-place with input == (float*)spectrum, BackwardReal with output == (float*)spectrum.
+    static void ForwardReal(const float* input, UnityComplexNumber* spectrum, int numsamples);
+    static void BackwardReal(const UnityComplexNumber* spectrum, float* output, int numsamples);
 };
 
 class FFTAnalyzer : public FFT
@@ -160,81 +202,189 @@ public:
 
 public:
     void Init(int _length);
+    // Init on memory the caller owns, GetLength(_length) floats of it, already zeroed
+    void Init(int _length, float* memory);
+    static int GetLength(int _length);
     void ReadBuffer(float* buffer, int numsamplesTarget, int numsamplesSource, float offset);
 
 public:
+    // Only one thread feeds the buffer. The samples are stored before the new writeindex is published, so a reader
+    // that loads writeindex with acquire ordering sees them.
     inline void Feed(float sample)
     {
-        // Don't try to optimize this with ++
-        // The writeindex veriable may be read at the same time, so we don't want intermediate values indexing out of the array.
-        int w = writeindex + 1;
-        if (w == length)
-            w = 0;
+        int w = (writeindex.load(std::memory_order_relaxed) + 1) & mask;
         data[w] = sample;
-        writeindex = w;
+        writeindex.store(w, std::memory_order_release);
+    }
+
+    // Feed for a whole block, numsamples no longer than the buffer
+    inline void FeedBlock(const float* samples, int numsamples)
+    {
+        if (numsamples <= 0)
+            return;
+        int w = (writeindex.load(std::memory_order_relaxed) + 1) & mask;
+        int first = length - w;
+        if (first > numsamples)
+            first = numsamples;
+        memcpy(data + w, samples, first * sizeof(float));
+        memcpy(data, samples + first, (numsamples - first) * sizeof(float));
+        writeindex.store((w + numsamples - 1) & mask, std::memory_order_release);
     }
 
+    // Index of the newest sample
+    inline int GetWriteIndex() const { return writeindex.load(std::memory_order_acquire); }
+
 public:
-    int length;
-    int writeindex;
+    int length;     // a power of two, Init rounds up to one
+    int mask;
+    std::atomic<int> writeindex;
     float* data;
+    bool owned;     // data was allocated by Init
 };
 
+// Smallest power of two not below n, at compile time
+template<int n, int p = 1, bool done = (p >= n)>
+struct NextPowerOfTwo { enum { value = NextPowerOfTwo<n, p * 2>::value }; };
+template<int n, int p>
+struct NextPowerOfTwo<n, p, true> { enum { value = p }; };
+
+// Lock-free queue between one producer thread and one consumer thread, holding up to LENGTH items, which is
+// _LENGTH rounded up to a power of two. The positions count items forever and are masked into the buffer; each is
+// only stored by its own side, with release ordering after the items it covers, and sits on its own cache line.
+// Each side also keeps the other's position as it last saw it, and only loads the shared one again when that copy
+// says the ring is empty (consumer) or full (producer), so a side streaming items doesn't pull the other's cache
+// line over for every one of them.
 template<const int _LENGTH, typename T = float>
 class RingBuffer
 {
 public:
-    enum { LENGTH = _LENGTH };
+    enum { LENGTH = NextPowerOfTwo<_LENGTH>::value, MASK = LENGTH - 1 };
 
-    volatile int readpos;
-    volatile int writepos;
-    T buffer[LENGTH];
+    RingBuffer() : readpos(0), cachedwritepos(0), writepos(0), cachedreadpos(0) {}
 
+    // Consumer
     inline bool Read(T& val)
     {
-        int r = readpos;
-        if (r == writepos)
+        unsigned r = readpos.load(std::memory_order_relaxed);
+        if (r == cachedwritepos && r == (cachedwritepos = writepos.load(std::memory_order_acquire)))
+            return false;
+        val = buffer[r & MASK];
+        readpos.store(r + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: reads up to count items, returns how many were read
+    inline int Read(T* dst, int count)
+    {
+        unsigned r = readpos.load(std::memory_order_relaxed);
+        int n = (int)(cachedwritepos - r);
+        if (n < count)
+        {
+            cachedwritepos = writepos.load(std::memory_order_acquire);
+            n = (int)(cachedwritepos - r);
+        }
+        if (n > count)
+            n = count;
+        if (n <= 0)
+            return 0;
+        int start = (int)(r & MASK), first = std::min(n, LENGTH - start);
+        std::copy(buffer + start, buffer + start + first, dst);
+        std::copy(buffer, buffer + (n - first), dst + first);
+        readpos.store(r + n, std::memory_order_release);
+        return n;
+    }
+
+    // Consumer: the next item without reading it, false when there is none
+    inline bool Peek(T& val) const
+    {
+        unsigned r = readpos.load(std::memory_order_relaxed);
+        if (r == cachedwritepos && r == (cachedwritepos = writepos.load(std::memory_order_acquire)))
             return false;
-        r = (r == LENGTH - 1) ? 0 : (r + 1);
-        val = buffer[r];
-        readpos = r;
+        val = buffer[r & MASK];
         return true;
     }
 
+    // Consumer: drops up to num items
     inline void Skip(int num)
     {
-        int r = readpos + num;
-        if (r >= LENGTH)
-            r -= LENGTH;
-        readpos = r;
+        unsigned r = readpos.load(std::memory_order_relaxed);
+        if ((int)(cachedwritepos - r) < num)
+            cachedwritepos = writepos.load(std::memory_order_acquire);
+        int n = std::min(num, (int)(cachedwritepos - r));
+        if (n > 0)
+            readpos.store(r + n, std::memory_order_release);
     }
 
+    // Producer, while the consumer is not using the buffer: drops whatever the consumer hasn't read yet
     inline void SyncWritePos()
     {
-        writepos = readpos;
+        unsigned r = readpos.load(std::memory_order_acquire);
+        cachedwritepos = r;
+        cachedreadpos = r;
+        writepos.store(r, std::memory_order_release);
     }
 
+    // Producer: false when the buffer is full
     inline bool Feed(const T& input)
     {
-        int w = (writepos == LENGTH - 1) ? 0 : (writepos + 1);
-        buffer[w] = input;
-        writepos = w;
+        unsigned w = writepos.load(std::memory_order_relaxed);
+        if (w - cachedreadpos >= (unsigned)LENGTH && w - (cachedreadpos = readpos.load(std::memory_order_acquire)) >= (unsigned)LENGTH)
+            return false;
+        buffer[w & MASK] = input;
+        writepos.store(w + 1, std::memory_order_release);
         return true;
     }
 
+    // Producer: writes as many of the count items as fit, returns how many were written
+    inline int Write(const T* src, int count)
+    {
+        unsigned w = writepos.load(std::memory_order_relaxed);
+        int n = LENGTH - (int)(w - cachedreadpos);
+        if (n < count)
+        {
+            cachedreadpos = readpos.load(std::memory_order_acquire);
+            n = LENGTH - (int)(w - cachedreadpos);
+        }
+        if (n > count)
+            n = count;
+        if (n <= 0)
+            return 0;
+        int start = (int)(w & MASK), first = std::min(n, LENGTH - start);
+        std::copy(src, src + first, buffer + start);
+        std::copy(src + first, src + n, buffer);
+        writepos.store(w + n, std::memory_order_release);
+        return n;
+    }
+
+    // Either side, as of the positions loaded; the other side may have moved on since. From the producer's side the
+    // consumer may have read more, so GetNumBuffered is an upper bound and GetFreeSpace a lower bound; from the
+    // consumer's side the producer may have written more, so GetNumBuffered is a lower bound.
     inline int GetNumBuffered() const
     {
-        int b = writepos - readpos;
-        if (b < 0)
-            b += LENGTH;
-        return b;
+        unsigned r = readpos.load(std::memory_order_acquire);
+        return (int)(writepos.load(std::memory_order_acquire) - r);
     }
 
+    inline int GetFreeSpace() const
+    {
+        return LENGTH - GetNumBuffered();
+    }
+
+    // Only while neither side is using the buffer
     inline void Clear()
     {
-        writepos = 0;
-        readpos = 0;
+        writepos.store(0, std::memory_order_relaxed);
+        readpos.store(0, std::memory_order_relaxed);
+        cachedwritepos = 0;
+        cachedreadpos = 0;
     }
+
+private:
+    alignas(64) std::atomic<unsigned> readpos;
+    mutable unsigned cachedwritepos;    // the consumer's copy of writepos
+    alignas(64) std::atomic<unsigned> writepos;
+    unsigned cachedreadpos;             // the producer's copy of readpos
+    alignas(64) T buffer[LENGTH];
 };
 
 class BiquadFilter
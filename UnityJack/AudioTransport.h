@@ -0,0 +1,69 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "BufferArena.h"
+
+#include <stdint.h>
+
+// What the plugin needs from whatever carries its blocks to the audio side: a JACK client in this process
+// (InternalJackClient) or a UDP stream to a receiver on another machine (NetworkClient).
+class AudioTransport
+{
+public:
+    virtual ~AudioTransport() {}
+
+    // Sends one cycle of interleaved frames for every output port
+    virtual void setAudioBuffer(float *buffer) = 0;
+
+    // Sends one cycle of planar frames, rows stride samples apart. Only the ports flagged in active (all of them
+    // when it is null) carry sound; the others play silence.
+    virtual void setAudioChannels(const float *channels, int stride, const uint8_t *active) = 0;
+
+    // Sends one cycle of the output ports from one row per port, nullptr for the ports that are silent
+    virtual void setAudioRows(const float *const *rows) = 0;
+
+    // Receives one cycle of interleaved frames from every input port
+    virtual void getAudioBuffer(float *buffer) = 0;
+
+    // Reads exactly one block of interleaved input frames, or nothing while less than that has arrived
+    virtual bool readInput(float *buffer, int frames) = 0;
+
+    // Replaces the impulse response convolved with an input port, where the transport has inputs to convolve
+    virtual bool setInputConvolution(int /*port*/, const float * /*ir*/, int /*length*/) { return false; }
+
+    // Sets the alignment delay of an output port, where the transport delays its outputs
+    virtual bool setOutputDelay(int /*port*/, float /*milliseconds*/) { return false; }
+
+    // Sets one band of an output port's EQ, where the transport filters its outputs (BiquadBank::Type)
+    virtual bool setOutputEq(int /*port*/, int /*band*/, int /*type*/, float /*frequency*/, float /*gain*/, float /*q*/) { return false; }
+
+    // Turns the DC blocker and limiter of an output port on or off, where the transport protects its outputs
+    virtual bool setOutputProtection(int /*port*/, bool /*enabled*/, float /*thresholdDb*/) { return false; }
+
+    // Mixes an input port into an output port at a gain, 0 removes the route, where the transport has both
+    virtual bool setMonitorRoute(int /*input*/, int /*output*/, float /*gain*/) { return false; }
+    virtual bool clearMonitorRoutes() { return false; }
+
+    // The largest limiter gain reduction of each output port since the last call, in dB
+    virtual int getOutputGainReduction(float * /*reductionDb*/, int /*count*/) { return 0; }
+
+    // Memory for the owner's own buffers, sized by the extraArenaBytes passed to the constructor
+    virtual BufferArena& arena() = 0;
+};
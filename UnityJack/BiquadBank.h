@@ -0,0 +1,238 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "AudioPluginUtil.h"
+#include "TripleBuffer.h"
+
+#include <atomic>
+#include <mutex>
+#include <vector>
+
+// Speaker EQ: up to kMaxBands biquads in series on every output port. Channels are filtered four at a time, one
+// per SSE lane, so coefficients and state are stored per group of four channels with a float per lane. Blocks of
+// 4 frames x 4 channels are transposed in registers, so every step of the cascade works on four channels at once.
+//
+// Bands are set from any thread: the setter recomputes the group's coefficients with BiquadFilter's cookbook
+// formulae and publishes the whole table through a triple buffer, which the audio thread picks up in BeginCycle.
+class BiquadBank
+{
+public:
+    enum { kMaxBands = 8, kLanes = 4 };
+
+    enum Type
+    {
+        Type_Off = 0,
+        Type_Peaking = 1,
+        Type_LowShelf = 2,
+        Type_HighShelf = 3,
+        Type_Lowpass = 4,
+        Type_Highpass = 5,
+        Type_Count
+    };
+
+    BiquadBank(int channels, int blocksize, float samplerate)
+    : mChannels(channels)
+    , mBlockSize(blocksize)
+    , mGroups((channels + kLanes - 1) / kLanes)
+    , mSampleRate(samplerate)
+    , mActive(false)
+    {
+        std::vector<float> identity(mGroups * kMaxBands * kCoeffs * kLanes, 0.0f);
+        for (int i = 0; i < mGroups * kMaxBands; i++)
+            for (int lane = 0; lane < kLanes; lane++)
+                identity[i * kCoeffs * kLanes + lane] = 1.0f; // b0
+        mMaster.coeffs = identity;
+        mMaster.bands.assign(mGroups, 0);
+        for (int i = 0; i < 3; i++)
+            mTables.Slot(i) = mMaster;
+        mBandsUsed.assign(mChannels * kMaxBands, false);
+        mState.assign(mGroups * kMaxBands * 2 * kLanes, 0.0f);
+        mSpare.assign((kLanes - 1) * blocksize, 0.0f);
+    }
+
+    // Any thread: sets one band of a channel, Type_Off removes it. Frequency in Hz, gain in dB for the peaking and
+    // shelving types.
+    bool Set(int channel, int band, int type, float frequency, float gain, float q)
+    {
+        if (channel < 0 || channel >= mChannels || band < 0 || band >= kMaxBands || type < 0 || type >= Type_Count)
+            return false;
+
+        frequency = FastClip(frequency, 10.0f, 0.49f * mSampleRate);
+        q = FastMax(q, 0.05f);
+        float c[kCoeffs] = { 0.0f, 0.0f, 1.0f, 0.0f, 0.0f };  // b2, b1, b0, a2, a1 as StoreCoeffs writes them
+        if (type != Type_Off)
+        {
+            BiquadFilter filter;
+            switch (type)
+            {
+                case Type_Peaking: filter.SetupPeaking(frequency, mSampleRate, gain, q); break;
+                case Type_LowShelf: filter.SetupLowShelf(frequency, mSampleRate, gain, q); break;
+                case Type_HighShelf: filter.SetupHighShelf(frequency, mSampleRate, gain, q); break;
+                case Type_Lowpass: filter.SetupLowpass(frequency, mSampleRate, q); break;
+                default: filter.SetupHighpass(frequency, mSampleRate, q); break;
+            }
+            float* p = c;
+            filter.StoreCoeffs(p);
+        }
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        int group = channel / kLanes, lane = channel % kLanes;
+        float* dst = &mMaster.coeffs[(group * kMaxBands + band) * kCoeffs * kLanes];
+        dst[0 * kLanes + lane] = c[2];
+        dst[1 * kLanes + lane] = c[1];
+        dst[2 * kLanes + lane] = c[0];
+        dst[3 * kLanes + lane] = c[4];
+        dst[4 * kLanes + lane] = c[3];
+
+        // a group runs as many stages as the highest band any of its channels uses
+        mBandsUsed[channel * kMaxBands + band] = (type != Type_Off);
+        int bands = 0;
+        for (int ch = group * kLanes; ch < mChannels && ch < (group + 1) * kLanes; ch++)
+            for (int b = 0; b < kMaxBands; b++)
+                if (mBandsUsed[ch * kMaxBands + b] && b + 1 > bands) bands = b + 1;
+        mMaster.bands[group] = bands;
+
+        mTables.Back() = mMaster;
+        mTables.Publish();
+        mActive.store(true, std::memory_order_release);
+        return true;
+    }
+
+    int GetGroups() const { return mGroups; }
+
+    // Realtime, once per cycle before any Process: picks up the latest coefficients. False while no band was ever set.
+    bool BeginCycle()
+    {
+        if (!mActive.load(std::memory_order_acquire)) return false;
+        mTables.Update();
+        return true;
+    }
+
+    // Realtime: filters the channels of one group in place, rows[i] being channel group * kLanes + i. Groups may
+    // run on different threads.
+    void Process(int group, float* const* rows, int numsamples)
+    {
+        const Table& table = mTables.Front();
+        const int bands = table.bands[group];
+        if (bands == 0 || numsamples > mBlockSize) return;
+
+        float* r[kLanes];
+        int lanes = mChannels - group * kLanes;
+        if (lanes > kLanes) lanes = kLanes;
+        for (int lane = 0; lane < kLanes; lane++)
+            r[lane] = (lane < lanes) ? rows[lane] : &mSpare[(lane - 1) * mBlockSize];
+
+        const float* c = &table.coeffs[group * kMaxBands * kCoeffs * kLanes];
+        float* state = &mState[group * kMaxBands * 2 * kLanes];
+        // stages past the last band start from rest when a band is added again
+        memset(state + bands * 2 * kLanes, 0, (kMaxBands - bands) * 2 * kLanes * sizeof(float));
+        int n = 0;
+#if UNITY_SSE
+        __m128 s1[kMaxBands], s2[kMaxBands];
+        for (int b = 0; b < bands; b++)
+        {
+            s1[b] = _mm_loadu_ps(state + (2 * b) * kLanes);
+            s2[b] = _mm_loadu_ps(state + (2 * b + 1) * kLanes);
+        }
+        for (; n + 3 < numsamples; n += 4)
+        {
+            __m128 x[4] = { _mm_loadu_ps(r[0] + n), _mm_loadu_ps(r[1] + n), _mm_loadu_ps(r[2] + n), _mm_loadu_ps(r[3] + n) };
+            _MM_TRANSPOSE4_PS(x[0], x[1], x[2], x[3]);
+            for (int i = 0; i < 4; i++)
+                x[i] = Cascade(x[i], c, s1, s2, bands);
+            _MM_TRANSPOSE4_PS(x[0], x[1], x[2], x[3]);
+            for (int lane = 0; lane < kLanes; lane++)
+                _mm_storeu_ps(r[lane] + n, x[lane]);
+        }
+        for (; n < numsamples; n++)
+        {
+            float y[kLanes];
+            _mm_storeu_ps(y, Cascade(_mm_set_ps(r[3][n], r[2][n], r[1][n], r[0][n]), c, s1, s2, bands));
+            for (int lane = 0; lane < kLanes; lane++)
+                r[lane][n] = y[lane];
+        }
+        for (int b = 0; b < bands; b++)
+        {
+            _mm_storeu_ps(state + (2 * b) * kLanes, s1[b]);
+            _mm_storeu_ps(state + (2 * b + 1) * kLanes, s2[b]);
+        }
+#else
+        for (int lane = 0; lane < kLanes; lane++)
+        {
+            for (n = 0; n < numsamples; n++)
+            {
+                float x = r[lane][n] + 1.0e-11f; // Kill denormals
+                for (int b = 0; b < bands; b++)
+                {
+                    const float* k = c + b * kCoeffs * kLanes;
+                    float* s = state + 2 * b * kLanes;
+                    float y = k[0 * kLanes + lane] * x + s[lane];
+                    s[lane] = k[1 * kLanes + lane] * x - k[3 * kLanes + lane] * y + s[kLanes + lane];
+                    s[kLanes + lane] = k[2 * kLanes + lane] * x - k[4 * kLanes + lane] * y;
+                    x = y;
+                }
+                r[lane][n] = x;
+            }
+        }
+#endif
+    }
+
+private:
+    enum { kCoeffs = 5 };
+
+    // Coefficients per group and band as b0, b1, b2, a1, a2, each with a float per lane, and the number of bands
+    // each group runs
+    struct Table
+    {
+        std::vector<float> coeffs;
+        std::vector<int> bands;
+    };
+
+#if UNITY_SSE
+    // One frame of four channels through the group's bands, transposed direct form II
+    static inline __m128 Cascade(__m128 x, const float* c, __m128* s1, __m128* s2, int bands)
+    {
+        x = _mm_add_ps(x, _mm_set1_ps(1.0e-11f)); // Kill denormals
+        for (int b = 0; b < bands; b++, c += kCoeffs * kLanes)
+        {
+            __m128 y = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(c), x), s1[b]);
+            s1[b] = _mm_add_ps(_mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(c + kLanes), x), _mm_mul_ps(_mm_loadu_ps(c + 3 * kLanes), y)), s2[b]);
+            s2[b] = _mm_sub_ps(_mm_mul_ps(_mm_loadu_ps(c + 2 * kLanes), x), _mm_mul_ps(_mm_loadu_ps(c + 4 * kLanes), y));
+            x = y;
+        }
+        return x;
+    }
+#endif
+
+    int mChannels;
+    int mBlockSize;
+    int mGroups;
+    float mSampleRate;
+
+    Table mMaster;                  // what the setters build, under mMutex
+    std::vector<bool> mBandsUsed;
+    std::mutex mMutex;
+
+    TripleBuffer<Table> mTables;    // mMaster as last published, written under mMutex
+    std::atomic<bool> mActive;
+
+    std::vector<float> mState;      // s1 and s2 per group and band, a float per lane
+    std::vector<float> mSpare;      // rows for the missing lanes of a last group of less than four channels
+};
@@ -0,0 +1,219 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <jack/ringbuffer.h>
+
+#include <atomic>
+#include <iostream>
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+
+#if defined(_WIN32)
+    #include <malloc.h>
+    #include <windows.h>
+#else
+    #include <sys/mman.h>
+#endif
+
+// One block of cache-line aligned memory, reserved when the client is created, from which every ringbuffer and
+// scratch buffer of the bridge is carved. Nothing is ever freed individually; the whole block goes away with the
+// client. The block is zeroed up front (so its pages are faulted in before the JACK thread touches them) and
+// optionally locked into RAM.
+class BufferArena
+{
+public:
+    enum { kAlignment = 64 };
+
+    BufferArena() : mBase(nullptr), mSize(0), mUsed(0), mLocked(false) {}
+    ~BufferArena() { Release(); }
+
+    BufferArena(BufferArena const&) = delete;
+    void operator=(BufferArena const&) = delete;
+
+    static size_t Align(size_t bytes) { return (bytes + kAlignment - 1) & ~(size_t)(kAlignment - 1); }
+
+    // kAlignment aligned heap memory, released with AlignedFree
+    static void* AlignedAlloc(size_t bytes)
+    {
+#if defined(_WIN32)
+        return _aligned_malloc(bytes, kAlignment);
+#else
+        void* p = nullptr;
+        return (posix_memalign(&p, kAlignment, bytes) == 0) ? p : nullptr;
+#endif
+    }
+
+    static void AlignedFree(void* p)
+    {
+#if defined(_WIN32)
+        _aligned_free(p);
+#else
+        free(p);
+#endif
+    }
+
+    // Size a jack ringbuffer of the given capacity takes in the arena, including its header
+    static size_t RingbufferBytes(size_t bytes) { return Align(sizeof(jack_ringbuffer_t)) + Align(RoundUpPowerOfTwo(bytes)); }
+
+    bool Reserve(size_t bytes, bool lock)
+    {
+        Release();
+        bytes = Align(bytes);
+        mBase = (char*)AlignedAlloc(bytes);
+        if (mBase == nullptr) return false;
+        mSize = bytes;
+        mUsed = 0;
+        memset(mBase, 0, mSize);
+#if defined(_WIN32)
+        mLocked = lock && VirtualLock(mBase, mSize) != 0;
+#else
+        mLocked = lock && mlock(mBase, mSize) == 0;
+#endif
+        return true;
+    }
+
+    void Release()
+    {
+        if (mBase == nullptr) return;
+#if defined(_WIN32)
+        if (mLocked) VirtualUnlock(mBase, mSize);
+#else
+        if (mLocked) munlock(mBase, mSize);
+#endif
+        AlignedFree(mBase);
+        mBase = nullptr;
+        mSize = mUsed = 0;
+        mLocked = false;
+    }
+
+    // Zeroed, aligned memory; nullptr once the reservation is used up
+    void* Allocate(size_t bytes)
+    {
+        bytes = Align(bytes);
+        if (mBase == nullptr || mUsed + bytes > mSize) return nullptr;
+        void* p = mBase + mUsed;
+        mUsed += bytes;
+        return p;
+    }
+
+    template<typename T> T* Allocate(size_t count) { return (T*)Allocate(sizeof(T) * count); }
+
+    // Same layout and semantics as jack_ringbuffer_create, but backed by the arena. Must not be passed to
+    // jack_ringbuffer_free.
+    jack_ringbuffer_t* CreateRingbuffer(size_t bytes)
+    {
+        size_t size = RoundUpPowerOfTwo(bytes);
+        jack_ringbuffer_t* rb = Allocate<jack_ringbuffer_t>(1);
+        char* buf = Allocate<char>(size);
+        if (rb == nullptr || buf == nullptr) return nullptr;
+        rb->buf = buf;
+        rb->size = size;
+        rb->size_mask = size - 1;
+        rb->write_ptr = 0;
+        rb->read_ptr = 0;
+        rb->mlocked = mLocked ? 1 : 0;
+        return rb;
+    }
+
+    size_t GetSize() const { return mSize; }
+    size_t GetUsed() const { return mUsed; }
+    bool IsLocked() const { return mLocked; }
+
+private:
+    static size_t RoundUpPowerOfTwo(size_t bytes)
+    {
+        size_t size = 1;
+        while (size < bytes) size <<= 1;
+        return size;
+    }
+
+    char* mBase;
+    size_t mSize;
+    size_t mUsed;
+    bool mLocked;
+};
+
+// Fixed number of cache-line aligned slots in static storage, handed out through a lock-free free list.
+// Used for state that lives longer than a client (effect instances), so it can't come from the client's arena.
+// Once all N slots are in use, further items come from the heap, which is logged the first time: Unity creates and
+// releases effects on its main thread, so that costs an allocation there and never on the audio thread.
+template<typename T, int N>
+class FixedPool
+{
+public:
+    // A value-initialized item, nullptr only when the heap is exhausted too
+    T* Allocate()
+    {
+        uint64_t head = mFree.load(std::memory_order_acquire);
+        while ((head & 0xFFFFFFFF) != 0)
+        {
+            int index = (int)(head & 0xFFFFFFFF) - 1;
+            uint64_t next = ((head >> 32) + 1) << 32 | (uint32_t)mSlots[index].next.load(std::memory_order_relaxed);
+            if (mFree.compare_exchange_weak(head, next, std::memory_order_acq_rel))
+                return new (mSlots[index].item) T();
+        }
+        int fresh = mFresh.fetch_add(1, std::memory_order_relaxed);
+        if (fresh < N)
+            return new (mSlots[fresh].item) T();
+        mFresh.fetch_sub(1, std::memory_order_relaxed);
+
+        if (!mOverflowed.exchange(true, std::memory_order_relaxed))
+            std::cout << "More than " << N << " instances of an effect, the rest are allocated on the heap" << std::endl;
+        void* p = BufferArena::AlignedAlloc(sizeof(Slot));
+        return (p != nullptr) ? new (p) T() : nullptr;
+    }
+
+    void Free(T* item)
+    {
+        if (item == nullptr) return;
+        item->~T();
+
+        uintptr_t address = (uintptr_t)item;
+        if (address < (uintptr_t)mSlots || address >= (uintptr_t)(mSlots + N))
+        {
+            BufferArena::AlignedFree(item);
+            return;
+        }
+
+        int index = (int)(((Slot*)item) - mSlots);
+        uint64_t head = mFree.load(std::memory_order_relaxed);
+        uint64_t next;
+        do
+        {
+            mSlots[index].next.store((int)(head & 0xFFFFFFFF), std::memory_order_relaxed);
+            next = ((head >> 32) + 1) << 32 | (uint32_t)(index + 1);
+        }
+        while (!mFree.compare_exchange_weak(head, next, std::memory_order_acq_rel));
+    }
+
+private:
+    struct alignas(BufferArena::kAlignment) Slot
+    {
+        alignas(T) unsigned char item[sizeof(T)];   // first member, so a T* is also a Slot*
+        std::atomic<int> next;
+    };
+
+    Slot mSlots[N];
+    std::atomic<uint64_t> mFree;  // (tag << 32) | (index + 1) of the first free slot, 0 when empty
+    std::atomic<int> mFresh;      // slots past this one have never been handed out
+    std::atomic<bool> mOverflowed;
+};
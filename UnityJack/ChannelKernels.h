@@ -0,0 +1,221 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "AudioPluginUtil.h"
+
+#include <string.h>
+
+// The per-sample channel loops of the hot paths, compiled once for each channel count we actually run (1, 2, 4,
+// 8, 16, 32 and 64) so the channel loop is unrolled and the frames go through SSE four at a time. Callers pick a
+// kernel with Select* when the channel count is known, not per block; any other count gets the generic loop.
+namespace ChannelKernels
+{
+
+    // out[frame * channels + ch] = in[ch][frame]
+    typedef void (*InterleaveFn)(const float* const* in, float* out, int channels, int frames);
+
+    // out[ch * stride + frame] = in[frame * channels + ch]
+    typedef void (*DeinterleaveFn)(const float* in, float* out, int stride, int channels, int frames);
+
+    // out[frame] = gain * the sum of in[frame * channels + ch] over the channels
+    typedef void (*DownmixFn)(const float* in, float* out, int channels, int frames, float gain);
+
+    inline void InterleaveGeneric(const float* const* in, float* out, int channels, int frames)
+    {
+        for (int ch = 0; ch < channels; ch++)
+        {
+            const float* src = in[ch];
+            float* dst = out + ch;
+            for (int i = 0; i < frames; i++)
+                dst[i * channels] = src[i];
+        }
+    }
+
+    inline void DeinterleaveGeneric(const float* in, float* out, int stride, int channels, int frames)
+    {
+        for (int ch = 0; ch < channels; ch++)
+        {
+            const float* src = in + ch;
+            float* dst = out + ch * stride;
+            for (int i = 0; i < frames; i++)
+                dst[i] = src[i * channels];
+        }
+    }
+
+    inline void DownmixGeneric(const float* in, float* out, int channels, int frames, float gain)
+    {
+        for (int i = 0; i < frames; i++)
+        {
+            float sum = 0.0f;
+            for (int ch = 0; ch < channels; ch++)
+                sum += in[i * channels + ch];
+            out[i] = sum * gain;
+        }
+    }
+
+    // The channels argument of the specialized kernels is only there to share the signature; N is used instead
+
+    template<int N> void Interleave(const float* const* in, float* out, int, int frames)
+    {
+        int i = 0;
+#if UNITY_SSE
+        if (N == 2)
+        {
+            for (; i + 3 < frames; i += 4)
+            {
+                __m128 a = _mm_loadu_ps(in[0] + i), b = _mm_loadu_ps(in[1] + i);
+                _mm_storeu_ps(out + i * 2, _mm_unpacklo_ps(a, b));
+                _mm_storeu_ps(out + i * 2 + 4, _mm_unpackhi_ps(a, b));
+            }
+        }
+        else if (N % 4 == 0)
+        {
+            // 4 frames of 4 channels at a time, transposed in registers
+            for (; i + 3 < frames; i += 4)
+            {
+                for (int ch = 0; ch < N; ch += 4)
+                {
+                    __m128 r0 = _mm_loadu_ps(in[ch] + i), r1 = _mm_loadu_ps(in[ch + 1] + i);
+                    __m128 r2 = _mm_loadu_ps(in[ch + 2] + i), r3 = _mm_loadu_ps(in[ch + 3] + i);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _mm_storeu_ps(out + i * N + ch, r0);
+                    _mm_storeu_ps(out + (i + 1) * N + ch, r1);
+                    _mm_storeu_ps(out + (i + 2) * N + ch, r2);
+                    _mm_storeu_ps(out + (i + 3) * N + ch, r3);
+                }
+            }
+        }
+#endif
+        for (; i < frames; i++)
+            for (int ch = 0; ch < N; ch++)
+                out[i * N + ch] = in[ch][i];
+    }
+
+    template<> inline void Interleave<1>(const float* const* in, float* out, int, int frames)
+    {
+        memcpy(out, in[0], frames * sizeof(float));
+    }
+
+    template<int N> void Deinterleave(const float* in, float* out, int stride, int, int frames)
+    {
+        int i = 0;
+#if UNITY_SSE
+        if (N == 2)
+        {
+            for (; i + 3 < frames; i += 4)
+            {
+                __m128 a = _mm_loadu_ps(in + i * 2), b = _mm_loadu_ps(in + i * 2 + 4);
+                _mm_storeu_ps(out + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)));
+                _mm_storeu_ps(out + stride + i, _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+            }
+        }
+        else if (N % 4 == 0)
+        {
+            for (; i + 3 < frames; i += 4)
+            {
+                for (int ch = 0; ch < N; ch += 4)
+                {
+                    __m128 r0 = _mm_loadu_ps(in + i * N + ch), r1 = _mm_loadu_ps(in + (i + 1) * N + ch);
+                    __m128 r2 = _mm_loadu_ps(in + (i + 2) * N + ch), r3 = _mm_loadu_ps(in + (i + 3) * N + ch);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    _mm_storeu_ps(out + ch * stride + i, r0);
+                    _mm_storeu_ps(out + (ch + 1) * stride + i, r1);
+                    _mm_storeu_ps(out + (ch + 2) * stride + i, r2);
+                    _mm_storeu_ps(out + (ch + 3) * stride + i, r3);
+                }
+            }
+        }
+#endif
+        for (; i < frames; i++)
+            for (int ch = 0; ch < N; ch++)
+                out[ch * stride + i] = in[i * N + ch];
+    }
+
+    template<> inline void Deinterleave<1>(const float* in, float* out, int, int, int frames)
+    {
+        memcpy(out, in, frames * sizeof(float));
+    }
+
+    template<int N> void Downmix(const float* in, float* out, int, int frames, float gain)
+    {
+        int i = 0;
+#if UNITY_SSE
+        const __m128 g = _mm_set1_ps(gain);
+        if (N == 2)
+        {
+            for (; i + 3 < frames; i += 4)
+            {
+                __m128 a = _mm_loadu_ps(in + i * 2), b = _mm_loadu_ps(in + i * 2 + 4);
+                __m128 sum = _mm_add_ps(_mm_shuffle_ps(a, b, _MM_SHUFFLE(2, 0, 2, 0)), _mm_shuffle_ps(a, b, _MM_SHUFFLE(3, 1, 3, 1)));
+                _mm_storeu_ps(out + i, _mm_mul_ps(sum, g));
+            }
+        }
+        else if (N % 4 == 0)
+        {
+            // the transposed rows of 4 channels add up to the sums of 4 frames at once
+            for (; i + 3 < frames; i += 4)
+            {
+                __m128 sum = _mm_setzero_ps();
+                for (int ch = 0; ch < N; ch += 4)
+                {
+                    __m128 r0 = _mm_loadu_ps(in + i * N + ch), r1 = _mm_loadu_ps(in + (i + 1) * N + ch);
+                    __m128 r2 = _mm_loadu_ps(in + (i + 2) * N + ch), r3 = _mm_loadu_ps(in + (i + 3) * N + ch);
+                    _MM_TRANSPOSE4_PS(r0, r1, r2, r3);
+                    sum = _mm_add_ps(sum, _mm_add_ps(_mm_add_ps(r0, r1), _mm_add_ps(r2, r3)));
+                }
+                _mm_storeu_ps(out + i, _mm_mul_ps(sum, g));
+            }
+        }
+#endif
+        for (; i < frames; i++)
+        {
+            float sum = 0.0f;
+            for (int ch = 0; ch < N; ch++)
+                sum += in[i * N + ch];
+            out[i] = sum * gain;
+        }
+    }
+
+    template<> inline void Downmix<1>(const float* in, float* out, int, int frames, float gain)
+    {
+        for (int i = 0; i < frames; i++)
+            out[i] = in[i] * gain;
+    }
+
+#define CHANNEL_KERNELS_SELECT(kernel, channels) \
+    switch (channels) \
+    { \
+        case 1: return kernel<1>; \
+        case 2: return kernel<2>; \
+        case 4: return kernel<4>; \
+        case 8: return kernel<8>; \
+        case 16: return kernel<16>; \
+        case 32: return kernel<32>; \
+        case 64: return kernel<64>; \
+        default: return kernel##Generic; \
+    }
+
+    inline InterleaveFn SelectInterleave(int channels) { CHANNEL_KERNELS_SELECT(Interleave, channels) }
+    inline DeinterleaveFn SelectDeinterleave(int channels) { CHANNEL_KERNELS_SELECT(Deinterleave, channels) }
+    inline DownmixFn SelectDownmix(int channels) { CHANNEL_KERNELS_SELECT(Downmix, channels) }
+
+#undef CHANNEL_KERNELS_SELECT
+
+}
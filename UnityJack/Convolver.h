@@ -0,0 +1,346 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "AudioPluginUtil.h"
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// acc[n] += a[n] * b[n] over interleaved complex spectra
+inline void ComplexMultiplyAccumulate(const UnityComplexNumber* a, const UnityComplexNumber* b, UnityComplexNumber* acc, int numbins)
+{
+    const float* pa = &a[0].re;
+    const float* pb = &b[0].re;
+    float* pacc = &acc[0].re;
+    int n = 0;
+#if UNITY_SSE
+    const __m128 sign = _mm_set_ps(1.0f, -1.0f, 1.0f, -1.0f);
+    for (; n + 1 < numbins; n += 2)
+    {
+        __m128 va = _mm_loadu_ps(pa + 2 * n);
+        __m128 vb = _mm_loadu_ps(pb + 2 * n);
+        __m128 bre = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(2, 2, 0, 0));
+        __m128 bim = _mm_shuffle_ps(vb, vb, _MM_SHUFFLE(3, 3, 1, 1));
+        __m128 aswap = _mm_shuffle_ps(va, va, _MM_SHUFFLE(2, 3, 0, 1));
+        __m128 t = _mm_add_ps(_mm_mul_ps(va, bre), _mm_mul_ps(_mm_mul_ps(aswap, bim), sign));
+        _mm_storeu_ps(pacc + 2 * n, _mm_add_ps(_mm_loadu_ps(pacc + 2 * n), t));
+    }
+#endif
+    for (; n < numbins; n++)
+    {
+        pacc[2 * n] += pa[2 * n] * pb[2 * n] - pa[2 * n + 1] * pb[2 * n + 1];
+        pacc[2 * n + 1] += pa[2 * n] * pb[2 * n + 1] + pa[2 * n + 1] * pb[2 * n];
+    }
+}
+
+// One uniformly partitioned overlap-save stage with a frequency-domain delay line.
+// Every call to Process consumes one block and returns the matching output block with no added latency. The same
+// work can be done in steps instead: Begin takes the block, Accumulate adds some of the partitions, and End, once
+// every partition was added, returns the output block.
+class ConvolutionStage
+{
+public:
+    ConvolutionStage() : blocksize(0), numbins(0), numpartitions(0), fdlpos(0) {}
+
+    void Init(const float* ir, int irlength, int _blocksize)
+    {
+        blocksize = _blocksize;
+        numbins = blocksize + 1;
+        numpartitions = (irlength + blocksize - 1) / blocksize;
+        fdlpos = 0;
+
+        // Make sure the plan exists before the audio thread needs it
+        FFTPlan::Get(blocksize);
+
+        filter.assign(numpartitions * numbins, UnityComplexNumber());
+        fdl.assign(numpartitions * numbins, UnityComplexNumber());
+        accum.assign(numbins, UnityComplexNumber());
+        inputbuffer.assign(2 * blocksize, 0.0f);
+        outputbuffer.assign(2 * blocksize, 0.0f);
+
+        std::vector<float> segment(2 * blocksize);
+        for (int p = 0; p < numpartitions; p++)
+        {
+            int offset = p * blocksize;
+            int count = (irlength - offset < blocksize) ? irlength - offset : blocksize;
+            std::fill(segment.begin(), segment.end(), 0.0f);
+            memcpy(segment.data(), ir + offset, sizeof(float) * count);
+            FFT::ForwardReal(segment.data(), &filter[p * numbins], 2 * blocksize);
+        }
+    }
+
+    void Process(const float* input, float* output)
+    {
+        Begin(input);
+        Accumulate(0, numpartitions);
+        End(output);
+    }
+
+    void Begin(const float* input)
+    {
+        memmove(inputbuffer.data(), inputbuffer.data() + blocksize, sizeof(float) * blocksize);
+        memcpy(inputbuffer.data() + blocksize, input, sizeof(float) * blocksize);
+        FFT::ForwardReal(inputbuffer.data(), &fdl[fdlpos * numbins], 2 * blocksize);
+        memset(accum.data(), 0, sizeof(UnityComplexNumber) * numbins);
+    }
+
+    // Adds partitions [first, last) of the filter
+    void Accumulate(int first, int last)
+    {
+        int slot = fdlpos - first;
+        if (slot < 0)
+            slot += numpartitions;
+        for (int p = first; p < last; p++)
+        {
+            ComplexMultiplyAccumulate(&fdl[slot * numbins], &filter[p * numbins], accum.data(), numbins);
+            slot = (slot == 0) ? numpartitions - 1 : slot - 1;
+        }
+    }
+
+    void End(float* output)
+    {
+        fdlpos = (fdlpos == numpartitions - 1) ? 0 : fdlpos + 1;
+        FFT::BackwardReal(accum.data(), outputbuffer.data(), 2 * blocksize);
+        memcpy(output, outputbuffer.data() + blocksize, sizeof(float) * blocksize);
+    }
+
+    bool IsEmpty() const { return numpartitions == 0; }
+    int GetNumPartitions() const { return numpartitions; }
+
+private:
+    int blocksize;
+    int numbins;
+    int numpartitions;
+    int fdlpos;
+    std::vector<UnityComplexNumber> filter;
+    std::vector<UnityComplexNumber> fdl;
+    std::vector<UnityComplexNumber> accum;
+    std::vector<float> inputbuffer;
+    std::vector<float> outputbuffer;
+};
+
+// Two-stage non-uniform partitioned convolution. The head stage uses the JACK block size and applies the first
+// 2 * kTailFactor blocks of the impulse response without latency; the rest of the response runs in a tail stage
+// with kTailFactor times larger partitions. The tail takes its input a tail block at a time, and the head covers two
+// of them, so each tail block has a whole tail period to be computed in: the forward transform, the partitions and
+// the inverse transform are spread over the kTailFactor cycles of the period, and every cycle costs about the same.
+// Its result is played in the period after that, and the whole filter stays latency-free.
+class PartitionedConvolver
+{
+public:
+    enum { kTailFactor = 8 };
+
+    PartitionedConvolver() : blocksize(0), tailblocksize(0), tailphase(0), tailbank(0) {}
+
+    void Init(const float* ir, int irlength, int _blocksize)
+    {
+        blocksize = _blocksize;
+        tailblocksize = blocksize * kTailFactor;
+        tailphase = 0;
+        tailbank = 0;
+
+        int headlength = (irlength < 2 * tailblocksize) ? irlength : 2 * tailblocksize;
+        head.Init(ir, headlength, blocksize);
+        tail.Init(ir + headlength, irlength - headlength, tailblocksize);
+        tailinput.assign(2 * tailblocksize, 0.0f);
+        tailoutput.assign(2 * tailblocksize, 0.0f);
+
+        // The transforms go to the first and last cycle of the period, so those get fewer partitions. Either one
+        // costs about as much as log2(tailblocksize) partitions of multiply-adds.
+        int numpartitions = tail.GetNumPartitions();
+        int transform = 0;
+        for (int n = tailblocksize; n > 1; n >>= 1)
+            transform++;
+        int total = numpartitions + 2 * transform;
+        for (int step = 0; step <= kTailFactor; step++)
+        {
+            int share = (int)(((int64_t)total * step) / kTailFactor) - transform;
+            tailsplit[step] = (share < 0) ? 0 : (share > numpartitions) ? numpartitions : share;
+        }
+        tailsplit[kTailFactor] = numpartitions;
+    }
+
+    void Process(const float* input, float* output)
+    {
+        head.Process(input, output);
+        if (tail.IsEmpty())
+            return;
+
+        // this period's input goes into one bank while the tail block in the other is computed; the block computed
+        // in the last period is played from this bank while the other one receives the new result
+        int offset = tailphase * blocksize;
+        float* filling = tailinput.data() + tailbank * tailblocksize;
+        const float* playing = tailoutput.data() + tailbank * tailblocksize;
+        memcpy(filling + offset, input, sizeof(float) * blocksize);
+        for (int n = 0; n < blocksize; n++)
+            output[n] += playing[offset + n];
+
+        const int other = (1 - tailbank) * tailblocksize;
+        if (tailphase == 0)
+            tail.Begin(tailinput.data() + other);
+        tail.Accumulate(tailsplit[tailphase], tailsplit[tailphase + 1]);
+        if (tailphase == kTailFactor - 1)
+            tail.End(tailoutput.data() + other);
+
+        if (++tailphase == kTailFactor)
+        {
+            tailphase = 0;
+            tailbank = 1 - tailbank;
+        }
+    }
+
+    bool IsEmpty() const { return head.IsEmpty(); }
+    int GetBlockSize() const { return blocksize; }
+
+private:
+    int blocksize;
+    int tailblocksize;
+    int tailphase;
+    int tailbank;                       // input bank being filled, output bank being played
+    int tailsplit[kTailFactor + 1];     // partitions of the tail added in cycle i of a period: [tailsplit[i], tailsplit[i + 1])
+    ConvolutionStage head;
+    ConvolutionStage tail;
+    std::vector<float> tailinput;       // two tail blocks
+    std::vector<float> tailoutput;
+};
+
+// Per-channel convolution inserts. Impulse responses are partitioned and transformed on a background loader
+// thread and handed to the audio thread through an atomic slot; replaced convolvers are handed back the same
+// way and freed by the loader, so the audio thread never allocates or frees.
+class ConvolutionEngine
+{
+public:
+    ConvolutionEngine(int channels, int blocksize)
+    : mBlockSize(blocksize)
+    , mSlots(channels)
+    , mRunning(true)
+    {
+        mLoader = std::thread(&ConvolutionEngine::LoaderThread, this);
+    }
+
+    ~ConvolutionEngine()
+    {
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            mRunning = false;
+        }
+        mWake.notify_one();
+        mLoader.join();
+
+        for (size_t i = 0; i < mSlots.size(); i++)
+        {
+            delete mSlots[i].pending.load();
+            delete mSlots[i].retired.load();
+            delete mSlots[i].active;
+        }
+    }
+
+    // Queues a new impulse response for a channel. An empty response removes the insert.
+    bool Load(int channel, const float* ir, int length)
+    {
+        if (channel < 0 || channel >= (int)mSlots.size() || length < 0) return false;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        mJobs.push_back(Job());
+        mJobs.back().channel = channel;
+        mJobs.back().ir.assign(ir, ir + length);
+        mWake.notify_one();
+        return true;
+    }
+
+    // Realtime: returns false when the channel has no active insert, in which case output is untouched
+    bool Process(int channel, const float* input, float* output, int numsamples)
+    {
+        Slot& slot = mSlots[channel];
+
+        // Only this thread ever fills the retired slot, so once it is seen empty it stays empty until we store to it.
+        // If the loader hasn't collected the last replaced convolver yet, the swap waits for a later cycle.
+        if (slot.retired.load(std::memory_order_acquire) == nullptr)
+        {
+            PartitionedConvolver* incoming = slot.pending.exchange(nullptr, std::memory_order_acquire);
+            if (incoming != nullptr)
+            {
+                slot.retired.store(slot.active, std::memory_order_release);
+                slot.active = incoming;
+            }
+        }
+
+        PartitionedConvolver* active = slot.active;
+        if (active == nullptr || active->IsEmpty() || active->GetBlockSize() != numsamples)
+            return false;
+
+        active->Process(input, output);
+        return true;
+    }
+
+private:
+    struct Slot
+    {
+        Slot() : pending(nullptr), retired(nullptr), active(nullptr) {}
+        std::atomic<PartitionedConvolver*> pending;
+        std::atomic<PartitionedConvolver*> retired;
+        PartitionedConvolver* active; // Only touched by the audio thread
+    };
+
+    struct Job
+    {
+        int channel;
+        std::vector<float> ir;
+    };
+
+    void LoaderThread()
+    {
+        std::unique_lock<std::mutex> lock(mMutex);
+        while (mRunning)
+        {
+            mWake.wait_for(lock, std::chrono::milliseconds(100));
+
+            while (!mJobs.empty())
+            {
+                Job job;
+                job.channel = mJobs.front().channel;
+                job.ir.swap(mJobs.front().ir);
+                mJobs.pop_front();
+
+                lock.unlock();
+                PartitionedConvolver* convolver = new PartitionedConvolver();
+                convolver->Init(job.ir.data(), (int)job.ir.size(), mBlockSize);
+                delete mSlots[job.channel].pending.exchange(convolver, std::memory_order_acq_rel);
+                lock.lock();
+            }
+
+            for (size_t i = 0; i < mSlots.size(); i++)
+                delete mSlots[i].retired.exchange(nullptr, std::memory_order_acq_rel);
+        }
+    }
+
+    int mBlockSize;
+    std::vector<Slot> mSlots;
+    bool mRunning;
+    std::deque<Job> mJobs;
+    std::mutex mMutex;
+    std::condition_variable mWake;
+    std::thread mLoader;
+};
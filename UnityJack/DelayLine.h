@@ -0,0 +1,184 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "AudioPluginUtil.h"
+#include "BufferArena.h"
+
+#include <atomic>
+#include <memory>
+
+// Speaker alignment: a fractional delay per output port, read from a HistoryBuffer of the port's past blocks
+// through a 4 tap Lagrange interpolator. Whole samples are exact; the worst fraction, half a sample, is about
+// 1 dB down at a quarter of the sample rate. Delays are set from any thread with an atomic store; the audio
+// thread crossfades from the old to the new delay over its next cycle, so moving a delay never clicks or sweeps
+// the pitch.
+// Every channel's history is carved from the arena up front, so setting a delay never allocates.
+class AlignmentDelays
+{
+public:
+    static size_t GetArenaBytes(int channels, int maxDelay, int blocksize)
+    {
+        return channels * BufferArena::Align(sizeof(float) * HistoryBuffer::GetLength(maxDelay + blocksize + kTaps));
+    }
+
+    // arena: at least GetArenaBytes(channels, maxDelay, blocksize) left in it
+    AlignmentDelays(BufferArena& arena, int channels, int maxDelay, int blocksize)
+    : mChannels(channels)
+    , mMaxDelay(maxDelay)
+    , mBlockSize(blocksize)
+    , mLines(new Line[channels])
+    , mActive(false)
+    {
+        const int length = maxDelay + blocksize + kTaps;
+        for (int i = 0; i < channels; i++)
+            mLines[i].history.Init(length, arena.Allocate<float>(HistoryBuffer::GetLength(length)));
+    }
+
+    int GetMaxDelay() const { return mMaxDelay; }
+
+    // Any thread: the delay of a channel in samples, clamped to [0, GetMaxDelay()]. The channel is processed from
+    // its first delay on; until then it costs nothing.
+    bool Set(int channel, float samples)
+    {
+        if (channel < 0 || channel >= mChannels || !(samples >= 0.0f)) return false;
+        if (samples > (float)mMaxDelay) samples = (float)mMaxDelay;
+
+        Line& line = mLines[channel];
+        if (line.history.data == nullptr) return false;
+        line.target.store(samples, std::memory_order_relaxed);
+        line.enabled.store(true, std::memory_order_release);
+        mActive.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // Whether any channel has a delay line at all
+    bool IsActive() const { return mActive.load(std::memory_order_acquire); }
+
+    // Realtime: delays one block of a channel in place. Channels without a delay line are left untouched.
+    void Process(int channel, float* block, int numsamples)
+    {
+        Line& line = mLines[channel];
+        if (!line.enabled.load(std::memory_order_acquire) || numsamples > mBlockSize) return;
+
+        line.history.FeedBlock(block, numsamples);
+        float target = line.target.load(std::memory_order_relaxed);
+        if (target == line.current && target == 0.0f) return;
+
+        Taps from = MakeTaps(line.current), to = MakeTaps(target);
+        Render(line.history, from, to, target != line.current, block, numsamples);
+        line.current = target;
+    }
+
+private:
+    enum { kTaps = 4 };
+
+    struct Line
+    {
+        Line() : target(0.0f), enabled(false), current(0.0f) {}
+        HistoryBuffer history;
+        std::atomic<float> target;
+        std::atomic<bool> enabled;
+        float current;  // the delay played last cycle, only touched by the audio thread
+    };
+
+    // out[n] = sum of h[k] * x[n - base - k]; the delay sits between the two middle taps where it can
+    struct Taps
+    {
+        int base;
+        float h[kTaps];
+    };
+
+    static Taps MakeTaps(float delay)
+    {
+        Taps taps;
+        int whole = (int)delay;
+        taps.base = whole >= 1 ? whole - 1 : 0;
+        float t = delay - (float)taps.base;
+        taps.h[0] = -(t - 1.0f) * (t - 2.0f) * (t - 3.0f) * (1.0f / 6.0f);
+        taps.h[1] = t * (t - 2.0f) * (t - 3.0f) * 0.5f;
+        taps.h[2] = -t * (t - 1.0f) * (t - 3.0f) * 0.5f;
+        taps.h[3] = t * (t - 1.0f) * (t - 2.0f) * (1.0f / 6.0f);
+        return taps;
+    }
+
+    // Index in the history of the oldest tap of the block's first sample
+    static int WindowStart(const HistoryBuffer& history, const Taps& taps, int numsamples)
+    {
+        return (history.GetWriteIndex() - (numsamples - 1) - taps.base - (kTaps - 1)) & history.mask;
+    }
+
+    static float Tap(const HistoryBuffer& history, const Taps& taps, int start, int n)
+    {
+        float sum = 0.0f;
+        for (int k = 0; k < kTaps; k++)
+            sum += taps.h[k] * history.data[(start + n + (kTaps - 1 - k)) & history.mask];
+        return sum;
+    }
+
+    // The block read at the delay of to, or crossfaded from the delay of from when fade is set
+    static void Render(const HistoryBuffer& history, const Taps& from, const Taps& to, bool fade, float* out, int numsamples)
+    {
+        const int a = WindowStart(history, from, numsamples), b = WindowStart(history, to, numsamples);
+        const int span = numsamples + kTaps - 1;
+        const float step = 1.0f / (float)numsamples;
+        int n = 0;
+#if UNITY_SSE
+        // Each window is contiguous except in the one cycle of every few where it wraps around the history
+        if (b + span <= history.length && (!fade || a + span <= history.length))
+        {
+            const float* pa = history.data + a;
+            const float* pb = history.data + b;
+            __m128 g = _mm_mul_ps(_mm_set_ps(4.0f, 3.0f, 2.0f, 1.0f), _mm_set1_ps(step));
+            const __m128 dg = _mm_set1_ps(4.0f * step);
+            for (; n + 3 < numsamples; n += 4)
+            {
+                __m128 y = _mm_add_ps(
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(to.h[3]), _mm_loadu_ps(pb + n)), _mm_mul_ps(_mm_set1_ps(to.h[2]), _mm_loadu_ps(pb + n + 1))),
+                    _mm_add_ps(_mm_mul_ps(_mm_set1_ps(to.h[1]), _mm_loadu_ps(pb + n + 2)), _mm_mul_ps(_mm_set1_ps(to.h[0]), _mm_loadu_ps(pb + n + 3))));
+                if (fade)
+                {
+                    __m128 x = _mm_add_ps(
+                        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(from.h[3]), _mm_loadu_ps(pa + n)), _mm_mul_ps(_mm_set1_ps(from.h[2]), _mm_loadu_ps(pa + n + 1))),
+                        _mm_add_ps(_mm_mul_ps(_mm_set1_ps(from.h[1]), _mm_loadu_ps(pa + n + 2)), _mm_mul_ps(_mm_set1_ps(from.h[0]), _mm_loadu_ps(pa + n + 3))));
+                    y = _mm_add_ps(x, _mm_mul_ps(_mm_sub_ps(y, x), g));
+                    g = _mm_add_ps(g, dg);
+                }
+                _mm_storeu_ps(out + n, y);
+            }
+        }
+#endif
+        for (; n < numsamples; n++)
+        {
+            float y = Tap(history, to, b, n);
+            if (fade)
+            {
+                float x = Tap(history, from, a, n);
+                y = x + (y - x) * step * (float)(n + 1);
+            }
+            out[n] = y;
+        }
+    }
+
+    int mChannels;
+    int mMaxDelay;
+    int mBlockSize;
+    std::unique_ptr<Line[]> mLines;
+    std::atomic<bool> mActive;
+};
@@ -20,13 +20,29 @@
 #include <jack/ringbuffer.h>
 #include <jack/types.h>
 
+#include "AudioTransport.h"
+#include "BiquadBank.h"
+#include "BufferArena.h"
+#include "ChannelKernels.h"
+#include "Convolver.h"
+#include "DelayLine.h"
+#include "OutputProtection.h"
+#include "RoutingMatrix.h"
+#include "SampleFormat.h"
+#include "TraceRecorder.h"
+#include "WorkerPool.h"
+
+#include <algorithm>
 #include <iostream>
 #include <string>
 #include <stdexcept>  // for std::runtime_error
 #include <vector>     // for std::vector
+#include <memory>     // for std::unique_ptr
 
 #define RINGBUF_SIZE 8192
-class InternalJackClient
+#define MAX_OUTPUT_DELAY_MS 100.0f // longest speaker alignment delay
+#define MAX_MONITOR_ROUTES 4096     // input to output crosspoints of the monitoring matrix
+class InternalJackClient : public AudioTransport
 {
 
 public:
@@ -35,20 +51,64 @@ public:
     typedef jack_port_t                 port_t;
 
     InternalJackClient(const std::string name = "Unity3D", const int inputs = 2,
-        const int outputs = 2)
+        const int outputs = 2, const int workers = 0, const ThreadConfig threads = ThreadConfig(),
+        const size_t extraArenaBytes = 0, const RingFormat format = RingFormat_Float32)
     : mClientName(name)
     , mClient(nullptr)
     , mInputs(inputs)
     , mOutputs(outputs)
+    , mFormat(format)
+    , mSampleBytes(SampleFormat::SampleBytes(format))
+    , mInterleaveInputs(ChannelKernels::SelectInterleave(inputs))
     {
 
         jack_status_t status;
         mClient = jack_client_open(name.c_str(), JackNullOption, &status);
         if (!mClient) throw std::runtime_error("Cannot create the client.");
 
+        mBufferFrames   = jack_get_buffer_size(mClient);
+        mSampleRate     = jack_get_sample_rate(mClient);
+
+        /* the ringbuffers, per-cycle buffers and output delay histories come from one arena, locked into RAM if
+        requested. The other processing stages built further down allocate their own memory, also before the client
+        is activated; mlockall covers them where it is available, on Windows only the arena is locked */
+        if (threads.lockMemory && !ThreadUtil::LockProcessMemory())
+            std::cout << "Could not lock memory, check the memlock limit" << std::endl;
+
+        const int maxOutputDelay = (int)ceilf(MAX_OUTPUT_DELAY_MS * 0.001f * mSampleRate);
+        size_t outRingBytes = mOutputs * mSampleBytes * RINGBUF_SIZE;
+        size_t inRingBytes = mInputs * mSampleBytes * RINGBUF_SIZE;
+        size_t arenaBytes = BufferArena::RingbufferBytes(outRingBytes)
+                          + BufferArena::RingbufferBytes(inRingBytes)
+                          + 2 * BufferArena::Align(sizeof(port_t*) * mInputs)
+                          + 2 * BufferArena::Align(sizeof(port_t*) * mOutputs)
+                          + BufferArena::Align(sizeof(sample_t) * mInputs * mBufferFrames)
+                          + BufferArena::Align(sizeof(sample_t) * mBufferFrames)
+                          + 2 * BufferArena::Align(OutputMaskBytes(mOutputs))
+                          + 2 * BufferArena::Align(mSampleBytes * mBufferFrames)
+                          + BufferArena::Align(sizeof(sample_t) * mInputs * mBufferFrames)
+                          + 2 * BufferArena::Align(mSampleBytes * mInputs * mBufferFrames)
+                          + AlignmentDelays::GetArenaBytes(mOutputs, maxOutputDelay, mBufferFrames)
+                          + extraArenaBytes;
+        if (!mArena.Reserve(arenaBytes, threads.lockMemory)) throw std::runtime_error("Cannot allocate the client memory");
+
         /* create the ringbuffers */
-        _rbout = jack_ringbuffer_create(mOutputs * sizeof(jack_default_audio_sample_t) * RINGBUF_SIZE);
-        _rbin = jack_ringbuffer_create(mInputs * sizeof(jack_default_audio_sample_t) * RINGBUF_SIZE);
+        _rbout = mArena.CreateRingbuffer(outRingBytes);
+        _rbin = mArena.CreateRingbuffer(inRingBytes);
+
+        mInputPorts = mArena.Allocate<port_t*>(mInputs);
+        mOutputPorts = mArena.Allocate<port_t*>(mOutputs);
+        mIn = mArena.Allocate<sample_t*>(mInputs);
+        mOut = mArena.Allocate<sample_t*>(mOutputs);
+        mConvolved = mArena.Allocate<sample_t>(mInputs * mBufferFrames);
+        mOutputRow = mArena.Allocate<sample_t>(mBufferFrames);
+        mWriteMask = mArena.Allocate<uint32_t>(OutputMaskWords(mOutputs));
+        mReadMask = mArena.Allocate<uint32_t>(OutputMaskWords(mOutputs));
+        mOutputEncoded = mArena.Allocate<uint8_t>(mSampleBytes * mBufferFrames);
+        mPlayEncoded = mArena.Allocate<uint8_t>(mSampleBytes * mBufferFrames);
+        mInputFrames = mArena.Allocate<sample_t>(mInputs * mBufferFrames);
+        mInputEncoded = mArena.Allocate<uint8_t>(mSampleBytes * mInputs * mBufferFrames);
+        mReceiveEncoded = mArena.Allocate<uint8_t>(mSampleBytes * mInputs * mBufferFrames);
 
 
         /* tell the JACK server to call `process()' whenever
@@ -64,37 +124,37 @@ public:
 
         jack_on_shutdown(mClient, InternalJackClient::Shutdown, this);
 
+        jack_set_xrun_callback(mClient, InternalJackClient::Xrun, this);
+
 
         //allocate ports
-        if (mInputs > 0){
-            for(unsigned int i = 0; i < mInputs; i++){
-                std::string portname = "in";
-                portname.append(std::to_string(i));
-                mInputPorts.push_back(
-                        jack_port_register (mClient, portname.c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0));
-            }
-            //reserve the data for the jack callback buffers
-            for(unsigned int i = 0; i < mInputPorts.size(); i++)
-                mIn.push_back(NULL);
-        } 
-        if (mOutputs > 0){
-            for(unsigned int i = 0; i < mOutputs; i++){
-                std::string portname = "out";
-                portname.append(std::to_string(i));
-                mOutputPorts.push_back(
-                        jack_port_register (mClient, portname.c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0));
-            }
-            //reserve the data for the jack callback buffers
-            for(unsigned int i = 0; i < mOutputPorts.size(); i++)
-                mOut.push_back(NULL);
-        } 
+        for(unsigned int i = 0; i < mInputs; i++){
+            std::string portname = "in";
+            portname.append(std::to_string(i));
+            mInputPorts[i] = jack_port_register (mClient, portname.c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsInput, 0);
+        }
+        for(unsigned int i = 0; i < mOutputs; i++){
+            std::string portname = "out";
+            portname.append(std::to_string(i));
+            mOutputPorts[i] = jack_port_register (mClient, portname.c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0);
+        }
 
-        mBufferFrames   = jack_get_buffer_size(mClient);
-        mSampleRate     = jack_get_sample_rate(mClient);
-        
-        mOutBufferBytes = mBufferFrames * mOutputs * sizeof(sample_t);
-        mInBufferBytes = mBufferFrames * mInputs * sizeof(sample_t);
+        // convolution inserts on the inputs, processed before the samples reach the ringbuffer
+        mInputConvolution.reset(new ConvolutionEngine(mInputs, mBufferFrames));
+
+        // speaker EQ, alignment delays and protection on the outputs, applied after the ringbuffer
+        mOutputEq.reset(new BiquadBank(mOutputs, mBufferFrames, (float)mSampleRate));
+        mEqActive = false;
+        mOutputDelays.reset(new AlignmentDelays(mArena, mOutputs, maxOutputDelay, mBufferFrames));
+        mOutputProtection.reset(new OutputProtection(mOutputs, mBufferFrames, (float)mSampleRate));
 
+        // direct monitoring of the inputs on the outputs, within the cycle
+        mMonitor.reset(new RoutingMatrix(mInputs, mOutputs, std::min(mInputs * mOutputs, MAX_MONITOR_ROUTES)));
+
+        // helper threads for the per-port work, by default at the same realtime priority as the jack thread
+        int priority = threads.workerPriority;
+        if (priority < 0) priority = jack_is_realtime(mClient) ? jack_client_real_time_priority(mClient) : 0;
+        mWorkers.reset(new WorkerPool(workers, priority, threads.workerCpus));
         
     	if (jack_activate(mClient) != 0) throw std::runtime_error("Cannot activate the client");
 
@@ -111,46 +171,222 @@ public:
       }
     }
 
-    void setAudioBuffer(sample_t *buffer)
+    void setAudioBuffer(sample_t *buffer) override
     {
         if (mClient == nullptr) return; // This might be called before the client deinitializes
 
-        if (jack_ringbuffer_write_space(_rbout) > 0) jack_ringbuffer_write(_rbout, (char*)buffer, mOutBufferBytes);
+        if (!beginOutputs(nullptr)) return;
+        for (int ch = 0; ch < mOutputs; ch++)
+        {
+            for (int i = 0; i < mBufferFrames; i++)
+                mOutputRow[i] = buffer[i * mOutputs + ch];
+            writeOutputRow(mOutputRow);
+        }
+    }
+
+    // Only the active ports go through the ringbuffer; the JACK callback writes silence to the others
+    void setAudioChannels(const sample_t *channels, int stride, const uint8_t *active) override
+    {
+        if (mClient == nullptr) return;
+
+        if (!beginOutputs(active)) return;
+        for (int ch = 0; ch < mOutputs; ch++)
+            if (active == nullptr || active[ch])
+                writeOutputRow(&channels[ch * stride]);
+    }
+
+    void setAudioRows(const sample_t *const *rows) override
+    {
+        if (mClient == nullptr) return;
+
+        if (!beginOutputs(nullptr, rows)) return;
+        for (int ch = 0; ch < mOutputs; ch++)
+            if (rows[ch] != nullptr)
+                writeOutputRow(rows[ch]);
     }
     
-    void getAudioBuffer(sample_t *buffer)
+    void getAudioBuffer(sample_t *buffer) override
     {
         if (mClient == nullptr) return; // This might be called before the client deinitializes
 
-        if (jack_ringbuffer_read_space(_rbin) > 0) jack_ringbuffer_read(_rbin, (char*)buffer, mInBufferBytes);
+        readInput(buffer, mBufferFrames);
+    }
+
+    bool readInput(sample_t *buffer, int frames) override
+    {
+        if (mClient == nullptr) return false;
+
+        if (jack_ringbuffer_read_space(_rbin) < (size_t)(frames * mInputs * mSampleBytes))
+        {
+            TraceRecorder::getInstance().Instant(Trace_InputUnderrun);
+            return false;
+        }
+        if (mFormat == RingFormat_Float32)
+        {
+            jack_ringbuffer_read(_rbin, (char*)buffer, frames * mInputs * sizeof(sample_t));
+            return true;
+        }
+        // the block may be longer than a JACK cycle, so it is decoded a cycle at a time
+        for (int done = 0; done < frames; done += mBufferFrames)
+        {
+            int count = std::min(frames - done, mBufferFrames) * mInputs;
+            jack_ringbuffer_read(_rbin, (char*)mReceiveEncoded, count * mSampleBytes);
+            SampleFormat::Decode(mFormat, mReceiveEncoded, buffer + done * mInputs, count);
+        }
+        return true;
+    }
+
+    RingFormat getRingFormat() const { return mFormat; }
+
+    // Number of uint32_t words in the channel mask that heads every output cycle in the ringbuffer
+    static int OutputMaskWords(int outputs) { return (outputs + 31) / 32; }
+    static size_t OutputMaskBytes(int outputs) { return OutputMaskWords(outputs) * sizeof(uint32_t); }
+
+    BufferArena& arena() override { return mArena; }
+
+    // Replaces the impulse response convolved with an input port; the partitioning runs in the background.
+    // An empty impulse response removes the insert.
+    bool setInputConvolution(int port, const float *ir, int length) override
+    {
+        if (mClient == nullptr || !mInputConvolution) return false;
+
+        return mInputConvolution->Load(port, ir, length);
+    }
+
+    bool setOutputDelay(int port, float milliseconds) override
+    {
+        if (mClient == nullptr || !mOutputDelays) return false;
+
+        return mOutputDelays->Set(port, milliseconds * 0.001f * mSampleRate);
+    }
+
+    bool setOutputEq(int port, int band, int type, float frequency, float gain, float q) override
+    {
+        if (mClient == nullptr || !mOutputEq) return false;
+
+        return mOutputEq->Set(port, band, type, frequency, gain, q);
+    }
+
+    bool setOutputProtection(int port, bool enabled, float thresholdDb) override
+    {
+        if (mClient == nullptr || !mOutputProtection) return false;
+
+        return mOutputProtection->Set(port, enabled, thresholdDb);
+    }
+
+    bool setMonitorRoute(int input, int output, float gain) override
+    {
+        if (mClient == nullptr || !mMonitor) return false;
+
+        return mMonitor->Set(input, output, gain);
+    }
+
+    bool clearMonitorRoutes() override
+    {
+        if (mClient == nullptr || !mMonitor) return false;
+
+        mMonitor->Clear();
+        return true;
+    }
+
+    int getOutputGainReduction(float *reductionDb, int count) override
+    {
+        if (mClient == nullptr || !mOutputProtection) return 0;
+
+        return mOutputProtection->GetGainReduction(reductionDb, count);
+    }
+
+    // Per-port work on an input, may run on any of the worker threads
+    static void ProcessInputPort(void *arg, int port)
+    {
+        InternalJackClient *client = (InternalJackClient *)arg;
+        sample_t *convolved = &client->mConvolved[port * client->mBufferFrames];
+        if (client->mInputConvolution->Process(port, client->mIn[port], convolved, client->mCycleFrames))
+            client->mIn[port] = convolved;
+    }
+
+    // Work on a group of BiquadBank::kLanes output ports, may run on any of the worker threads
+    static void ProcessOutputGroup(void *arg, int group)
+    {
+        InternalJackClient *client = (InternalJackClient *)arg;
+        sample_t **rows = client->mOut + group * BiquadBank::kLanes;
+        if (client->mEqActive)
+            client->mOutputEq->Process(group, rows, client->mCycleFrames);
+        int last = std::min(client->mOutputs, (group + 1) * (int)BiquadBank::kLanes);
+        for (int port = group * BiquadBank::kLanes; port < last; port++)
+            client->mOutputDelays->Process(port, client->mOut[port], client->mCycleFrames);
+        if (client->mOutputProtection->IsActive())
+            client->mOutputProtection->Process(group, rows, client->mCycleFrames);
     }
 
     static int Process(jack_nframes_t nframes, void *arg)
     {
         InternalJackClient *client = (InternalJackClient *)arg;
+        TraceScope trace(Trace_JackProcess);
         //get the input and output buffers
         for (unsigned int i = 0; i < client->mInputs; i++)
             client->mIn[i] = (jack_default_audio_sample_t *)jack_port_get_buffer(client->mInputPorts[i], nframes);
         for (unsigned int i = 0; i < client->mOutputs; i++)
             client->mOut[i] = (jack_default_audio_sample_t *)jack_port_get_buffer(client->mOutputPorts[i], nframes);
 
-        for (int i = 0; i < nframes; i++)
+        client->mCycleFrames = nframes;
+        client->mWorkers->Run(client->mInputs, InternalJackClient::ProcessInputPort, client);
+
+        // IN: the cycle goes into the ringbuffer interleaved and whole, or not at all when Unity has fallen behind
+        int inSamples = nframes * client->mInputs;
+        if ((int)nframes <= client->mBufferFrames
+            && jack_ringbuffer_write_space(client->_rbin) >= (size_t)(inSamples * client->mSampleBytes))
         {
-            // IN
-            for (int ch = 0; ch < client->mInputs; ch++)
+            client->mInterleaveInputs(client->mIn, client->mInputFrames, client->mInputs, nframes);
+
+            if (client->mFormat == RingFormat_Float32)
+                jack_ringbuffer_write(client->_rbin, (char *)client->mInputFrames, inSamples * sizeof(sample_t));
+            else
             {
-                jack_ringbuffer_write(client->_rbin, (char *)client->mIn[ch], sizeof(jack_default_audio_sample_t));
-                client->mIn[ch]++;
-                
+                SampleFormat::Encode(client->mFormat, client->mInputFrames, client->mInputEncoded, inSamples, client->mInputDither);
+                jack_ringbuffer_write(client->_rbin, (char *)client->mInputEncoded, inSamples * client->mSampleBytes);
             }
+        }
+        else
+            TraceRecorder::getInstance().Instant(Trace_InputOverflow);
+        if (TraceRecorder::getInstance().IsEnabled())
+        {
+            TraceRecorder::getInstance().Counter(Trace_InputRing, jack_ringbuffer_read_space(client->_rbin));
+            TraceRecorder::getInstance().Counter(Trace_OutputRing, jack_ringbuffer_read_space(client->_rbout));
+        }
+
+        // OUT: the active ports of the cycle are read straight into their buffers, silent ones are zeroed. When
+        // Unity hasn't delivered a whole cycle, play silence rather than whatever is left in the port buffers.
+        size_t maskBytes = OutputMaskBytes(client->mOutputs);
+        size_t rowBytes = nframes * client->mSampleBytes;
+        bool haveOutput = (int)nframes == client->mBufferFrames
+            && jack_ringbuffer_peek(client->_rbout, (char *)client->mReadMask, maskBytes) == maskBytes
+            && jack_ringbuffer_read_space(client->_rbout) >= maskBytes + client->countOutputs(client->mReadMask) * rowBytes;
+        if (haveOutput) jack_ringbuffer_read_advance(client->_rbout, maskBytes);
+        else TraceRecorder::getInstance().Instant(Trace_OutputUnderrun);
 
-            // OUT
-            for (int ch = 0; ch < client->mOutputs; ch++)
+        for (int ch = 0; ch < client->mOutputs; ch++)
+        {
+            if (!haveOutput || !(client->mReadMask[ch / 32] & (1u << (ch % 32))))
+                memset(client->mOut[ch], 0, nframes * sizeof(sample_t));
+            else if (client->mFormat == RingFormat_Float32)
+                jack_ringbuffer_read(client->_rbout, (char *)client->mOut[ch], rowBytes);
+            else
             {
-                jack_ringbuffer_read(client->_rbout, (char *)client->mOut[ch], sizeof(jack_default_audio_sample_t));
-                client->mOut[ch]++;
+                jack_ringbuffer_read(client->_rbout, (char *)client->mPlayEncoded, rowBytes);
+                SampleFormat::Decode(client->mFormat, client->mPlayEncoded, client->mOut[ch], nframes);
             }
         }
+
+        // monitored inputs join the cycle's outputs before the output stage, so they get the same EQ and protection
+        client->mMonitor->Process(client->mIn, client->mOut, nframes);
+
+        client->mEqActive = client->mOutputEq->BeginCycle();
+        if (client->mEqActive || client->mOutputDelays->IsActive() || client->mOutputProtection->IsActive())
+        {
+            TraceScope stage(Trace_OutputStage);
+            client->mWorkers->Run(client->mOutputEq->GetGroups(), InternalJackClient::ProcessOutputGroup, client);
+        }
         
         return 0;
     }
@@ -158,7 +394,55 @@ public:
     static void Shutdown(void *arg)
     {}
 
+    static int Xrun(void *arg)
+    {
+        TraceRecorder::getInstance().Instant(Trace_Xrun);
+        return 0;
+    }
+
 private:
+
+    // Writes the channel mask of a new output cycle, once the ringbuffer has room for the whole cycle. The active
+    // ports are the flagged ones, or the ones with a row when rows are given.
+    bool beginOutputs(const uint8_t *active, const sample_t *const *rows = nullptr)
+    {
+        int words = OutputMaskWords(mOutputs);
+        memset(mWriteMask, 0, words * sizeof(uint32_t));
+        for (int ch = 0; ch < mOutputs; ch++)
+        {
+            bool on = (rows != nullptr) ? rows[ch] != nullptr : (active == nullptr || active[ch]);
+            if (on) mWriteMask[ch / 32] |= 1u << (ch % 32);
+        }
+
+        size_t bytes = OutputMaskBytes(mOutputs) + countOutputs(mWriteMask) * mBufferFrames * mSampleBytes;
+        if (jack_ringbuffer_write_space(_rbout) < bytes)
+        {
+            TraceRecorder::getInstance().Instant(Trace_OutputRingFull);
+            return false;
+        }
+        jack_ringbuffer_write(_rbout, (const char*)mWriteMask, OutputMaskBytes(mOutputs));
+        return true;
+    }
+
+    // Writes one output port's row of a cycle in the ringbuffer format
+    void writeOutputRow(const sample_t *row)
+    {
+        if (mFormat == RingFormat_Float32)
+        {
+            jack_ringbuffer_write(_rbout, (const char*)row, mBufferFrames * sizeof(sample_t));
+            return;
+        }
+        SampleFormat::Encode(mFormat, row, mOutputEncoded, mBufferFrames, mOutputDither);
+        jack_ringbuffer_write(_rbout, (const char*)mOutputEncoded, mBufferFrames * mSampleBytes);
+    }
+
+    int countOutputs(const uint32_t *mask) const
+    {
+        int count = 0;
+        for (int ch = 0; ch < mOutputs; ch++)
+            if (mask[ch / 32] & (1u << (ch % 32))) count++;
+        return count;
+    }
  
     jack_client_t* mClient;
     int mInputs;
@@ -166,16 +450,40 @@ private:
     
     int mBufferFrames;
     int mSampleRate;
+    int mCycleFrames;
     
-    int mOutBufferBytes;
-    int mInBufferBytes;
+    RingFormat mFormat;
+    int mSampleBytes;   // size of a sample in the ringbuffers
+    ChannelKernels::InterleaveFn mInterleaveInputs;   // specialized for mInputs
 
     
     jack_ringbuffer_t* _rbin;
     jack_ringbuffer_t* _rbout;
     std::string mClientName;
-    std::vector<jack_port_t *> mOutputPorts;
-    std::vector<jack_port_t *> mInputPorts;
-    std::vector<sample_t*> mOut; 
-	std::vector<sample_t*> mIn; 
+    BufferArena mArena;
+    port_t **mOutputPorts;
+    port_t **mInputPorts;
+    sample_t **mOut;
+    sample_t **mIn;
+
+    std::unique_ptr<ConvolutionEngine> mInputConvolution;
+    sample_t *mConvolved;
+    std::unique_ptr<BiquadBank> mOutputEq;
+    bool mEqActive;         // whether this cycle runs the EQ, set before the output groups are processed
+    std::unique_ptr<AlignmentDelays> mOutputDelays;
+    std::unique_ptr<OutputProtection> mOutputProtection;
+    std::unique_ptr<RoutingMatrix> mMonitor;
+    sample_t *mOutputRow;   // setAudioBuffer's deinterleaving row
+    uint32_t *mWriteMask;   // active output ports of the cycle being written
+    uint32_t *mReadMask;    // and of the cycle being played
+
+    // conversion to and from the ringbuffer format, on the Unity side and on the JACK side
+    uint8_t *mOutputEncoded;
+    uint8_t *mPlayEncoded;
+    sample_t *mInputFrames;
+    uint8_t *mInputEncoded;
+    uint8_t *mReceiveEncoded;
+    SampleFormat::Dither mOutputDither;
+    SampleFormat::Dither mInputDither;
+    std::unique_ptr<WorkerPool> mWorkers;
 };
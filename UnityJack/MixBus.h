@@ -0,0 +1,234 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "AudioPluginUtil.h"
+#include "BufferArena.h"
+
+#include <atomic>
+#include <stdint.h>
+
+// dst[n] += src[n] * gain, with the gain ramped linearly from gain0 towards gain1 across the block
+inline void MixAccumulate(float* dst, const float* src, float gain0, float gain1, int numsamples)
+{
+    const float step = (gain1 - gain0) / (float)numsamples;
+    int n = 0;
+#if UNITY_SSE
+    __m128 g = _mm_add_ps(_mm_set1_ps(gain0), _mm_mul_ps(_mm_set1_ps(step), _mm_set_ps(3.0f, 2.0f, 1.0f, 0.0f)));
+    const __m128 dg = _mm_set1_ps(4.0f * step);
+    for (; n + 3 < numsamples; n += 4)
+    {
+        _mm_storeu_ps(dst + n, _mm_add_ps(_mm_loadu_ps(dst + n), _mm_mul_ps(_mm_loadu_ps(src + n), g)));
+        g = _mm_add_ps(g, dg);
+    }
+#endif
+    for (; n < numsamples; n++)
+        dst[n] += src[n] * (gain0 + step * (float)n);
+}
+
+// dst[n] += src[n]
+inline void MixAdd(float* dst, const float* src, int numsamples)
+{
+    int n = 0;
+#if UNITY_SSE
+    for (; n + 3 < numsamples; n += 4)
+        _mm_storeu_ps(dst + n, _mm_add_ps(_mm_loadu_ps(dst + n), _mm_loadu_ps(src + n)));
+#endif
+    for (; n < numsamples; n++)
+        dst[n] += src[n];
+}
+
+// Largest absolute sample value of a block
+inline float MaxAbs(const float* src, int numsamples)
+{
+    float peak = 0.0f;
+    int n = 0;
+#if UNITY_SSE
+    const __m128 signmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+    __m128 m = _mm_setzero_ps();
+    for (; n + 3 < numsamples; n += 4)
+        m = _mm_max_ps(m, _mm_and_ps(_mm_loadu_ps(src + n), signmask));
+    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(1, 0, 3, 2)));
+    m = _mm_max_ps(m, _mm_shuffle_ps(m, m, _MM_SHUFFLE(2, 3, 0, 1)));
+    peak = _mm_cvtss_f32(m);
+#endif
+    for (; n < numsamples; n++)
+        peak = FastMax(peak, fabsf(src[n]));
+    return peak;
+}
+
+// Blocks whose peak stays below this (about -140 dBFS, under the resolution of a 24 bit converter) count as silent
+const float kSilenceThreshold = 1.0e-7f;
+
+inline bool IsSilent(const float* src, int numsamples)
+{
+    return MaxAbs(src, numsamples) < kSilenceThreshold;
+}
+
+// Summing bus that any number of effects on any of Unity's mixer threads add into during a DSP tick, without locks.
+// Every thread accumulates into a bank of rows it claims for the tick, so up to kMaxThreads threads can mix in the
+// same tick while the banks of the previous one are still being reduced. Banks belong to a tick, not a thread:
+// mixer threads that come and go (Unity recreates them when the audio setup changes) never use them up. Rows are
+// only cleared when something is first mixed into them in a tick, so channels nobody feeds cost nothing until the
+// reduction, which zero-fills them. The first caller that sees a new tick sums every bank of the previous tick,
+// which is complete at that point because Unity finishes a tick before starting the next, and frees the banks.
+class MixBus
+{
+public:
+    enum { kMaxThreads = 8, kBanks = kMaxThreads * 2 };
+
+    // One thread's rows for one tick
+    class Bank
+    {
+    public:
+        Bank() : data(nullptr), touched(nullptr), frames(0), stamp(0) {}
+
+        // Realtime: the channel's row of frames samples, zeroed the first time it is asked for in the tick
+        float* Row(int channel)
+        {
+            float* row = data + channel * frames;
+            if (!touched[channel])
+            {
+                memset(row, 0, sizeof(float) * frames);
+                touched[channel] = 1;
+            }
+            return row;
+        }
+
+    private:
+        friend class MixBus;
+        float* data;
+        uint8_t* touched;   // channels mixed into during the tick of stamp
+        int frames;
+        std::atomic<uint64_t> stamp; // tick + 1 the bank was claimed for, 0 while free
+    };
+
+    MixBus() : mChannels(0), mFrames(0), mCollected(0) {}
+
+    static size_t GetArenaBytes(int channels, int frames)
+    {
+        return (BufferArena::Align(sizeof(float) * channels * frames) + BufferArena::Align(channels)) * kBanks;
+    }
+
+    bool Init(BufferArena& arena, int channels, int frames)
+    {
+        mChannels = channels;
+        mFrames = frames;
+        bool ok = true;
+        for (int i = 0; i < kBanks; i++)
+        {
+            mBanks[i].data = arena.Allocate<float>(channels * frames);
+            mBanks[i].touched = arena.Allocate<uint8_t>(channels);
+            mBanks[i].frames = frames;
+            mBanks[i].stamp.store(0, std::memory_order_relaxed);
+            ok = ok && mBanks[i].data != nullptr && mBanks[i].touched != nullptr;
+        }
+        mCollected.store(0, std::memory_order_relaxed);
+        return ok;
+    }
+
+    int GetChannels() const { return mChannels; }
+    int GetFrames() const { return mFrames; }
+
+    // Realtime: the calling thread's bank for the tick, claimed on its first call in the tick. nullptr when every
+    // bank is taken, which takes more than kMaxThreads threads mixing into the same tick.
+    Bank* Begin(uint64_t tick)
+    {
+        if (mBanks[0].data == nullptr) return nullptr;
+
+        uint64_t stamp = tick + 1;
+        static thread_local Claim claim = { nullptr, 0, nullptr };
+        if (claim.bus == this && claim.stamp == stamp && claim.bank->stamp.load(std::memory_order_relaxed) == stamp)
+            return claim.bank;
+
+        for (int i = 0; i < kBanks; i++)
+        {
+            uint64_t free = 0;
+            if (mBanks[i].stamp.load(std::memory_order_relaxed) != 0
+                || !mBanks[i].stamp.compare_exchange_strong(free, stamp, std::memory_order_acq_rel))
+                continue;
+            memset(mBanks[i].touched, 0, mChannels);
+            claim.bus = this;
+            claim.stamp = stamp;
+            claim.bank = &mBanks[i];
+            return claim.bank;
+        }
+        return nullptr;
+    }
+
+    // Realtime: when the tick is one the bus hasn't seen yet, sums every thread's rows of the previous tick into
+    // out (planar, GetFrames() samples per channel) and returns true. Exactly one caller per tick gets true.
+    // Channels nothing was mixed into are zeroed and, when active is given, flagged 0 there.
+    bool Collect(uint64_t tick, float* out, uint8_t* active = nullptr)
+    {
+        uint64_t stamp = tick + 1;
+        uint64_t previous = mCollected.load(std::memory_order_acquire);
+        if (previous == stamp || !mCollected.compare_exchange_strong(previous, stamp, std::memory_order_acq_rel))
+            return false;
+        if (previous == 0 || mBanks[0].data == nullptr) return false;
+
+        Bank* sources[kBanks];
+        int numsources = 0;
+        for (int i = 0; i < kBanks; i++)
+            if (mBanks[i].stamp.load(std::memory_order_acquire) == previous)
+                sources[numsources++] = &mBanks[i];
+
+        for (int ch = 0; ch < mChannels; ch++)
+        {
+            float* row = out + ch * mFrames;
+            bool filled = false;
+            for (int i = 0; i < numsources; i++)
+            {
+                if (!sources[i]->touched[ch]) continue;
+                const float* src = sources[i]->data + ch * mFrames;
+                if (filled)
+                    MixAdd(row, src, mFrames);
+                else
+                    memcpy(row, src, sizeof(float) * mFrames);
+                filled = true;
+            }
+            if (!filled) memset(row, 0, sizeof(float) * mFrames);
+            if (active != nullptr) active[ch] = filled ? 1 : 0;
+        }
+
+        // the banks of the previous tick, and any of older ticks nobody collected, are free again; those already
+        // claimed for this tick stay with their threads
+        for (int i = 0; i < kBanks; i++)
+        {
+            uint64_t held = mBanks[i].stamp.load(std::memory_order_relaxed);
+            if (held != 0 && held != stamp)
+                mBanks[i].stamp.compare_exchange_strong(held, 0, std::memory_order_release);
+        }
+        return true;
+    }
+
+private:
+    // The bank a thread claimed last, so later effects on the thread in the same tick mix into it too
+    struct Claim
+    {
+        const MixBus* bus;
+        uint64_t stamp;
+        Bank* bank;
+    };
+
+    int mChannels;
+    int mFrames;
+    Bank mBanks[kBanks];
+    alignas(64) std::atomic<uint64_t> mCollected;   // tick + 1 of the last tick that triggered a Collect
+};
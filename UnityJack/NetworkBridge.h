@@ -0,0 +1,573 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+// Winsock 2 has to come before anything that pulls in windows.h
+#if defined(_WIN32)
+    #include <winsock2.h>
+    #include <ws2tcpip.h>
+    #if defined(_MSC_VER)
+        #pragma comment(lib, "ws2_32.lib")
+    #endif
+#else
+    #include <arpa/inet.h>
+    #include <fcntl.h>
+    #include <netdb.h>
+    #include <netinet/in.h>
+    #include <sys/socket.h>
+    #include <sys/time.h>
+    #include <unistd.h>
+#endif
+
+#include "AudioTransport.h"
+#include "SampleFormat.h"
+
+#include <algorithm>
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+// Streams the plugin's output blocks over UDP to UnityJackReceiver, a JACK client on the audio machine, instead
+// of a JACK server in this process.
+//
+// Every block gets a sequence number and goes out as one packet per run of consecutive active channels, each
+// channel a planar row in one of the ring formats. A silent block still sends a bare header, so the receiver can
+// tell silence from loss. The receiver holds a few blocks in a jitter buffer before playing them; lost blocks and
+// channels play silence.
+namespace NetworkBridge
+{
+
+    enum
+    {
+        kMagic = 0x4b414a55,    // "UJAK"
+        kVersion = 1,
+        kDefaultPort = 9500,
+        kMaxPayload = 1400,     // keeps packets within an ethernet frame whenever one channel's row fits
+        kMaxFrames = 4096,
+        kMaxChannels = 1024
+    };
+
+    // Header and rows are sent in host byte order, so both ends have to share it; big-endian peers are not supported
+    struct PacketHeader
+    {
+        uint32_t magic;
+        uint32_t sequence;  // block number
+        uint16_t frames;    // frames per block
+        uint16_t channels;  // channels in the stream
+        uint16_t first;     // first channel in this packet
+        uint16_t count;     // channels in this packet, one row of frames each after the header
+        uint8_t format;     // RingFormat of the rows
+        uint8_t version;
+        uint16_t reserved;
+    };
+
+#if defined(_WIN32)
+    typedef SOCKET socket_t;
+    const socket_t kInvalidSocket = INVALID_SOCKET;
+    inline void CloseSocket(socket_t s) { closesocket(s); }
+#else
+    typedef int socket_t;
+    const socket_t kInvalidSocket = -1;
+    inline void CloseSocket(socket_t s) { close(s); }
+#endif
+
+    class UdpSocket
+    {
+    public:
+        UdpSocket() : mSocket(kInvalidSocket)
+        {
+#if defined(_WIN32)
+            WSADATA wsa;
+            WSAStartup(MAKEWORD(2, 2), &wsa);
+#endif
+        }
+
+        ~UdpSocket()
+        {
+            Close();
+#if defined(_WIN32)
+            WSACleanup();
+#endif
+        }
+
+        UdpSocket(UdpSocket const&) = delete;
+        void operator=(UdpSocket const&) = delete;
+
+        // Socket that sends to host:port. Sends never block; a packet the socket has no room for is dropped.
+        bool Connect(const char* host, int port)
+        {
+            if (!Resolve(host, port, false)) return false;
+            if (connect(mSocket, (sockaddr*)&mAddress, sizeof(mAddress)) != 0) return false;
+#if defined(_WIN32)
+            u_long nonblocking = 1;
+            ioctlsocket(mSocket, FIONBIO, &nonblocking);
+#else
+            fcntl(mSocket, F_SETFL, fcntl(mSocket, F_GETFL, 0) | O_NONBLOCK);
+#endif
+            return true;
+        }
+
+        // Socket that receives on port, on every interface when host is empty. Port 0 picks a free one.
+        bool Bind(const char* host, int port)
+        {
+            if (!Resolve((host != nullptr && host[0] != '\0') ? host : nullptr, port, true)) return false;
+            if (bind(mSocket, (sockaddr*)&mAddress, sizeof(mAddress)) != 0) return false;
+            int buffer = 4 << 20;
+            setsockopt(mSocket, SOL_SOCKET, SO_RCVBUF, (const char*)&buffer, sizeof(buffer));
+            return true;
+        }
+
+        int LocalPort() const
+        {
+            sockaddr_in address;
+            socklen_t length = sizeof(address);
+            if (getsockname(mSocket, (sockaddr*)&address, &length) != 0) return 0;
+            return ntohs(address.sin_port);
+        }
+
+        int Send(const void* data, int bytes)
+        {
+            return (int)send(mSocket, (const char*)data, bytes, 0);
+        }
+
+        // Waits up to timeoutMs for a datagram; returns its size, or <= 0 when none arrived
+        int Receive(void* data, int bytes, int timeoutMs)
+        {
+            fd_set set;
+            FD_ZERO(&set);
+            FD_SET(mSocket, &set);
+            timeval timeout;
+            timeout.tv_sec = timeoutMs / 1000;
+            timeout.tv_usec = (timeoutMs % 1000) * 1000;
+            if (select((int)mSocket + 1, &set, nullptr, nullptr, &timeout) <= 0) return 0;
+            return (int)recv(mSocket, (char*)data, bytes, 0);
+        }
+
+        void Close()
+        {
+            if (mSocket != kInvalidSocket) CloseSocket(mSocket);
+            mSocket = kInvalidSocket;
+        }
+
+    private:
+        bool Resolve(const char* host, int port, bool passive)
+        {
+            Close();
+            addrinfo hints, *result = nullptr;
+            memset(&hints, 0, sizeof(hints));
+            hints.ai_family = AF_INET;
+            hints.ai_socktype = SOCK_DGRAM;
+            hints.ai_flags = passive ? AI_PASSIVE : 0;
+            std::string service = std::to_string(port);
+            if (getaddrinfo(host, service.c_str(), &hints, &result) != 0 || result == nullptr) return false;
+            memcpy(&mAddress, result->ai_addr, sizeof(mAddress));
+            freeaddrinfo(result);
+            mSocket = socket(AF_INET, SOCK_DGRAM, IPPROTO_UDP);
+            return mSocket != kInvalidSocket;
+        }
+
+        socket_t mSocket;
+        sockaddr_in mAddress;
+    };
+
+    // Sending end, in place of InternalJackClient in the plugin. Blocks go out straight from the Unity audio thread
+    // that publishes them; a UDP send doesn't wait on the network. There are no inputs over the network, the
+    // receive side reads silence.
+    class NetworkClient : public AudioTransport
+    {
+    public:
+        NetworkClient(const std::string host, const int port, const int inputs, const int outputs, const int frames,
+            const size_t extraArenaBytes = 0, const RingFormat format = RingFormat_Float32)
+        : mInputs(inputs)
+        , mOutputs(outputs)
+        , mFrames(frames)
+        , mFormat(format)
+        , mSampleBytes(SampleFormat::SampleBytes(format))
+        , mSequence(0)
+        {
+            if (outputs <= 0 || outputs > kMaxChannels || frames <= 0 || frames > kMaxFrames)
+                throw std::runtime_error("Unsupported stream size");
+            if (!mSocket.Connect(host.c_str(), port)) throw std::runtime_error("Cannot reach " + host);
+
+            // one row per packet at least, more while they fit in the payload
+            int rowBytes = mFrames * mSampleBytes;
+            mRowsPerPacket = std::max(1, (int)(kMaxPayload - sizeof(PacketHeader)) / rowBytes);
+            mPacketBytes = sizeof(PacketHeader) + mRowsPerPacket * rowBytes;
+
+            size_t arenaBytes = BufferArena::Align(mPacketBytes)
+                              + BufferArena::Align(sizeof(float) * mOutputs * mFrames)
+                              + BufferArena::Align(sizeof(float*) * mOutputs)
+                              + extraArenaBytes;
+            if (!mArena.Reserve(arenaBytes, false)) throw std::runtime_error("Cannot allocate the client memory");
+            mPacket = mArena.Allocate<uint8_t>(mPacketBytes);
+            mPlanar = mArena.Allocate<float>(mOutputs * mFrames);
+            mRows = mArena.Allocate<const float*>(mOutputs);
+        }
+
+        void setAudioBuffer(float *buffer) override
+        {
+            for (int ch = 0; ch < mOutputs; ch++)
+                for (int i = 0; i < mFrames; i++)
+                    mPlanar[ch * mFrames + i] = buffer[i * mOutputs + ch];
+            setAudioChannels(mPlanar, mFrames, nullptr);
+        }
+
+        void setAudioChannels(const float *channels, int stride, const uint8_t *active) override
+        {
+            for (int ch = 0; ch < mOutputs; ch++)
+                mRows[ch] = (active == nullptr || active[ch]) ? &channels[ch * stride] : nullptr;
+            setAudioRows(mRows);
+        }
+
+        void setAudioRows(const float *const *rows) override
+        {
+            PacketHeader* header = (PacketHeader*)mPacket;
+            header->magic = kMagic;
+            header->sequence = mSequence++;
+            header->frames = (uint16_t)mFrames;
+            header->channels = (uint16_t)mOutputs;
+            header->format = (uint8_t)mFormat;
+            header->version = kVersion;
+            header->reserved = 0;
+
+            bool sent = false;
+            int ch = 0;
+            while (ch < mOutputs)
+            {
+                if (rows[ch] == nullptr)
+                {
+                    ch++;
+                    continue;
+                }
+                int first = ch, count = 0;
+                uint8_t* row = mPacket + sizeof(PacketHeader);
+                for (; ch < mOutputs && count < mRowsPerPacket && rows[ch] != nullptr; ch++, count++)
+                {
+                    SampleFormat::Encode(mFormat, rows[ch], row, mFrames, mDither);
+                    row += mFrames * mSampleBytes;
+                }
+                header->first = (uint16_t)first;
+                header->count = (uint16_t)count;
+                mSocket.Send(mPacket, (int)(row - mPacket));
+                sent = true;
+            }
+            if (!sent)
+            {
+                header->first = 0;
+                header->count = 0;
+                mSocket.Send(mPacket, sizeof(PacketHeader));
+            }
+        }
+
+        void getAudioBuffer(float *buffer) override
+        {
+            memset(buffer, 0, sizeof(float) * mInputs * mFrames);
+        }
+
+        bool readInput(float * /*buffer*/, int /*frames*/) override { return false; }
+
+        BufferArena& arena() override { return mArena; }
+
+    private:
+        int mInputs;
+        int mOutputs;
+        int mFrames;
+        RingFormat mFormat;
+        int mSampleBytes;
+        int mRowsPerPacket;
+        int mPacketBytes;
+        uint32_t mSequence;
+
+        UdpSocket mSocket;
+        BufferArena mArena;
+        uint8_t* mPacket;
+        float* mPlanar;     // setAudioBuffer's deinterleaved block
+        const float** mRows;    // setAudioChannels' rows
+        SampleFormat::Dither mDither;
+    };
+
+    // Receiving end: a thread takes packets off the socket into a ring of block slots, and Pull plays them out a
+    // few blocks behind the newest, at whatever cycle size the caller has. The slot count bounds how far ahead of
+    // playback a block may arrive.
+    class NetworkReceiver
+    {
+    public:
+        enum { kSlots = 64 };
+
+        struct Stats
+        {
+            uint64_t packets;   // valid packets taken in
+            uint64_t late;      // packets that came after playback of their block had started
+            uint64_t early;     // packets that came kSlots blocks or more before their block was due
+            uint64_t lost;      // blocks played as silence because nothing of them arrived
+            uint64_t resyncs;   // times playback jumped to catch up with or wait for the sender
+        };
+
+        // latency: blocks held back to absorb jitter. Playback lets the sender get up to 3 * latency blocks ahead
+        // before it skips, and all of those have to fit in the slots, so latency is at most (kSlots - 1) / 3.
+        NetworkReceiver(int channels, int latency)
+        : mChannels(channels)
+        , mLatency(std::max(1, std::min(latency, ((int)kSlots - 1) / 3)))
+        , mFrames(0)
+        , mNewest(0)
+        , mPlayed(0)
+        , mRunning(false)
+        , mStarted(false)
+        , mPlaying(false)
+        , mPlaySequence(0)
+        , mOffset(0)
+        {
+            mPackets = mLate = mEarly = mLost = mResyncs = 0;
+            mPlayingChannels.assign(channels, 0);
+            for (int i = 0; i < kSlots; i++)
+                mSlots[i].stamp.store(0, std::memory_order_relaxed);
+        }
+
+        ~NetworkReceiver() { Stop(); }
+
+        // Listens on port (0 picks one, see GetPort) of the interface at host, or all of them when it is empty
+        bool Start(const char* host, int port)
+        {
+            Stop();
+            if (!mSocket.Bind(host, port)) return false;
+            mRunning = true;
+            mThread = std::thread(&NetworkReceiver::Run, this);
+            return true;
+        }
+
+        void Stop()
+        {
+            mRunning = false;
+            if (mThread.joinable()) mThread.join();
+            mSocket.Close();
+        }
+
+        int GetPort() const { return mSocket.LocalPort(); }
+        int GetChannels() const { return mChannels; }
+
+        // Frames per block of the stream, 0 until the first packet
+        int GetFrames() const { return mFrames.load(std::memory_order_acquire); }
+
+        Stats GetStats() const
+        {
+            Stats stats;
+            stats.packets = mPackets.load(std::memory_order_relaxed);
+            stats.late = mLate.load(std::memory_order_relaxed);
+            stats.early = mEarly.load(std::memory_order_relaxed);
+            stats.lost = mLost.load(std::memory_order_relaxed);
+            stats.resyncs = mResyncs.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+        // Realtime: the next frames of every channel into outputs[channel]. Plays silence while the jitter buffer
+        // fills, and for blocks or channels that never arrived.
+        void Pull(float** outputs, int frames)
+        {
+            int blockFrames = GetFrames();
+            uint32_t newest = mNewest.load(std::memory_order_acquire);
+            if (blockFrames > 0 && newest != 0)
+            {
+                uint32_t latest = newest - 1;
+                int32_t ahead = (int32_t)(latest - mPlaySequence);    // blocks in hand past the one playing
+                if (!mStarted || ahead < -(int32_t)kSlots)
+                {
+                    // first block, or the sender restarted: play from it once the buffer has filled
+                    if (mStarted) mResyncs.fetch_add(1, std::memory_order_relaxed);
+                    mPlaySequence = latest;
+                    mPlayed.store(mPlaySequence, std::memory_order_release);
+                    mOffset = 0;
+                    mStarted = true;
+                    mPlaying = false;
+                }
+                else if (ahead > 3 * mLatency)
+                {
+                    // the sender got far ahead (clock drift, a stall here), skip to the nominal latency
+                    mResyncs.fetch_add(1, std::memory_order_relaxed);
+                    mPlaySequence = latest - (uint32_t)mLatency;
+                    mPlayed.store(mPlaySequence, std::memory_order_release);
+                    mOffset = 0;
+                }
+                else if (!mPlaying && ahead >= mLatency)
+                    mPlaying = true;
+                else if (mPlaying && mOffset == 0 && ahead < 0)
+                {
+                    // played everything that came in, hold still until the buffer has filled again
+                    mResyncs.fetch_add(1, std::memory_order_relaxed);
+                    mPlaying = false;
+                }
+            }
+            if (!mPlaying)
+            {
+                for (int ch = 0; ch < mChannels; ch++)
+                    memset(outputs[ch], 0, sizeof(float) * frames);
+                return;
+            }
+
+            int done = 0;
+            while (done < frames)
+            {
+                int count = std::min(frames - done, blockFrames - mOffset);
+                Slot& slot = mSlots[mPlaySequence % kSlots];
+                if (mOffset == 0)
+                {
+                    // Starting the block: from here on the receiving thread drops its packets, so the channels
+                    // that arrived in time are the ones played, from the first frame to the last. Run marks the
+                    // slot before it checks mPlayed, and we publish mPlayed before checking the slot, so either it
+                    // sees the block started or we see it writing, and then play the block as lost.
+                    mPlayed.store(mPlaySequence + 1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    bool present = slot.stamp.load(std::memory_order_acquire) == mPlaySequence + 1;
+                    for (int ch = 0; ch < mChannels; ch++)
+                        mPlayingChannels[ch] = present && slot.received[ch];
+                    if (!present) mLost.fetch_add(1, std::memory_order_relaxed);
+                }
+                for (int ch = 0; ch < mChannels; ch++)
+                {
+                    if (mPlayingChannels[ch])
+                        memcpy(outputs[ch] + done, &slot.data[ch * blockFrames + mOffset], sizeof(float) * count);
+                    else
+                        memset(outputs[ch] + done, 0, sizeof(float) * count);
+                }
+                // nothing writes the slot while its block plays; check that it still holds the block anyway
+                std::atomic_thread_fence(std::memory_order_acquire);
+                if (slot.stamp.load(std::memory_order_relaxed) != mPlaySequence + 1)
+                {
+                    for (int ch = 0; ch < mChannels; ch++)
+                        memset(outputs[ch] + done, 0, sizeof(float) * count);
+                }
+                done += count;
+                mOffset += count;
+                if (mOffset == blockFrames)
+                {
+                    mOffset = 0;
+                    mPlaySequence++;
+                }
+            }
+        }
+
+    private:
+        struct Slot
+        {
+            std::vector<float> data;        // planar, channels x frames
+            std::vector<uint8_t> received;  // channels that arrived for the block
+            std::atomic<uint32_t> stamp;    // sequence + 1 of the block held, 0 while it is being replaced
+        };
+
+        void Run()
+        {
+            std::vector<uint8_t> packet(65536);
+            std::vector<float> decoded;
+            while (mRunning)
+            {
+                int bytes = mSocket.Receive(packet.data(), (int)packet.size(), 100);
+                if (bytes < (int)sizeof(PacketHeader)) continue;
+
+                const PacketHeader* header = (const PacketHeader*)packet.data();
+                RingFormat format = (RingFormat)header->format;
+                if (header->magic != kMagic || header->version != kVersion || header->format >= RingFormat_Count)
+                    continue;
+                int sampleBytes = SampleFormat::SampleBytes(format);
+                if (bytes < (int)sizeof(PacketHeader) + header->count * header->frames * sampleBytes) continue;
+                if (header->first + header->count > header->channels) continue;
+                if (!Prepare(header->frames)) continue;
+                mPackets.fetch_add(1, std::memory_order_relaxed);
+
+                uint32_t sequence = header->sequence;
+                uint32_t newest = mNewest.load(std::memory_order_relaxed);
+                if (newest == 0 || (int32_t)(sequence + 1 - newest) > 0 || (int32_t)(sequence + 1 - newest) < -(int32_t)kSlots)
+                    mNewest.store(sequence + 1, std::memory_order_release);  // newer, or the sender restarted
+                else if ((int32_t)(sequence - mPlayed.load(std::memory_order_acquire)) < 0)
+                {
+                    mLate.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                // kSlots or more past the block playing, which is up to one before mPlayed, its slot still holds a
+                // block to be played. Pull skips ahead once it sees the newest, and the packets after that fit.
+                if (sequence - mPlayed.load(std::memory_order_acquire) >= (uint32_t)kSlots - 1)
+                {
+                    mEarly.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+
+                // Mark the slot as being written, then make sure playback hasn't started on the block meanwhile;
+                // Pull does the same the other way round (see there)
+                Slot& slot = mSlots[sequence % kSlots];
+                const bool same = slot.stamp.load(std::memory_order_relaxed) == sequence + 1;
+                slot.stamp.store(0, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if ((int32_t)(sequence - mPlayed.load(std::memory_order_relaxed)) < 0)
+                {
+                    if (same) slot.stamp.store(sequence + 1, std::memory_order_release);
+                    mLate.fetch_add(1, std::memory_order_relaxed);
+                    continue;
+                }
+                if (!same)
+                    std::fill(slot.received.begin(), slot.received.end(), 0);
+                const int frames = header->frames;
+                const uint8_t* row = packet.data() + sizeof(PacketHeader);
+                for (int i = 0; i < header->count; i++, row += frames * sampleBytes)
+                {
+                    int ch = header->first + i;
+                    if (ch >= mChannels) break;
+                    SampleFormat::Decode(format, row, &slot.data[ch * frames], frames);
+                    slot.received[ch] = 1;
+                }
+                slot.stamp.store(sequence + 1, std::memory_order_release);
+            }
+        }
+
+        // Sizes the slots for the stream's block on its first packet; a stream with other blocks is ignored
+        bool Prepare(int frames)
+        {
+            int current = mFrames.load(std::memory_order_relaxed);
+            if (current != 0) return current == frames;
+            if (frames <= 0 || frames > kMaxFrames) return false;
+            for (int i = 0; i < kSlots; i++)
+            {
+                mSlots[i].data.assign(mChannels * frames, 0.0f);
+                mSlots[i].received.assign(mChannels, 0);
+            }
+            mFrames.store(frames, std::memory_order_release);
+            return true;
+        }
+
+        int mChannels;
+        int mLatency;
+        std::atomic<int> mFrames;
+        std::atomic<uint32_t> mNewest;  // sequence + 1 of the newest block received, 0 before any
+        std::atomic<uint32_t> mPlayed;  // first block playback hasn't started yet
+        std::atomic<bool> mRunning;
+        std::atomic<uint64_t> mPackets, mLate, mEarly, mLost, mResyncs;
+
+        // playback state, only touched by Pull
+        bool mStarted;
+        bool mPlaying;
+        uint32_t mPlaySequence;
+        int mOffset;
+        std::vector<uint8_t> mPlayingChannels;  // channels of the block being played that arrived before it started
+
+        Slot mSlots[kSlots];
+        UdpSocket mSocket;
+        std::thread mThread;
+    };
+
+} // !namespace NetworkBridge
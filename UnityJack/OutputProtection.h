@@ -0,0 +1,293 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "AudioPluginUtil.h"
+
+#include <atomic>
+#include <memory>
+#include <vector>
+
+// Last stage before the output ports, so nothing a scene does can reach the amplifiers as DC, NaNs or more than the
+// port's threshold. Non-finite samples are zeroed on every port. On each protected port a one pole highpass at
+// 10 Hz removes DC, and a lookahead limiter ramps the gain down over kLookahead ms ahead of every peak, holds it
+// while the peak passes and releases exponentially. Ports are processed in groups of four, one per SSE lane, like
+// BiquadBank.
+//
+// Once any port is protected, every port goes through the lookahead delay so the outputs stay aligned;
+// unprotected ports are only delayed.
+class OutputProtection
+{
+public:
+    enum { kLanes = 4 };
+
+    OutputProtection(int channels, int blocksize, float samplerate)
+    : mChannels(channels)
+    , mGroups((channels + kLanes - 1) / kLanes)
+    , mBlockSize(blocksize)
+    , mLookahead((int)ceilf(kLookahead * 0.001f * samplerate))
+    , mDcCoeff(1.0f - 2.0f * kPI * kDcCutoff / samplerate)
+    , mRelease(1.0f - expf(-1.0f / (kRelease * 0.001f * samplerate)))
+    , mReleaseReach(mRelease * (mLookahead + 1))
+    , mThresholds(new std::atomic<float>[channels])
+    , mMinGains(new std::atomic<float>[channels])
+    , mActive(false)
+    {
+        for (int ch = 0; ch < mChannels; ch++)
+        {
+            mThresholds[ch].store(0.0f, std::memory_order_relaxed);
+            mMinGains[ch].store(1.0f, std::memory_order_relaxed);
+        }
+        mState.assign(mGroups * kStateVectors * kLanes, 0.0f);
+        for (int g = 0; g < mGroups; g++)
+            for (int lane = 0; lane < kLanes; lane++)
+            {
+                mState[(g * kStateVectors + kGain) * kLanes + lane] = 1.0f;
+                mState[(g * kStateVectors + kTarget) * kLanes + lane] = 1.0f;
+            }
+        mDelay.assign(mGroups * mLookahead * kLanes, 0.0f);
+        mPositions.assign(mGroups, 0);
+        mSpare.assign((kLanes - 1) * blocksize, 0.0f);
+    }
+
+    // Latency the stage adds to every port once it is active, in samples
+    int GetLatency() const { return mLookahead; }
+
+    // Any thread: protects a channel at a threshold in dBFS, or stops protecting it when enabled is false
+    bool Set(int channel, bool enabled, float thresholdDb)
+    {
+        if (channel < 0 || channel >= mChannels) return false;
+        float threshold = enabled ? powf(10.0f, FastMin(thresholdDb, 0.0f) * 0.05f) : 0.0f;
+        mThresholds[channel].store(threshold, std::memory_order_relaxed);
+        if (enabled) mActive.store(true, std::memory_order_release);
+        return true;
+    }
+
+    bool IsActive() const { return mActive.load(std::memory_order_acquire); }
+
+    // Any thread: the largest gain reduction of each channel since the last call, in dB (positive)
+    int GetGainReduction(float* reductionDb, int count)
+    {
+        if (count > mChannels) count = mChannels;
+        for (int ch = 0; ch < count; ch++)
+        {
+            float gain = mMinGains[ch].exchange(1.0f, std::memory_order_relaxed);
+            reductionDb[ch] = (gain < 1.0f) ? -20.0f * log10f(FastMax(gain, 1.0e-6f)) : 0.0f;
+        }
+        return count;
+    }
+
+    // Realtime: processes the channels of one group in place, rows[i] being channel group * kLanes + i. Groups may
+    // run on different threads.
+    void Process(int group, float* const* rows, int numsamples)
+    {
+        if (numsamples > mBlockSize) return;
+
+        float* r[kLanes];
+        float threshold[kLanes], dc[kLanes];
+        int lanes = mChannels - group * kLanes;
+        if (lanes > kLanes) lanes = kLanes;
+        for (int lane = 0; lane < kLanes; lane++)
+        {
+            float t = (lane < lanes) ? mThresholds[group * kLanes + lane].load(std::memory_order_relaxed) : 0.0f;
+            r[lane] = (lane < lanes) ? rows[lane] : &mSpare[(lane - 1) * mBlockSize];
+            threshold[lane] = (t > 0.0f) ? t : kUnlimited;
+            dc[lane] = (t > 0.0f) ? mDcCoeff : -1.0f;   // negative: the channel is passed through
+        }
+
+        float* state = &mState[group * kStateVectors * kLanes];
+        float* delay = &mDelay[group * mLookahead * kLanes];
+        int pos = mPositions[group];
+        float mingain[kLanes] = { 1.0f, 1.0f, 1.0f, 1.0f };
+        int n = 0;
+#if UNITY_SSE
+        Lanes v;
+        v.threshold = _mm_loadu_ps(threshold);
+        v.dc = _mm_loadu_ps(dc);
+        v.gain = _mm_loadu_ps(state + kGain * kLanes);
+        v.target = _mm_loadu_ps(state + kTarget * kLanes);
+        v.slope = _mm_loadu_ps(state + kSlope * kLanes);
+        v.hold = _mm_loadu_ps(state + kHold * kLanes);
+        v.x1 = _mm_loadu_ps(state + kX1 * kLanes);
+        v.y1 = _mm_loadu_ps(state + kY1 * kLanes);
+        v.mingain = _mm_set1_ps(1.0f);
+        for (; n + 3 < numsamples; n += 4)
+        {
+            __m128 x[4] = { _mm_loadu_ps(r[0] + n), _mm_loadu_ps(r[1] + n), _mm_loadu_ps(r[2] + n), _mm_loadu_ps(r[3] + n) };
+            _MM_TRANSPOSE4_PS(x[0], x[1], x[2], x[3]);
+            for (int i = 0; i < 4; i++)
+            {
+                x[i] = Step(v, x[i], delay + pos * kLanes);
+                if (++pos == mLookahead) pos = 0;
+            }
+            _MM_TRANSPOSE4_PS(x[0], x[1], x[2], x[3]);
+            for (int lane = 0; lane < kLanes; lane++)
+                _mm_storeu_ps(r[lane] + n, x[lane]);
+        }
+        for (; n < numsamples; n++)
+        {
+            float y[kLanes];
+            _mm_storeu_ps(y, Step(v, _mm_set_ps(r[3][n], r[2][n], r[1][n], r[0][n]), delay + pos * kLanes));
+            if (++pos == mLookahead) pos = 0;
+            for (int lane = 0; lane < kLanes; lane++)
+                r[lane][n] = y[lane];
+        }
+        _mm_storeu_ps(state + kGain * kLanes, v.gain);
+        _mm_storeu_ps(state + kTarget * kLanes, v.target);
+        _mm_storeu_ps(state + kSlope * kLanes, v.slope);
+        _mm_storeu_ps(state + kHold * kLanes, v.hold);
+        _mm_storeu_ps(state + kX1 * kLanes, v.x1);
+        _mm_storeu_ps(state + kY1 * kLanes, v.y1);
+        _mm_storeu_ps(mingain, v.mingain);
+#else
+        int start = pos;
+        for (int lane = 0; lane < kLanes; lane++)
+        {
+            pos = start;
+            float* s = state + lane;
+            for (n = 0; n < numsamples; n++)
+            {
+                r[lane][n] = StepScalar(s, threshold[lane], dc[lane], r[lane][n], delay + pos * kLanes + lane);
+                if (++pos == mLookahead) pos = 0;
+                mingain[lane] = FastMin(mingain[lane], s[kGain * kLanes]);
+            }
+        }
+#endif
+        mPositions[group] = pos;
+
+        for (int lane = 0; lane < lanes; lane++)
+        {
+            std::atomic<float>& meter = mMinGains[group * kLanes + lane];
+            float current = meter.load(std::memory_order_relaxed);
+            while (mingain[lane] < current && !meter.compare_exchange_weak(current, mingain[lane], std::memory_order_relaxed)) {}
+        }
+    }
+
+private:
+    // ms of lookahead and release, Hz of the DC blocker
+    static constexpr float kLookahead = 1.0f;
+    static constexpr float kRelease = 50.0f;
+    static constexpr float kDcCutoff = 10.0f;
+    static constexpr float kUnlimited = 1.0e30f;
+
+    // state per group, a float per lane each
+    enum { kGain, kTarget, kSlope, kHold, kX1, kY1, kStateVectors };
+
+#if UNITY_SSE
+    struct Lanes
+    {
+        __m128 threshold, dc, gain, target, slope, hold, x1, y1, mingain;
+    };
+
+    static inline __m128 Select(__m128 mask, __m128 a, __m128 b)
+    {
+        return _mm_or_ps(_mm_and_ps(mask, a), _mm_andnot_ps(mask, b));
+    }
+
+    // One frame of four channels: the sample goes into the lookahead delay, the one leaving it comes out limited
+    inline __m128 Step(Lanes& v, __m128 x, float* slot) const
+    {
+        const __m128 one = _mm_set1_ps(1.0f);
+        const __m128 absmask = _mm_castsi128_ps(_mm_set1_epi32(0x7fffffff));
+
+        // NaN, infinity and absurd values become silence, then the DC blocker on the protected lanes
+        x = _mm_and_ps(x, _mm_cmplt_ps(_mm_and_ps(x, absmask), _mm_set1_ps(kUnlimited)));
+        __m128 protect = _mm_cmpge_ps(v.dc, _mm_setzero_ps());
+        __m128 y = _mm_add_ps(_mm_sub_ps(x, v.x1), _mm_mul_ps(v.dc, v.y1));
+        v.x1 = _mm_and_ps(protect, x);
+        v.y1 = _mm_and_ps(protect, y);
+        y = Select(protect, y, x);
+
+        // the gain this sample needs when it leaves the delay, reached by a ramp over the lookahead
+        __m128 req = _mm_div_ps(v.threshold, _mm_max_ps(_mm_and_ps(y, absmask), v.threshold));
+        // no release while a sample in the delay could end up above its own gain
+        __m128 reach = _mm_add_ps(v.gain, _mm_mul_ps(_mm_sub_ps(one, v.gain), _mm_set1_ps(mReleaseReach)));
+        v.hold = Select(_mm_cmplt_ps(req, reach), _mm_set1_ps((float)(mLookahead + 2)), v.hold);
+        __m128 tighter = _mm_cmplt_ps(req, v.target);
+        v.slope = Select(tighter, _mm_max_ps(v.slope, _mm_mul_ps(_mm_sub_ps(v.gain, req), _mm_set1_ps(1.0f / (float)mLookahead))), v.slope);
+        v.target = _mm_min_ps(v.target, req);
+
+        __m128 attacking = _mm_cmpgt_ps(v.gain, v.target);
+        v.hold = _mm_max_ps(_mm_sub_ps(v.hold, one), _mm_setzero_ps());
+        __m128 releasing = _mm_andnot_ps(attacking, _mm_cmple_ps(v.hold, _mm_setzero_ps()));
+        __m128 gain = Select(attacking, _mm_max_ps(_mm_sub_ps(v.gain, v.slope), v.target),
+            Select(releasing, _mm_add_ps(v.gain, _mm_mul_ps(_mm_sub_ps(one, v.gain), _mm_set1_ps(mRelease))), v.gain));
+        v.target = Select(releasing, gain, v.target);
+        v.gain = gain;
+        v.slope = _mm_and_ps(_mm_cmpgt_ps(gain, v.target), v.slope);
+        v.mingain = _mm_min_ps(v.mingain, gain);
+
+        __m128 out = _mm_mul_ps(_mm_loadu_ps(slot), gain);
+        _mm_storeu_ps(slot, y);
+        return out;
+    }
+#endif
+
+    // The same for a single lane, s pointing at the lane's state
+    inline float StepScalar(float* s, float threshold, float dc, float x, float* slot) const
+    {
+        float& gain = s[kGain * kLanes];
+        float& target = s[kTarget * kLanes];
+        float& slope = s[kSlope * kLanes];
+        float& hold = s[kHold * kLanes];
+        float& x1 = s[kX1 * kLanes];
+        float& y1 = s[kY1 * kLanes];
+
+        if (!(fabsf(x) < kUnlimited)) x = 0.0f;
+        bool protect = dc >= 0.0f;
+        float y = protect ? x - x1 + dc * y1 : x;
+        x1 = protect ? x : 0.0f;
+        y1 = protect ? y : 0.0f;
+
+        float req = threshold / FastMax(fabsf(y), threshold);
+        if (req < gain + (1.0f - gain) * mReleaseReach) hold = (float)(mLookahead + 2);
+        if (req < target)
+        {
+            slope = FastMax(slope, (gain - req) / (float)mLookahead);
+            target = req;
+        }
+        bool attacking = gain > target;
+        hold = FastMax(hold - 1.0f, 0.0f);
+        if (attacking)
+            gain = FastMax(gain - slope, target);
+        else if (hold <= 0.0f)
+            target = gain = gain + (1.0f - gain) * mRelease;
+        if (!(gain > target)) slope = 0.0f;
+
+        float out = *slot * gain;
+        *slot = y;
+        return out;
+    }
+
+    int mChannels;
+    int mGroups;
+    int mBlockSize;
+    int mLookahead;
+    float mDcCoeff;
+    float mRelease;
+    float mReleaseReach;    // how far towards 1 the gain can release while a sample crosses the delay
+    std::unique_ptr<std::atomic<float>[]> mThresholds;  // linear, 0 when the channel is not protected
+    std::unique_ptr<std::atomic<float>[]> mMinGains;    // lowest gain since the meters were last read
+    std::atomic<bool> mActive;
+
+    std::vector<float> mState;
+    std::vector<float> mDelay;      // mLookahead frames of a float per lane for each group
+    std::vector<int> mPositions;    // next frame of each group's delay
+    std::vector<float> mSpare;      // rows for the missing lanes of a last group of less than four channels
+};
@@ -0,0 +1,155 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "AudioPluginUtil.h"
+
+#include <atomic>
+#include <stdint.h>
+
+// Groups parameter changes so the audio thread sees all of them or none. Changes made between Begin and End are
+// held back until End, then take effect together at the DSP tick given to Begin, in samples like
+// UnityAudioEffectState::currdsptick; 0 or a tick already past means the start of the next block. Changes made
+// outside a batch take effect at the start of the next block.
+// Main thread, where Unity calls the parameter setters; a Begin while a batch is open ends that batch.
+class ParameterBatch
+{
+public:
+    static ParameterBatch& getInstance()
+    {
+        static ParameterBatch instance;
+        return instance;
+    }
+
+    void Begin(uint64_t tick)
+    {
+        if (++mNext == 0) mNext = 1;
+        mId = mNext;
+        mTime = tick;
+        mOpen.store(mId, std::memory_order_release);
+    }
+
+    void End()
+    {
+        mId = 0;
+        mTime = 0;
+        mOpen.store(0, std::memory_order_release);
+    }
+
+    // Main thread: the stamp of a change made now
+    uint32_t GetId() const { return mId; }
+    uint64_t GetTime() const { return mTime; }
+
+    // Realtime: true while changes stamped with id have to wait for their batch to end. A change is queued after
+    // its batch was opened, so once the change is visible any id other than the open one is a batch that ended.
+    bool IsHeld(uint32_t id) const { return id != 0 && mOpen.load(std::memory_order_acquire) == id; }
+
+private:
+    ParameterBatch() : mOpen(0), mNext(0), mId(0), mTime(0) {}
+
+    std::atomic<uint32_t> mOpen;    // batch being built, 0 when none
+    uint32_t mNext;
+    uint32_t mId;
+    uint64_t mTime;
+};
+
+// Parameter changes of one effect instance, from the thread Unity sets parameters on to its ProcessCallback. The
+// effect processes with its own copy of the values, which only the audio thread writes, so a block never sees a
+// value half-set, and changes land at the sample they were scheduled for: Apply splits the block at every pending
+// change, and the effect renders each part with the values in force there. Changes scheduled for the same sample
+// are applied together, the last one to a parameter winning.
+//
+// When more than kCapacity changes are waiting, the latest value of each parameter is kept on the side instead and
+// applied after everything queued before it, so nothing is lost but its timing.
+template<int kParams, int kCapacity = 64>
+class ParameterQueue
+{
+public:
+    ParameterQueue() : mOverflow(0)
+    {
+        for (int i = 0; i < kParams; i++)
+        {
+            mLatest[i].store(0.0f, std::memory_order_relaxed);
+            mRequested[i] = 0.0f;
+        }
+    }
+
+    // Main thread: the values Get reports before anything is set
+    void Init(const float* values)
+    {
+        for (int i = 0; i < kParams; i++)
+            mRequested[i] = values[i];
+    }
+
+    void Set(int index, float value)
+    {
+        mRequested[index] = value;
+
+        ParameterBatch& batch = ParameterBatch::getInstance();
+        Change change = { batch.GetTime(), batch.GetId(), index, value };
+        // once something went to the side, later changes follow it there, so they can't overtake it
+        if (mOverflow.load(std::memory_order_acquire) == 0 && mChanges.Feed(change))
+            return;
+        mLatest[index].store(value, std::memory_order_relaxed);
+        mOverflow.fetch_or(1u << index, std::memory_order_release);
+    }
+
+    // Main thread: the value last set, applied or not
+    float Get(int index) const { return mRequested[index]; }
+
+    // Realtime: applies to values every change due at or before the DSP tick position, and returns for how many
+    // samples, at most remaining, the values then hold. The first call of a block is at its start with the whole
+    // block remaining; a block-rate effect makes just that one.
+    int Apply(float* values, uint64_t position, int remaining)
+    {
+        Change change;
+        while (mChanges.Peek(change))
+        {
+            if (ParameterBatch::getInstance().IsHeld(change.batch)) return remaining;
+            if (change.time > position)
+                return (change.time - position < (uint64_t)remaining) ? (int)(change.time - position) : remaining;
+            values[change.index] = change.value;
+            mChanges.Skip(1);
+        }
+
+        if (mOverflow.load(std::memory_order_relaxed) != 0)
+        {
+            uint32_t overflow = mOverflow.exchange(0, std::memory_order_acquire);
+            for (int i = 0; i < kParams; i++)
+                if (overflow & (1u << i)) values[i] = mLatest[i].load(std::memory_order_relaxed);
+        }
+        return remaining;
+    }
+
+private:
+    static_assert(kParams <= 32, "one overflow bit per parameter");
+
+    struct Change
+    {
+        uint64_t time;      // DSP tick to apply at
+        uint32_t batch;     // 0 when not part of a batch
+        int index;
+        float value;
+    };
+
+    RingBuffer<kCapacity, Change> mChanges;
+    std::atomic<uint32_t> mOverflow;    // parameters whose latest value is in mLatest
+    std::atomic<float> mLatest[kParams];
+    float mRequested[kParams];          // main thread only
+};
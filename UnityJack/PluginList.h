@@ -1,2 +1,4 @@
 DECLARE_EFFECT("Jack Send", TestSharedStack)
+DECLARE_EFFECT("Jack Receive", JackReceive)
+DECLARE_EFFECT("Jack Spatializer", JackSpatializer)
 
@@ -0,0 +1,197 @@
+// Copyright (C) 2016  Rodrigo Diaz
+// 
+// This file is part of JackAudioUnity.
+// 
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+// 
+
+// Plays a JACK input port through an AudioSource. Set as the project's spatializer, every spatialized source
+// gets an instance; the source plays a constant clip of ones, so the input buffer carries Unity's volume and
+// distance attenuation as a gain envelope, which is applied to the port's block before panning it from the
+// listener and source matrices.
+
+#include "AudioPluginUtil.h"
+#include "ParameterQueue.h"
+#include "TestSharedLib.cpp"
+
+namespace JackReceive
+{
+
+using TestSharedStack::JackClient;
+
+enum Param
+{
+    P_PORT,
+    P_GAIN,
+    P_NUM
+};
+
+struct EffectData
+{
+    float p[P_NUM];     // as the audio thread applied them
+    ParameterQueue<P_NUM> changes;
+    float gains[2];     // stereo gains at the end of the last block, ramped from in the next one
+    bool hasgains;
+    float block[BUFSIZE];
+};
+
+static FixedPool<EffectData, 512> effectPool;
+
+int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition)
+{
+    int numparams = P_NUM;
+    definition.paramdefs = new UnityAudioParameterDefinition[numparams];
+    RegisterParameter(definition, "PORT", "", 0.0f, 64.0f, 0.0f, 1.0f, 1.0f, P_PORT, "JACK input port played by this source");
+    RegisterParameter(definition, "GAIN", "", 0.0f, 4.0f, 1.0f, 1.0f, 1.0f, P_GAIN, "Gain applied to the port");
+    definition.flags |= UnityAudioEffectDefinitionFlags_IsSpatializer;
+    return numparams;
+}
+
+// Stereo gains from the source position in listener space. Balance-style equal power law: both channels
+// are at unity in the center and the far one fades out as the source moves to the side.
+static void ComputeStereoGains(const UnityAudioSpatializerData* spatializer, float* gains)
+{
+    const float* m = spatializer->listenermatrix;
+    const float* s = spatializer->sourcematrix;
+    float px = s[12], py = s[13], pz = s[14];
+    float dx = m[0] * px + m[4] * py + m[8] * pz + m[12];
+    float dy = m[1] * px + m[5] * py + m[9] * pz + m[13];
+    float dz = m[2] * px + m[6] * py + m[10] * pz + m[14];
+    float distance = sqrtf(dx * dx + dy * dy + dz * dz);
+
+    float pan = (distance > 1.0e-6f) ? dx / distance : 0.0f;
+    pan *= spatializer->spatialblend * (1.0f - spatializer->spread / 360.0f);
+    pan = FastClip(pan + spatializer->stereopan, -1.0f, 1.0f);
+
+    float angle = (pan + 1.0f) * 0.25f * kPI;
+    gains[0] = FastMin(1.0f, cosf(angle) * sqrtf(2.0f));
+    gains[1] = FastMin(1.0f, sinf(angle) * sqrtf(2.0f));
+}
+
+UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state)
+{
+    EffectData* data = effectPool.Allocate();
+    if (data == nullptr) return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+    state->effectdata = data;
+    InitParametersFromDefinitions(InternalRegisterEffectDefinition, data->p);
+    data->changes.Init(data->p);
+    return UNITY_AUDIODSP_OK;
+}
+
+UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback(UnityAudioEffectState* state)
+{
+    EffectData* data = state->GetEffectData<EffectData>();
+    effectPool.Free(data);
+    return UNITY_AUDIODSP_OK;
+}
+
+UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels)
+{
+    EffectData* data = state->GetEffectData<EffectData>();
+    TraceScope trace(Trace_ProcessCallback);
+    JackClient::getInstance().Tick(state->currdsptick);
+    unsigned int run = data->changes.Apply(data->p, state->currdsptick, length);
+
+    if (length > BUFSIZE || inchannels != outchannels)
+    {
+        memset(outbuffer, 0, length * outchannels * sizeof(float));
+        return UNITY_AUDIODSP_OK;
+    }
+
+    JackClient::getInstance().GetPortData((int)data->p[P_PORT], state->currdsptick, data->block, length);
+
+    // The gain follows its changes to the sample, the port is picked once per block
+    for (unsigned int offset = 0; offset < length; offset += run)
+    {
+        if (offset > 0) run = data->changes.Apply(data->p, state->currdsptick + offset, length - offset);
+        const float gain = data->p[P_GAIN];
+        for (unsigned int n = offset; n < offset + run; n++)
+            data->block[n] *= gain;
+    }
+
+    const UnityAudioSpatializerData* spatializer =
+        (state->structsize >= sizeof(UnityAudioEffectState)) ? state->spatializerdata : NULL;
+
+    if (spatializer == NULL)
+    {
+        // Not running as a spatializer: the port replaces the input on every channel
+        for (unsigned int n = 0; n < length; n++)
+        {
+            float x = data->block[n];
+            for (int i = 0; i < outchannels; i++)
+                outbuffer[n * outchannels + i] = x;
+        }
+        return UNITY_AUDIODSP_OK;
+    }
+
+    if (outchannels != 2)
+    {
+        // No panning outside stereo, only the attenuation envelope
+        for (unsigned int n = 0; n < length; n++)
+            for (int i = 0; i < outchannels; i++)
+                outbuffer[n * outchannels + i] = data->block[n] * inbuffer[n * outchannels + i];
+        return UNITY_AUDIODSP_OK;
+    }
+
+    float target[2];
+    ComputeStereoGains(spatializer, target);
+    if (!data->hasgains)
+    {
+        data->gains[0] = target[0];
+        data->gains[1] = target[1];
+        data->hasgains = true;
+    }
+
+    // Ramp the panning across the block so moving sources don't zipper
+    const float step = 1.0f / (float)length;
+    float gl = data->gains[0], gr = data->gains[1];
+    const float dl = (target[0] - data->gains[0]) * step;
+    const float dr = (target[1] - data->gains[1]) * step;
+    for (unsigned int n = 0; n < length; n++)
+    {
+        float x = data->block[n];
+        outbuffer[n * 2] = x * inbuffer[n * 2] * gl;
+        outbuffer[n * 2 + 1] = x * inbuffer[n * 2 + 1] * gr;
+        gl += dl;
+        gr += dr;
+    }
+    data->gains[0] = target[0];
+    data->gains[1] = target[1];
+
+    return UNITY_AUDIODSP_OK;
+}
+
+UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK SetFloatParameterCallback(UnityAudioEffectState* state, int index, float value)
+{
+    EffectData* data = state->GetEffectData<EffectData>();
+    if (index < 0 || index >= P_NUM) return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+    data->changes.Set(index, value);
+    return UNITY_AUDIODSP_OK;
+}
+
+UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatParameterCallback(UnityAudioEffectState* state, int index, float* value, char *valuestr)
+{
+    EffectData* data = state->GetEffectData<EffectData>();
+    if (index < 0 || index >= P_NUM) return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+    if (value != NULL) *value = data->changes.Get(index);
+    if (valuestr != NULL) valuestr[0] = 0;
+    return UNITY_AUDIODSP_OK;
+}
+
+int UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback(UnityAudioEffectState* state, const char* name, float* buffer, int numsamples)
+{
+    return UNITY_AUDIODSP_OK;
+}
+
+} //!namespace
@@ -0,0 +1,210 @@
+// Copyright (C) 2016  Rodrigo Diaz
+// 
+// This file is part of JackAudioUnity.
+// 
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+// 
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+// 
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+// 
+
+// Renders every spatialized AudioSource straight to the JACK outputs as a speaker array. Each source is
+// downmixed to mono, panned with VBAP or DBAP over the layout loaded with LoadSpeakerLayout (one JACK output per
+// speaker) or encoded to 3rd order ambisonics on the first 16 outputs, and summed into the output bus; Unity's
+// own output gets silence. A source can play a JACK input
+// port instead of its clip, like the Jack Receive spatializer, so JACK-fed sources can be placed on the array too.
+
+#include "AudioPluginUtil.h"
+#include "ParameterQueue.h"
+#include "TestSharedLib.cpp"
+
+namespace JackSpatializer
+{
+
+using TestSharedStack::JackClient;
+
+enum Param
+{
+    P_INPUT,    // INPUT and GAIN sit where Jack Receive has PORT and GAIN, so a receiver drives either plugin
+    P_GAIN,
+    P_MODE,
+    P_ROLLOFF,
+    P_BLUR,
+    P_NUM
+};
+
+enum Mode
+{
+    MODE_VBAP,
+    MODE_DBAP,
+    MODE_HOA
+};
+
+struct EffectData
+{
+    float p[P_NUM];                                 // as the audio thread applied them
+    ParameterQueue<P_NUM> changes;
+    const SpeakerLayout* layout;                    // layout and mode the gains below were computed for
+    int mode;
+    float gains[SpeakerLayout::kMaxSpeakers];       // gains at the end of the last block
+    float target[SpeakerLayout::kMaxSpeakers];
+    float block[BUFSIZE];
+    int inchannels;                                 // channel count the downmix kernel was picked for
+    ChannelKernels::DownmixFn downmix;
+};
+
+static FixedPool<EffectData, 512> effectPool;
+
+int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition)
+{
+    int numparams = P_NUM;
+    definition.paramdefs = new UnityAudioParameterDefinition[numparams];
+    RegisterParameter(definition, "INPUT", "", -1.0f, 64.0f, -1.0f, 1.0f, 1.0f, P_INPUT, "JACK input port played instead of the source's audio, -1 for the source itself");
+    RegisterParameter(definition, "GAIN", "", 0.0f, 4.0f, 1.0f, 1.0f, 1.0f, P_GAIN, "Gain applied to the source");
+    RegisterParameter(definition, "MODE", "", 0.0f, 2.0f, 0.0f, 1.0f, 1.0f, P_MODE, "Panning law: 0 VBAP, 1 DBAP, 2 3rd order ambisonics on the first 16 ports");
+    RegisterParameter(definition, "ROLLOFF", "dB", 0.0f, 24.0f, 6.0f, 1.0f, 1.0f, P_ROLLOFF, "DBAP attenuation per doubling of distance");
+    RegisterParameter(definition, "BLUR", "m", 0.0f, 10.0f, 0.2f, 1.0f, 1.0f, P_BLUR, "DBAP spatial blur");
+    definition.flags |= UnityAudioEffectDefinitionFlags_IsSpatializer;
+    return numparams;
+}
+
+// Source position in the listener's space, which is the space the speaker layout is given in
+static void GetSourcePosition(const UnityAudioSpatializerData* spatializer, float* position)
+{
+    const float* m = spatializer->listenermatrix;
+    const float* s = spatializer->sourcematrix;
+    float px = s[12], py = s[13], pz = s[14];
+    position[0] = m[0] * px + m[4] * py + m[8] * pz + m[12];
+    position[1] = m[1] * px + m[5] * py + m[9] * pz + m[13];
+    position[2] = m[2] * px + m[6] * py + m[10] * pz + m[14];
+}
+
+UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state)
+{
+    EffectData* data = effectPool.Allocate();
+    if (data == nullptr) return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+    state->effectdata = data;
+    InitParametersFromDefinitions(InternalRegisterEffectDefinition, data->p);
+    data->changes.Init(data->p);
+    return UNITY_AUDIODSP_OK;
+}
+
+UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback(UnityAudioEffectState* state)
+{
+    EffectData* data = state->GetEffectData<EffectData>();
+    effectPool.Free(data);
+    return UNITY_AUDIODSP_OK;
+}
+
+UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels)
+{
+    EffectData* data = state->GetEffectData<EffectData>();
+    TraceScope trace(Trace_ProcessCallback);
+    JackClient& jack = JackClient::getInstance();
+    jack.Tick(state->currdsptick);
+    // Every parameter here is block-rate, and gain changes are ramped across the block with the panning
+    data->changes.Apply(data->p, state->currdsptick, length);
+
+    memset(outbuffer, 0, length * outchannels * sizeof(float));
+
+    const int mode = (int)data->p[P_MODE];
+    const SpeakerLayout* layout = jack.GetSpeakerLayout();
+    if ((layout == NULL && mode != MODE_HOA) || length > BUFSIZE || inchannels <= 0)
+        return UNITY_AUDIODSP_OK;
+
+    // Mono source: the input channels averaged, or a JACK port scaled by them (the source then plays a clip of
+    // ones, which carries Unity's volume and distance attenuation)
+    if (inchannels != data->inchannels)
+    {
+        data->downmix = ChannelKernels::SelectDownmix(inchannels);
+        data->inchannels = inchannels;
+    }
+    data->downmix(inbuffer, data->block, inchannels, length, 1.0f / (float)inchannels);
+    int input = (int)data->p[P_INPUT];
+    if (input >= 0)
+    {
+        float port[BUFSIZE];
+        jack.GetPortData(input, state->currdsptick, port, length);
+        for (unsigned int n = 0; n < length; n++)
+            data->block[n] *= port[n];
+    }
+
+    const UnityAudioSpatializerData* spatializer =
+        (state->structsize >= sizeof(UnityAudioEffectState)) ? state->spatializerdata : NULL;
+    float position[3] = { 0.0f, 0.0f, 1.0f };
+    float blend = 0.0f;
+    if (spatializer != NULL)
+    {
+        GetSourcePosition(spatializer, position);
+        blend = spatializer->spatialblend;
+    }
+
+    int numgains;
+    if (mode == MODE_HOA)
+    {
+        // A 2D source (spatial blend 0) only feeds the omnidirectional component
+        numgains = AmbisonicEncoder::kChannels;
+        AmbisonicEncoder::GainsFromListenerSpace(position, data->target);
+        for (int i = 1; i < numgains; i++)
+            data->target[i] *= blend;
+        for (int i = 0; i < numgains; i++)
+            data->target[i] *= data->p[P_GAIN];
+    }
+    else
+    {
+        numgains = layout->GetNumSpeakers();
+        if (mode == MODE_DBAP)
+            layout->ComputeDBAP(position, data->p[P_ROLLOFF], data->p[P_BLUR], data->target);
+        else
+            layout->ComputeVBAP(position, data->target);
+
+        // A 2D source (spatial blend 0) plays equally on every speaker
+        const float omni = (1.0f - blend) / sqrtf((float)numgains);
+        for (int i = 0; i < numgains; i++)
+            data->target[i] = (data->target[i] * blend + omni) * data->p[P_GAIN];
+    }
+
+    if (data->layout != layout || data->mode != mode)
+    {
+        memcpy(data->gains, data->target, numgains * sizeof(float));
+        data->layout = layout;
+        data->mode = mode;
+    }
+
+    jack.MixOutputs(state->currdsptick, data->block, data->gains, data->target, numgains, length);
+    memcpy(data->gains, data->target, numgains * sizeof(float));
+
+    return UNITY_AUDIODSP_OK;
+}
+
+UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK SetFloatParameterCallback(UnityAudioEffectState* state, int index, float value)
+{
+    EffectData* data = state->GetEffectData<EffectData>();
+    if (index < 0 || index >= P_NUM) return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+    data->changes.Set(index, value);
+    return UNITY_AUDIODSP_OK;
+}
+
+UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatParameterCallback(UnityAudioEffectState* state, int index, float* value, char *valuestr)
+{
+    EffectData* data = state->GetEffectData<EffectData>();
+    if (index < 0 || index >= P_NUM) return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+    if (value != NULL) *value = data->changes.Get(index);
+    if (valuestr != NULL) valuestr[0] = 0;
+    return UNITY_AUDIODSP_OK;
+}
+
+int UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback(UnityAudioEffectState* state, const char* name, float* buffer, int numsamples)
+{
+    return UNITY_AUDIODSP_OK;
+}
+
+} //!namespace
@@ -17,10 +17,9 @@
 // 
 
 #include "AudioPluginUtil.h"
+#include "ParameterQueue.h"
 #include "TestSharedLib.cpp"
 
-#define DEBUG_OUT
-
 namespace TestSharedStack
 {
 
@@ -28,33 +27,45 @@ enum Param
 {
     P_PARAM1,
     P_INDEX,
+    P_HOA,
+    P_AZIMUTH,
+    P_ELEVATION,
     P_NUM
 };
 
 struct EffectData
 {
-    float p[P_NUM];
-    float tmpbuffer_in[BUFSIZE];
+    float p[P_NUM];                                 // as the audio thread applied them
+    ParameterQueue<P_NUM> changes;
     float tmpbuffer_out[BUFSIZE];
+    float hoagains[AmbisonicEncoder::kChannels];   // encoding gains at the end of the last block
+    bool hashoagains;
 
 };
 
+// Effect instances come from static storage, so creating one never hits the heap while Unity's mixer is running
+static FixedPool<EffectData, 256> effectPool;
+
 int InternalRegisterEffectDefinition(UnityAudioEffectDefinition& definition)
 {
     int numparams = P_NUM;
     definition.paramdefs = new UnityAudioParameterDefinition[numparams];
     RegisterParameter(definition, "INDEX", "", 0.0f, 64.0f, 0.0f, 1.0f, 1.0f, P_INDEX, "User-defined parameter 1 (read/write)");
     RegisterParameter(definition, "VOL", "", 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, P_PARAM1, "User-defined parameter 1 (read/write)");
+    RegisterParameter(definition, "HOA", "", 0.0f, 1.0f, 0.0f, 1.0f, 1.0f, P_HOA, "Encode into the 3rd order ambisonic bus on the 16 ports from INDEX instead of sending to INDEX");
+    RegisterParameter(definition, "AZIMUTH", "deg", -180.0f, 180.0f, 0.0f, 1.0f, 1.0f, P_AZIMUTH, "Ambisonic direction, clockwise from the front");
+    RegisterParameter(definition, "ELEVATION", "deg", -90.0f, 90.0f, 0.0f, 1.0f, 1.0f, P_ELEVATION, "Ambisonic direction, up from the horizon");
 
     return numparams;
 }
 
 UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectState* state)
 {
-    EffectData* data = new EffectData;
-    memset(data, 0, sizeof(EffectData));
+    EffectData* data = effectPool.Allocate();
+    if (data == nullptr) return UNITY_AUDIODSP_ERR_UNSUPPORTED;
     state->effectdata = data;
     InitParametersFromDefinitions(InternalRegisterEffectDefinition, data->p);
+    data->changes.Init(data->p);
 
     // TODO: this should not be neccesary since we are calling
     // client creation from C#
@@ -67,19 +78,27 @@ UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK CreateCallback(UnityAudioEffectSta
 UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ReleaseCallback(UnityAudioEffectState* state)
 {
     EffectData* data = state->GetEffectData<EffectData>();
-    delete data;
+    effectPool.Free(data);
     return UNITY_AUDIODSP_OK;
 }
 
 UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectState* state, float* inbuffer, float* outbuffer, unsigned int length, int inchannels, int outchannels)
 {
     EffectData* data = state->GetEffectData<EffectData>();
+    TraceScope trace(Trace_ProcessCallback);
+    JackClient::getInstance().Tick(state->currdsptick);
 
-    for (unsigned int n = 0; n < length; n++)
+    // VOL follows its changes to the sample; the send parameters below take the values at the end of the block
+    unsigned int run;
+    for (unsigned int offset = 0; offset < length; offset += run)
     {
-        for (int i = 0; i < outchannels; i++)
+        run = data->changes.Apply(data->p, state->currdsptick + offset, length - offset);
+        for (unsigned int n = offset; n < offset + run; n++)
         {
-            outbuffer[n * outchannels + i] = inbuffer[n * outchannels + i] * data->p[P_PARAM1];
+            for (int i = 0; i < outchannels; i++)
+            {
+                outbuffer[n * outchannels + i] = inbuffer[n * outchannels + i] * data->p[P_PARAM1];
+            }
         }
     }
     
@@ -88,36 +107,36 @@ UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectSt
     // The "Best Performance" setting gives us BUFSIZE = 1024 samples per channel
     // which corresponds to 1024 samples in Jack
     
-#ifdef DEBUG_OUT
+    const float* mono = inbuffer;
     if (inchannels == 2)
     {
-        //downmix
-        for (int i = 0, j = 0; i < length * 2; i += 2)
-        {
-            data->tmpbuffer_out[j++] = inbuffer[i] + inbuffer[i+1];
-        }
-        
-        JackClient::getInstance().SetData( data->p[P_INDEX], data->tmpbuffer_out);
-
-        
-    } else if (inchannels == 1) {
-        JackClient::getInstance().SetData( data->p[P_INDEX], inbuffer );
+        ChannelKernels::Downmix<2>(inbuffer, data->tmpbuffer_out, 2, length, 1.0f);
+        mono = data->tmpbuffer_out;
+    } else if (inchannels != 1) {
+        data->hashoagains = false;
+        return UNITY_AUDIODSP_OK;
     }
-#else
-    if (inchannels == 2)
-    {
-        // upmix
-        JackClient::getInstance().GetData( data->p[P_INDEX], data->tmpbuffer_in);
 
-        for (int i = 0,j=0; i < length * 2; i += 2)
+    if (data->p[P_HOA] >= 0.5f)
+    {
+        // Encode into the shared ambisonic bus, interpolating the gains across the block
+        float target[AmbisonicEncoder::kChannels];
+        AmbisonicEncoder::GainsFromAngles(data->p[P_AZIMUTH], data->p[P_ELEVATION], target);
+        if (!data->hashoagains)
         {
-            outbuffer[i] = data->tmpbuffer_in[j++];
-            outbuffer[i+1] = outbuffer[i];
+            memcpy(data->hoagains, target, sizeof(target));
+            data->hashoagains = true;
         }
-    } else if (inchannels == 1) {
-        JackClient::getInstance().GetData( data->p[P_INDEX], outbuffer);
+        JackClient::getInstance().MixOutputs(state->currdsptick, mono, data->hoagains, target,
+            AmbisonicEncoder::kChannels, length, (int)data->p[P_INDEX]);
+        memcpy(data->hoagains, target, sizeof(target));
+    }
+    else
+    {
+        // the gains are stale by the time HOA is switched back on, so that block starts at its own gains
+        data->hashoagains = false;
+        JackClient::getInstance().SetData( data->p[P_INDEX], state->currdsptick, mono, length);
     }
-#endif
     
 //    std::cout << "Processing data " << length << " channels " << inchannels << std::endl;
     return UNITY_AUDIODSP_OK;
@@ -126,13 +145,15 @@ UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK ProcessCallback(UnityAudioEffectSt
 UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK SetFloatParameterCallback(UnityAudioEffectState* state, int index, float value)
 {
     EffectData* data = state->GetEffectData<EffectData>();
-    data->p[index] = value;
+    if (index < 0 || index >= P_NUM) return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+    data->changes.Set(index, value);
     return UNITY_AUDIODSP_OK;
 }
 UNITY_AUDIODSP_RESULT UNITY_AUDIODSP_CALLBACK GetFloatParameterCallback(UnityAudioEffectState* state, int index, float* value, char *valuestr)
 {
     EffectData* data = state->GetEffectData<EffectData>();
-    if (value != NULL) *value = data->p[index];
+    if (index < 0 || index >= P_NUM) return UNITY_AUDIODSP_ERR_UNSUPPORTED;
+    if (value != NULL) *value = data->changes.Get(index);
     return UNITY_AUDIODSP_OK;
 }
 int UNITY_AUDIODSP_CALLBACK GetFloatBufferCallback(UnityAudioEffectState* state, const char* name, float* buffer, int numsamples)
@@ -163,3 +184,108 @@ extern "C" UNITY_AUDIODSP_EXPORT_API void SetAllData(float* buffer)
     TestSharedStack::JackClient::getInstance().SetAllData(buffer);
 }
 
+extern "C" UNITY_AUDIODSP_EXPORT_API void SetPlanarData(const float* const* tracks, int numtracks, const uint64_t* mask, int length)
+{
+    TestSharedStack::JackClient::getInstance().SetPlanarData(tracks, numtracks, mask, length);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API float* AcquireTrackBlock(int* stride, int* tracks)
+{
+    return TestSharedStack::JackClient::getInstance().AcquireTrackBlock(stride, tracks);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API bool SubmitTrackBlock(const uint64_t* mask)
+{
+    return TestSharedStack::JackClient::getInstance().SubmitTrackBlock(mask);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API bool SendTrackBlock(int length)
+{
+    return TestSharedStack::JackClient::getInstance().SendTrackBlock(length);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API bool SetInputConvolution(int port, float* ir, int length)
+{
+    return TestSharedStack::JackClient::getInstance().SetInputConvolution(port, ir, length);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API bool SetOutputDelay(int port, float milliseconds)
+{
+    return TestSharedStack::JackClient::getInstance().SetOutputDelay(port, milliseconds);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API bool SetOutputEq(int port, int band, int type, float frequency, float gain, float q)
+{
+    return TestSharedStack::JackClient::getInstance().SetOutputEq(port, band, type, frequency, gain, q);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API bool SetOutputProtection(int port, int enabled, float thresholdDb)
+{
+    return TestSharedStack::JackClient::getInstance().SetOutputProtection(port, enabled != 0, thresholdDb);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API bool SetMonitorRoute(int input, int output, float gain)
+{
+    return TestSharedStack::JackClient::getInstance().SetMonitorRoute(input, output, gain);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API bool ClearMonitorRoutes()
+{
+    return TestSharedStack::JackClient::getInstance().ClearMonitorRoutes();
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API int GetOutputGainReduction(float* reductionDb, int count)
+{
+    return TestSharedStack::JackClient::getInstance().GetOutputGainReduction(reductionDb, count);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API bool StartTrace(const char* path)
+{
+    return TestSharedStack::JackClient::getInstance().StartTrace(path);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API void StopTrace()
+{
+    TestSharedStack::JackClient::getInstance().StopTrace();
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API void BeginParameterBatch(uint64_t tick)
+{
+    ParameterBatch::getInstance().Begin(tick);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API void EndParameterBatch()
+{
+    ParameterBatch::getInstance().End();
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API bool LoadSpeakerLayout(const char* path)
+{
+    return TestSharedStack::JackClient::getInstance().LoadSpeakerLayout(path);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API void SetWorkerThreads(int count)
+{
+    TestSharedStack::JackClient::getInstance().SetWorkerThreads(count);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API void SetRingFormat(int format)
+{
+    TestSharedStack::JackClient::getInstance().SetRingFormat(format);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API void SetNetworkTarget(const char* host, int port, int frames)
+{
+    TestSharedStack::JackClient::getInstance().SetNetworkTarget(host, port, frames);
+}
+
+extern "C" UNITY_AUDIODSP_EXPORT_API void SetThreadConfig(int workerPriority, UInt64 workerCpus, int unityPriority, UInt64 unityCpus, int lockMemory)
+{
+    ThreadConfig config;
+    config.workerPriority = workerPriority;
+    config.workerCpus = workerCpus;
+    config.unityPriority = unityPriority;
+    config.unityCpus = unityCpus;
+    config.lockMemory = lockMemory != 0;
+    TestSharedStack::JackClient::getInstance().SetThreadConfig(config);
+}
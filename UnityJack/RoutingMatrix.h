@@ -0,0 +1,183 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "MixBus.h"
+#include "TripleBuffer.h"
+
+#include <algorithm>
+#include <mutex>
+#include <vector>
+
+// Direct monitoring: input ports mixed straight into output ports inside the JACK cycle, with a gain per
+// crosspoint, so a live input reaches the speakers in the same period it arrives instead of going through Unity.
+// The matrix is sparse, a sorted list of the crosspoints in use. Setters publish the whole list through a triple
+// buffer; the audio thread merges it with what it was playing, so gains that changed, and crosspoints that
+// appeared or went away, are ramped over one cycle instead of clicking.
+class RoutingMatrix
+{
+public:
+    struct Crosspoint
+    {
+        int output;
+        int input;
+        float gain;
+    };
+
+    RoutingMatrix(int inputs, int outputs, int maxCrosspoints)
+    : mInputs(inputs)
+    , mOutputs(outputs)
+    , mCapacity(maxCrosspoints)
+    , mActive(false)
+    {
+        mMaster.reserve(mCapacity);
+        for (int i = 0; i < 3; i++)
+            mTables.Slot(i).reserve(mCapacity);
+        mPlaying.reserve(2 * mCapacity);
+        mMerged.reserve(2 * mCapacity);
+    }
+
+    // Any thread: sets the gain from an input port to an output port, 0 removes the crosspoint. False when the
+    // ports don't exist or the matrix is full.
+    bool Set(int input, int output, float gain)
+    {
+        if (input < 0 || input >= mInputs || output < 0 || output >= mOutputs) return false;
+
+        std::lock_guard<std::mutex> lock(mMutex);
+        Crosspoint key = { output, input, gain };
+        std::vector<Crosspoint>::iterator it = std::lower_bound(mMaster.begin(), mMaster.end(), key, Before);
+        bool found = it != mMaster.end() && it->output == output && it->input == input;
+        if (gain == 0.0f)
+        {
+            if (!found) return true;
+            mMaster.erase(it);
+        }
+        else if (found)
+            it->gain = gain;
+        else if ((int)mMaster.size() >= mCapacity)
+            return false;
+        else
+            mMaster.insert(it, key);
+
+        publish();
+        return true;
+    }
+
+    // Any thread: removes every crosspoint
+    void Clear()
+    {
+        std::lock_guard<std::mutex> lock(mMutex);
+        mMaster.clear();
+        publish();
+    }
+
+    // Realtime: adds the routed inputs of one cycle to the outputs
+    void Process(const float* const* inputs, float* const* outputs, int numsamples)
+    {
+        if (!mActive.load(std::memory_order_acquire)) return;
+
+        if (mTables.Update()) merge(mTables.Front());
+        if (mPlaying.empty()) return;
+
+        bool faded = false;
+        for (size_t i = 0; i < mPlaying.size(); i++)
+        {
+            Playing& p = mPlaying[i];
+            MixAccumulate(outputs[p.output], inputs[p.input], p.from, p.to, numsamples);
+            faded = faded || p.from != p.to;
+            p.from = p.to;
+        }
+
+        // crosspoints that have faded out are gone
+        if (faded)
+        {
+            size_t kept = 0;
+            for (size_t i = 0; i < mPlaying.size(); i++)
+                if (mPlaying[i].to != 0.0f) mPlaying[kept++] = mPlaying[i];
+            mPlaying.resize(kept);
+        }
+    }
+
+private:
+    struct Playing
+    {
+        int output;
+        int input;
+        float from;     // gain at the start of the cycle
+        float to;       // and at its end
+    };
+
+    static bool Before(const Crosspoint& a, const Crosspoint& b)
+    {
+        return a.output != b.output ? a.output < b.output : a.input < b.input;
+    }
+
+    // Under mMutex
+    void publish()
+    {
+        mTables.Back() = mMaster;   // within the reserved capacity, so it never allocates
+        mTables.Publish();
+        mActive.store(true, std::memory_order_release);
+    }
+
+    // Realtime: the crosspoints of table, each starting from the gain it was playing at. Both lists are sorted
+    // the same way; mMerged has room for both, so nothing allocates.
+    void merge(const std::vector<Crosspoint>& table)
+    {
+        mMerged.clear();
+        size_t a = 0, b = 0;
+        while (a < mPlaying.size() || b < table.size())
+        {
+            Playing p;
+            bool old = a < mPlaying.size(), fresh = b < table.size();
+            if (old && fresh && mPlaying[a].output == table[b].output && mPlaying[a].input == table[b].input)
+            {
+                p = mPlaying[a++];
+                p.to = table[b++].gain;
+            }
+            else if (old && (!fresh || mPlaying[a].output < table[b].output
+                || (mPlaying[a].output == table[b].output && mPlaying[a].input < table[b].input)))
+            {
+                p = mPlaying[a++];
+                p.to = 0.0f;
+            }
+            else
+            {
+                p.output = table[b].output;
+                p.input = table[b].input;
+                p.from = 0.0f;
+                p.to = table[b++].gain;
+            }
+            mMerged.push_back(p);
+        }
+        mPlaying.swap(mMerged);
+    }
+
+    int mInputs;
+    int mOutputs;
+    int mCapacity;
+
+    std::vector<Crosspoint> mMaster;    // under mMutex
+    std::mutex mMutex;
+    TripleBuffer<std::vector<Crosspoint> > mTables;
+    std::atomic<bool> mActive;
+
+    std::vector<Playing> mPlaying;      // audio thread only
+    std::vector<Playing> mMerged;
+};
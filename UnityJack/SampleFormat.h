@@ -0,0 +1,343 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "AudioPluginUtil.h"
+
+#include <stdint.h>
+#include <string.h>
+
+// How samples are stored in the client's ringbuffers. The compact formats trade resolution for memory and
+// bandwidth, which matters more than the last bits once there are a hundred channels or so.
+enum RingFormat
+{
+    RingFormat_Float32 = 0,
+    RingFormat_Int16 = 1,   // TPDF dithered
+    RingFormat_Int24 = 2,   // TPDF dithered, packed in 3 little endian bytes
+    RingFormat_Float16 = 3, // IEEE half precision, about 11 bits of resolution at any level
+    RingFormat_Count
+};
+
+namespace SampleFormat
+{
+
+    inline int SampleBytes(RingFormat format)
+    {
+        switch (format)
+        {
+            case RingFormat_Int16: return 2;
+            case RingFormat_Int24: return 3;
+            case RingFormat_Float16: return 2;
+            default: return 4;
+        }
+    }
+
+    // Triangular dither of +-1 LSB from four interleaved xorshift generators, one per SSE lane. Every writer of
+    // a ringbuffer keeps its own.
+    struct Dither
+    {
+        Dither() { for (int i = 0; i < 4; i++) state[i] = 0x9e3779b9u * (i + 1); }
+        uint32_t state[4];
+    };
+
+    // Uniform in [-0.5, 0.5) from the top bits of a generator step
+    inline float NextUniform(uint32_t& x)
+    {
+        x ^= x << 13;
+        x ^= x >> 17;
+        x ^= x << 5;
+        union { uint32_t u; float f; } bits;
+        bits.u = (x >> 9) | 0x3f800000u;
+        return bits.f - 1.5f;
+    }
+
+    inline float NextTriangular(uint32_t& x)
+    {
+        float a = NextUniform(x);
+        return a + NextUniform(x);
+    }
+
+    inline uint16_t FloatToHalf(float value)
+    {
+        union { uint32_t u; float f; } f, magic;
+        f.f = value;
+        uint32_t sign = f.u & 0x80000000u;
+        f.u ^= sign;
+        uint16_t h;
+        if (f.u >= 0x477fe000u)
+            h = (f.u > 0x7f800000u) ? 0x7e00 : 0x7bff;  // NaN stays NaN, anything too loud clips to the largest half
+        else if (f.u < 0x38800000u)
+        {
+            // Subnormal half: the float addition rounds the mantissa into place
+            magic.u = 126u << 23;
+            f.f += magic.f;
+            h = (uint16_t)(f.u - magic.u);
+        }
+        else
+        {
+            uint32_t odd = (f.u >> 13) & 1;
+            f.u += 0xc8000fffu + odd;   // rebias the exponent and round to nearest even
+            h = (uint16_t)(f.u >> 13);
+        }
+        return (uint16_t)(h | (sign >> 16));
+    }
+
+    inline float HalfToFloat(uint16_t half)
+    {
+        union { uint32_t u; float f; } o, magic;
+        magic.u = 113u << 23;
+        o.u = (uint32_t)(half & 0x7fff) << 13;
+        uint32_t exponent = o.u & 0x0f800000u;
+        o.u += (127 - 15) << 23;
+        if (exponent == 0x0f800000u)
+            o.u += (128 - 16) << 23;    // Inf or NaN
+        else if (exponent == 0)
+        {
+            o.u += 1 << 23;             // subnormal, renormalized by the float subtraction
+            o.f -= magic.f;
+        }
+        o.u |= (uint32_t)(half & 0x8000) << 16;
+        return o.f;
+    }
+
+    // Clamps a scaled sample into [lo, hi] for the integer formats: infinities clip, NaN becomes silence. The SSE
+    // paths do the same with a NaN mask and _mm_max_ps/_mm_min_ps.
+    inline float ClampSample(float s, float lo, float hi)
+    {
+        if (s >= lo) return (s <= hi) ? s : hi;
+        return (s < lo) ? lo : 0.0f;
+    }
+
+    // Converts count samples into the ringbuffer format at dst
+    inline void Encode(RingFormat format, const float* src, void* dst, int count, Dither& dither)
+    {
+        int n = 0;
+        switch (format)
+        {
+        case RingFormat_Int16:
+        {
+            int16_t* out = (int16_t*)dst;
+#if UNITY_SSE
+            __m128i x = _mm_loadu_si128((const __m128i*)dither.state);
+            const __m128i mantissa = _mm_set1_epi32(0x3f800000);
+            const __m128 centre = _mm_set1_ps(3.0f);
+            const __m128 scale = _mm_set1_ps(32767.0f);
+            const __m128 lo = _mm_set1_ps(-32768.0f), hi = _mm_set1_ps(32767.0f);
+            for (; n + 7 < count; n += 8)
+            {
+                __m128i q[2];
+                for (int k = 0; k < 2; k++)
+                {
+                    // Two xorshift steps give the two uniform values of the triangular dither
+                    __m128 d = _mm_setzero_ps();
+                    for (int r = 0; r < 2; r++)
+                    {
+                        x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+                        x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+                        x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+                        d = _mm_add_ps(d, _mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(x, 9), mantissa)));
+                    }
+                    d = _mm_sub_ps(d, centre);
+                    __m128 s = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + n + 4 * k), scale), d);
+                    // clamped before converting: out of range, inf and NaN would all convert to 0x80000000
+                    s = _mm_and_ps(s, _mm_cmpord_ps(s, s));
+                    q[k] = _mm_cvtps_epi32(_mm_min_ps(_mm_max_ps(s, lo), hi));
+                }
+                _mm_storeu_si128((__m128i*)(out + n), _mm_packs_epi32(q[0], q[1]));
+            }
+            _mm_storeu_si128((__m128i*)dither.state, x);
+#endif
+            for (; n < count; n++)
+            {
+                float s = src[n] * 32767.0f + NextTriangular(dither.state[n & 3]);
+                s = ClampSample(s, -32768.0f, 32767.0f);
+                out[n] = (int16_t)(s < 0.0f ? s - 0.5f : s + 0.5f);
+            }
+            break;
+        }
+        case RingFormat_Int24:
+        {
+            uint8_t* out = (uint8_t*)dst;
+            int32_t q[4];
+#if UNITY_SSE
+            __m128i x = _mm_loadu_si128((const __m128i*)dither.state);
+            const __m128i mantissa = _mm_set1_epi32(0x3f800000);
+            const __m128 centre = _mm_set1_ps(3.0f);
+            const __m128 scale = _mm_set1_ps(8388607.0f);
+            const __m128 lo = _mm_set1_ps(-8388608.0f), hi = _mm_set1_ps(8388607.0f);
+            for (; n + 3 < count; n += 4)
+            {
+                __m128 d = _mm_setzero_ps();
+                for (int r = 0; r < 2; r++)
+                {
+                    x = _mm_xor_si128(x, _mm_slli_epi32(x, 13));
+                    x = _mm_xor_si128(x, _mm_srli_epi32(x, 17));
+                    x = _mm_xor_si128(x, _mm_slli_epi32(x, 5));
+                    d = _mm_add_ps(d, _mm_castsi128_ps(_mm_or_si128(_mm_srli_epi32(x, 9), mantissa)));
+                }
+                d = _mm_sub_ps(d, centre);
+                __m128 s = _mm_add_ps(_mm_mul_ps(_mm_loadu_ps(src + n), scale), d);
+                s = _mm_and_ps(s, _mm_cmpord_ps(s, s));
+                s = _mm_min_ps(_mm_max_ps(s, lo), hi);
+                _mm_storeu_si128((__m128i*)q, _mm_cvtps_epi32(s));
+                for (int k = 0; k < 4; k++)
+                {
+                    uint8_t* p = out + 3 * (n + k);
+                    p[0] = (uint8_t)q[k];
+                    p[1] = (uint8_t)(q[k] >> 8);
+                    p[2] = (uint8_t)(q[k] >> 16);
+                }
+            }
+            _mm_storeu_si128((__m128i*)dither.state, x);
+#endif
+            for (; n < count; n++)
+            {
+                float s = src[n] * 8388607.0f + NextTriangular(dither.state[n & 3]);
+                s = ClampSample(s, -8388608.0f, 8388607.0f);
+                int32_t v = (int32_t)(s < 0.0f ? s - 0.5f : s + 0.5f);
+                uint8_t* p = out + 3 * n;
+                p[0] = (uint8_t)v;
+                p[1] = (uint8_t)(v >> 8);
+                p[2] = (uint8_t)(v >> 16);
+            }
+            break;
+        }
+        case RingFormat_Float16:
+        {
+            uint16_t* out = (uint16_t*)dst;
+#if UNITY_SSE
+            // FloatToHalf four at a time, both rounding paths computed and blended
+            const __m128i absmask = _mm_set1_epi32(0x7fffffff);
+            const __m128i maxhalf = _mm_set1_epi32(0x477fe000 - 1);
+            const __m128i minnormal = _mm_set1_epi32(0x38800000);
+            const __m128i rebias = _mm_set1_epi32((int)0xc8000fffu);
+            const __m128i one = _mm_set1_epi32(1);
+            const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32(126 << 23));
+            const __m128i largest = _mm_set1_epi32(0x7bff);
+            const __m128i infinity = _mm_set1_epi32(0x7f800000);
+            const __m128i quietnan = _mm_set1_epi32(0x7e00);
+            for (; n + 3 < count; n += 4)
+            {
+                __m128i bits = _mm_castps_si128(_mm_loadu_ps(src + n));
+                __m128i a = _mm_and_si128(bits, absmask);
+                __m128i sign = _mm_srai_epi32(_mm_andnot_si128(absmask, bits), 16);
+
+                __m128i normal = _mm_srli_epi32(_mm_add_epi32(_mm_add_epi32(a, rebias),
+                    _mm_and_si128(_mm_srli_epi32(a, 13), one)), 13);
+                __m128i subnormal = _mm_sub_epi32(_mm_castps_si128(_mm_add_ps(_mm_castsi128_ps(a), magic)),
+                    _mm_castps_si128(magic));
+                __m128i small = _mm_cmplt_epi32(a, minnormal);
+                __m128i h = _mm_or_si128(_mm_and_si128(small, subnormal), _mm_andnot_si128(small, normal));
+                __m128i loud = _mm_cmpgt_epi32(a, maxhalf);
+                h = _mm_or_si128(_mm_and_si128(loud, largest), _mm_andnot_si128(loud, h));
+                __m128i nan = _mm_cmpgt_epi32(a, infinity);    // NaN stays NaN, as in FloatToHalf
+                h = _mm_or_si128(_mm_and_si128(nan, quietnan), _mm_andnot_si128(nan, h));
+                h = _mm_or_si128(h, _mm_and_si128(sign, _mm_set1_epi32(0x8000)));
+
+                // Pack the low halves of the four lanes without saturating
+                h = _mm_shufflelo_epi16(h, _MM_SHUFFLE(3, 3, 2, 0));
+                h = _mm_shufflehi_epi16(h, _MM_SHUFFLE(3, 3, 2, 0));
+                h = _mm_shuffle_epi32(h, _MM_SHUFFLE(3, 3, 2, 0));
+                _mm_storel_epi64((__m128i*)(out + n), h);
+            }
+#endif
+            for (; n < count; n++)
+                out[n] = FloatToHalf(src[n]);
+            break;
+        }
+        default:
+            memcpy(dst, src, count * sizeof(float));
+            break;
+        }
+    }
+
+    // Converts count samples in the ringbuffer format at src back to float
+    inline void Decode(RingFormat format, const void* src, float* dst, int count)
+    {
+        int n = 0;
+        switch (format)
+        {
+        case RingFormat_Int16:
+        {
+            const int16_t* in = (const int16_t*)src;
+#if UNITY_SSE
+            const __m128 scale = _mm_set1_ps(1.0f / 32768.0f);
+            for (; n + 7 < count; n += 8)
+            {
+                __m128i v = _mm_loadu_si128((const __m128i*)(in + n));
+                __m128i lo = _mm_srai_epi32(_mm_unpacklo_epi16(v, v), 16);
+                __m128i hi = _mm_srai_epi32(_mm_unpackhi_epi16(v, v), 16);
+                _mm_storeu_ps(dst + n, _mm_mul_ps(_mm_cvtepi32_ps(lo), scale));
+                _mm_storeu_ps(dst + n + 4, _mm_mul_ps(_mm_cvtepi32_ps(hi), scale));
+            }
+#endif
+            for (; n < count; n++)
+                dst[n] = in[n] * (1.0f / 32768.0f);
+            break;
+        }
+        case RingFormat_Int24:
+        {
+            const uint8_t* in = (const uint8_t*)src;
+            for (; n < count; n++)
+            {
+                const uint8_t* p = in + 3 * n;
+                int32_t v = (int32_t)((uint32_t)p[0] << 8 | (uint32_t)p[1] << 16 | (uint32_t)p[2] << 24) >> 8;
+                dst[n] = v * (1.0f / 8388608.0f);
+            }
+            break;
+        }
+        case RingFormat_Float16:
+        {
+            const uint16_t* in = (const uint16_t*)src;
+#if UNITY_SSE
+            // HalfToFloat four at a time
+            const __m128i magnitude = _mm_set1_epi32(0x7fff);
+            const __m128i exponentmask = _mm_set1_epi32(0x0f800000);
+            const __m128i bias = _mm_set1_epi32((127 - 15) << 23);
+            const __m128i infbias = _mm_set1_epi32((128 - 16) << 23);
+            const __m128i implicit = _mm_set1_epi32(1 << 23);
+            const __m128 magic = _mm_castsi128_ps(_mm_set1_epi32(113 << 23));
+            for (; n + 3 < count; n += 4)
+            {
+                __m128i h = _mm_unpacklo_epi16(_mm_loadl_epi64((const __m128i*)(in + n)), _mm_setzero_si128());
+                __m128i o = _mm_slli_epi32(_mm_and_si128(h, magnitude), 13);
+                __m128i exponent = _mm_and_si128(o, exponentmask);
+                o = _mm_add_epi32(o, bias);
+
+                __m128i special = _mm_cmpeq_epi32(exponent, exponentmask);
+                o = _mm_add_epi32(o, _mm_and_si128(special, infbias));
+                __m128i subnormal = _mm_cmpeq_epi32(exponent, _mm_setzero_si128());
+                __m128i renormalized = _mm_castps_si128(_mm_sub_ps(_mm_castsi128_ps(_mm_add_epi32(o, implicit)), magic));
+                o = _mm_or_si128(_mm_and_si128(subnormal, renormalized), _mm_andnot_si128(subnormal, o));
+
+                o = _mm_or_si128(o, _mm_slli_epi32(_mm_andnot_si128(magnitude, h), 16));
+                _mm_storeu_ps(dst + n, _mm_castsi128_ps(o));
+            }
+#endif
+            for (; n < count; n++)
+                dst[n] = HalfToFloat(in[n]);
+            break;
+        }
+        default:
+            memcpy(dst, src, count * sizeof(float));
+            break;
+        }
+    }
+
+} // !namespace SampleFormat
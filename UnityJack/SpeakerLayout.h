@@ -0,0 +1,276 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "AudioPluginUtil.h"
+
+#include <algorithm>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+// Speaker positions around the listener and the panning laws over them. Coordinates are Unity's listener space:
+// x right, y up, z forward, in meters.
+//
+// A layout file has one speaker per line, in JACK output port order:
+//
+//     # azimuth elevation [distance]
+//     -30  0  2.5
+//      30  0  2.5
+//
+// Azimuth is in degrees clockwise from the front, elevation in degrees up from the horizon and distance in meters
+// (1 when left out). Everything after a '#' is a comment.
+class SpeakerLayout
+{
+public:
+    enum { kMaxSpeakers = 64 };
+
+    SpeakerLayout() : numspeakers(0), planar(false) {}
+
+    bool Load(const char* path)
+    {
+        std::ifstream file(path);
+        if (!file) return false;
+
+        std::vector<float> positions;
+        std::string line;
+        while (std::getline(file, line))
+        {
+            size_t comment = line.find('#');
+            if (comment != std::string::npos) line.erase(comment);
+            std::istringstream fields(line);
+            float azimuth, elevation, distance = 1.0f;
+            if (!(fields >> azimuth >> elevation)) continue;
+            fields >> distance;
+            if ((int)positions.size() == 3 * kMaxSpeakers) return false;
+
+            float az = azimuth * kPI / 180.0f, el = elevation * kPI / 180.0f;
+            positions.push_back(distance * cosf(el) * sinf(az));
+            positions.push_back(distance * sinf(el));
+            positions.push_back(distance * cosf(el) * cosf(az));
+        }
+        return Set(positions.data(), (int)positions.size() / 3);
+    }
+
+    // Positions as x, y, z triples
+    bool Set(const float* positions, int count)
+    {
+        if (count <= 0 || count > kMaxSpeakers) return false;
+        numspeakers = count;
+        planar = true;
+        for (int i = 0; i < count; i++)
+        {
+            for (int k = 0; k < 3; k++)
+                position[i][k] = positions[i * 3 + k];
+            float length = sqrtf(Dot(position[i], position[i]));
+            if (length < 1.0e-6f) return false;
+            for (int k = 0; k < 3; k++)
+                direction[i][k] = position[i][k] / length;
+            if (fabsf(direction[i][1]) > 1.0e-3f)
+                planar = false;
+        }
+        if (planar || numspeakers < 3)
+            BuildPairs();
+        else
+            BuildTriangles();
+        return true;
+    }
+
+    int GetNumSpeakers() const { return numspeakers; }
+
+    // Vector base amplitude panning towards a direction (need not be normalized), power-normalized gains
+    void ComputeVBAP(const float* source, float* gains) const
+    {
+        for (int i = 0; i < numspeakers; i++)
+            gains[i] = 0.0f;
+        if (numspeakers == 1)
+        {
+            gains[0] = 1.0f;
+            return;
+        }
+        if (planar && fabsf(source[0]) + fabsf(source[2]) < 1.0e-6f)
+        {
+            // Straight above or below a horizontal ring, which every speaker is equally close to
+            for (int i = 0; i < numspeakers; i++)
+                gains[i] = 1.0f / sqrtf((float)numspeakers);
+            return;
+        }
+
+        // The base whose smallest gain is largest contains the direction; when none does (below a dome, say) it
+        // is also the nearest one, and its negative gains are dropped.
+        float best[3] = { 0.0f, 0.0f, 0.0f }, bestmin = -1.0e30f;
+        int bestbase = -1;
+        for (size_t b = 0; b < bases.size(); b++)
+        {
+            const Base& base = bases[b];
+            float g[3];
+            for (int k = 0; k < base.size; k++)
+                g[k] = planar ? base.inverse[k][0] * source[0] + base.inverse[k][2] * source[2] : Dot(base.inverse[k], source);
+            float smallest = g[0];
+            for (int k = 1; k < base.size; k++)
+                smallest = FastMin(smallest, g[k]);
+            if (smallest > bestmin)
+            {
+                bestmin = smallest;
+                bestbase = (int)b;
+                for (int k = 0; k < base.size; k++)
+                    best[k] = g[k];
+            }
+        }
+        if (bestbase < 0) return;
+
+        const Base& base = bases[bestbase];
+        float power = 0.0f;
+        for (int k = 0; k < base.size; k++)
+        {
+            best[k] = FastMax(best[k], 0.0f);
+            power += best[k] * best[k];
+        }
+        float scale = (power > 1.0e-12f) ? 1.0f / sqrtf(power) : 0.0f;
+        for (int k = 0; k < base.size; k++)
+            gains[base.speakers[k]] = best[k] * scale;
+    }
+
+    // Distance based amplitude panning from a source position. rolloff is the attenuation in dB per doubling of
+    // distance and blur a distance in meters added to every speaker, which keeps a source on a speaker from
+    // collapsing onto it alone.
+    void ComputeDBAP(const float* source, float rolloff, float blur, float* gains) const
+    {
+        const float exponent = rolloff / 6.0206f;
+        float power = 0.0f;
+        for (int i = 0; i < numspeakers; i++)
+        {
+            float d[3] = { source[0] - position[i][0], source[1] - position[i][1], source[2] - position[i][2] };
+            float distance2 = Dot(d, d) + blur * blur + 1.0e-6f;
+            gains[i] = powf(distance2, -0.5f * exponent);
+            power += gains[i] * gains[i];
+        }
+        float scale = 1.0f / sqrtf(power);
+        for (int i = 0; i < numspeakers; i++)
+            gains[i] *= scale;
+    }
+
+private:
+    struct Base
+    {
+        int size;               // 2 speakers for a pair on the horizon, 3 for a triangle
+        int speakers[3];
+        float inverse[3][3];    // rows map a direction to the gains of the speakers
+    };
+
+    static float Dot(const float* a, const float* b) { return a[0] * b[0] + a[1] * b[1] + a[2] * b[2]; }
+
+    static void Cross(const float* a, const float* b, float* c)
+    {
+        c[0] = a[1] * b[2] - a[2] * b[1];
+        c[1] = a[2] * b[0] - a[0] * b[2];
+        c[2] = a[0] * b[1] - a[1] * b[0];
+    }
+
+    // Neighbouring speakers around the horizon
+    void BuildPairs()
+    {
+        bases.clear();
+        std::vector<int> order(numspeakers);
+        std::vector<float> azimuth(numspeakers);
+        for (int i = 0; i < numspeakers; i++)
+        {
+            order[i] = i;
+            azimuth[i] = atan2f(direction[i][0], direction[i][2]);
+        }
+        for (int i = 1; i < numspeakers; i++)
+            for (int j = i; j > 0 && azimuth[order[j]] < azimuth[order[j - 1]]; j--)
+                std::swap(order[j], order[j - 1]);
+
+        int numpairs = (numspeakers == 2) ? 1 : numspeakers;
+        for (int p = 0; p < numpairs; p++)
+        {
+            int a = order[p], b = order[(p + 1) % numspeakers];
+            float det = direction[a][0] * direction[b][2] - direction[a][2] * direction[b][0];
+            if (fabsf(det) < 1.0e-4f) continue; // a pair 180 degrees apart doesn't span anything
+            Base base;
+            memset(&base, 0, sizeof(base));
+            base.size = 2;
+            base.speakers[0] = a;
+            base.speakers[1] = b;
+            base.inverse[0][0] = direction[b][2] / det;
+            base.inverse[0][2] = -direction[b][0] / det;
+            base.inverse[1][0] = -direction[a][2] / det;
+            base.inverse[1][2] = direction[a][0] / det;
+            bases.push_back(base);
+        }
+    }
+
+    // Faces of the convex hull of the speaker directions, which for points on a sphere are its Delaunay
+    // triangles. Brute force, but it only runs when a layout is loaded.
+    void BuildTriangles()
+    {
+        bases.clear();
+        const float epsilon = 1.0e-4f;
+        for (int i = 0; i < numspeakers; i++)
+        for (int j = i + 1; j < numspeakers; j++)
+        for (int k = j + 1; k < numspeakers; k++)
+        {
+            const float *a = direction[i], *b = direction[j], *c = direction[k];
+            float ab[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+            float ac[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+            float normal[3];
+            Cross(ab, ac, normal);
+            if (Dot(normal, normal) < epsilon * epsilon) continue;
+
+            bool above = false, below = false;
+            for (int m = 0; m < numspeakers && !(above && below); m++)
+            {
+                float d[3] = { direction[m][0] - a[0], direction[m][1] - a[1], direction[m][2] - a[2] };
+                float side = Dot(normal, d);
+                above |= side > epsilon;
+                below |= side < -epsilon;
+            }
+            if (above && below) continue;
+
+            // A face through the listener (the open bottom of a dome, say) has no inverse
+            float bc[3], ca[3], abx[3];
+            Cross(b, c, bc);
+            Cross(c, a, ca);
+            Cross(a, b, abx);
+            float det = Dot(a, bc);
+            if (fabsf(det) < epsilon) continue;
+
+            Base base;
+            base.size = 3;
+            base.speakers[0] = i;
+            base.speakers[1] = j;
+            base.speakers[2] = k;
+            for (int n = 0; n < 3; n++)
+            {
+                base.inverse[0][n] = bc[n] / det;
+                base.inverse[1][n] = ca[n] / det;
+                base.inverse[2][n] = abx[n] / det;
+            }
+            bases.push_back(base);
+        }
+    }
+
+    int numspeakers;
+    bool planar;
+    float position[kMaxSpeakers][3];
+    float direction[kMaxSpeakers][3];
+    std::vector<Base> bases;
+};
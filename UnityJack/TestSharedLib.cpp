@@ -38,6 +38,7 @@
     #include <unistd.h>
     #include <string.h>
 #elif UNITY_WIN
+    #include <winsock2.h> // before windows.h, for the network bridge
     #include <windows.h>
 	#define _STDINT_H //for jack int definition
 #endif
@@ -51,7 +52,16 @@
 #endif
 
 #include "InternalJackClient.h"
+#include "NetworkBridge.h"
+#include "MixBus.h"
+#include "AmbisonicEncoder.h"
+#include "ChannelKernels.h"
+#include "SpeakerLayout.h"
+#include "TraceRecorder.h"
+#include "TrackBlockQueue.h"
 #include <array>
+#include <atomic>
+#include <mutex>
 
 // #define TRACKS 16
 #define BUFSIZE 1024
@@ -78,28 +88,76 @@ public:
     int SetAllData(float* buffer) {
         
         if (!initialized) return 0;
+        PromoteCallingThread();
+        TraceScope trace(Trace_SetAllData);
 
         client->setAudioBuffer(buffer);
         return 0;
     }
 	
-    int SetData(int idx, float* buffer) {
-        
-        if (!initialized) return 0;
-        
-        for (int i = 0; i < BUFSIZE; i++) {
-            mixedBuffer[(i * _outputs) + idx] = buffer[i];
+    // Sends one block of many tracks at once, straight from the caller's arrays: tracks[i] holds track i's
+    // samples, at least a full cycle of them, and is only read when bit i of mask is set. Tracks that aren't
+    // flagged, or are silent, play silence.
+    int SetPlanarData(const float* const* tracks, int numtracks, const uint64_t* mask, int length) {
+
+        if (!initialized || tracks == nullptr || mask == nullptr) return 0;
+        PromoteCallingThread();
+
+        for (int ch = 0; ch < _outputs; ch++) {
+            bool flagged = ch < numtracks && TrackFlagged(mask, ch);
+            planarRows[ch] = (flagged && tracks[ch] != nullptr && !IsSilent(tracks[ch], length)) ? tracks[ch] : nullptr;
         }
-        
-        // Increase the index until the mixed buffer is filled.
-        track++;
+        client->setAudioRows(planarRows);
+        return 0;
+    }
+
+    // A block of native memory for every output track, to fill from any thread (C# jobs, say) and hand over with
+    // SubmitTrackBlock. Track t starts stride samples after track t - 1. Returns the same block until it is
+    // submitted, and nullptr while the queue is full. Blocks stay valid until the client is destroyed.
+    float* AcquireTrackBlock(int* stride, int* tracks) {
+        if (stride != nullptr) *stride = initialized ? _trackBlocks.GetStride() : 0;
+        if (tracks != nullptr) *tracks = initialized ? _trackBlocks.GetTracks() : 0;
+        if (!initialized) return nullptr;
+        return _trackBlocks.Acquire();
+    }
+
+    // Queues the acquired block, with bit t of mask set for every track written (all of them when it is null)
+    bool SubmitTrackBlock(const uint64_t* mask) {
+        if (!initialized) return false;
+        return _trackBlocks.Submit(mask);
+    }
 
-        // if filled send to ringbuffer, restart index
-        if (track == _outputs) {
-            client->setAudioBuffer(mixedBuffer);
-            track = 0;
+    // Realtime: sends the oldest submitted block straight from its native memory; false when none is waiting
+    bool SendTrackBlock(int length) {
+        if (!initialized || length > BUFSIZE) return false;
+        PromoteCallingThread();
+
+        const uint64_t* mask;
+        const float* block = _trackBlocks.Front(&mask);
+        if (block == nullptr) return false;
+        for (int ch = 0; ch < _outputs; ch++) {
+            const float* track = block + ch * _trackBlocks.GetStride();
+            planarRows[ch] = (TrackFlagged(mask, ch) && !IsSilent(track, length)) ? track : nullptr;
         }
+        client->setAudioRows(planarRows);
+        _trackBlocks.Pop();
+        return true;
+    }
+
+    // Realtime: marks the Unity DSP tick an effect is processing. Every effect calls this first, so the previous
+    // tick's output bus goes out to JACK as soon as the next tick starts, however many sends ran in it.
+    void Tick(uint64_t tick) {
+        if (!initialized) return;
+        PublishOutputs(tick);
+    }
+
+    // Realtime: adds a send's block to an output port for the given Unity tick. Any number of sends may target
+    // the same port, from any mixer thread; the port carries their sum once the tick is over.
+    int SetData(int idx, uint64_t tick, const float* buffer, int length) {
         
+        if (idx < 0) return 0;
+        const float unity = 1.0f;
+        MixOutputs(tick, buffer, &unity, &unity, 1, length, idx);
         return 0;
     }
     
@@ -109,29 +167,198 @@ public:
     }
     
 
-    int GetData(int idx, float* buffer) {
-    
-        if (!initialized) return 0;
+    // Copies one input port's block of the given Unity DSP tick. The first receiver to ask for a new tick pulls
+    // the interleaved block from the ringbuffer and splits it into one row per port, the rest copy their row.
+    // Ports without data for the tick read silence. Receivers never wait: one that asks while another mixer
+    // thread is still pulling the tick gets the previous tick's row.
+    int GetPortData(int idx, uint64_t tick, float* buffer, int length) {
 
-        client->getAudioBuffer(mixedBufferIn);
-        
-        for (int i = 0; i < BUFSIZE; i++) {
-            buffer[i] = mixedBufferIn[(i * _inputs) + idx];
+        if (!initialized || idx < 0 || idx >= _inputs || length > BUFSIZE) {
+            memset(buffer, 0, length * sizeof(float));
+            return 0;
         }
-        
+
+        // ticks are stored plus one so the zero-initialized state never matches a real tick
+        uint64_t stamp = tick + 1;
+        if (_receivedTick.load(std::memory_order_acquire) != stamp) {
+            uint64_t claimed = _receiveClaim.load(std::memory_order_relaxed);
+            if (claimed != stamp && _receiveClaim.compare_exchange_strong(claimed, stamp, std::memory_order_acq_rel)) {
+                PullInputs(stamp, length);
+                _receivedTick.store(stamp, std::memory_order_release);
+            }
+        }
+
+        // the half last pulled into: this tick's, or the previous one while the pull is under way. A later pull
+        // may start rewriting it during the copy, which its stamp then shows.
+        int half = _receiveHalf.load(std::memory_order_acquire);
+        uint64_t held = _receiveStamp[half].load(std::memory_order_acquire);
+        if (held != 0) {
+            memcpy(buffer, &receiveBuffer[(half * _inputs + idx) * BUFSIZE], length * sizeof(float));
+            std::atomic_thread_fence(std::memory_order_acquire);
+            if (_receiveStamp[half].load(std::memory_order_relaxed) == held) return 0;
+        }
+        memset(buffer, 0, length * sizeof(float));
         return 0;
     }
     
+    // Realtime: adds a mono block to the output ports firstport onwards for the current Unity tick, each port's
+    // gain ramped from gains0 to gains1. Whatever was mixed in the previous tick goes out to JACK first.
+    void MixOutputs(uint64_t tick, const float* block, const float* gains0, const float* gains1, int numgains, int length, int firstport = 0) {
+
+        if (!initialized || length > BUFSIZE) return;
+        PromoteCallingThread();
+        PublishOutputs(tick);
+        if (IsSilent(block, length)) return; // a silent send leaves its ports untouched, and idle ports cost nothing
+
+        MixBus::Bank* bank = _outputBus.Begin(tick);
+        if (bank == nullptr || firstport < 0) return;
+        int ports = _outputs - firstport;
+        if (numgains < ports) ports = numgains;
+        for (int i = 0; i < ports; i++) {
+            if (gains0[i] == 0.0f && gains1[i] == 0.0f) continue;
+            MixAccumulate(bank->Row(firstport + i), block, gains0[i], gains1[i], length);
+        }
+    }
+
+    // Replaces the speaker layout the spatializer pans over. Replaced layouts stay allocated, since a
+    // spatializer may still be reading one; layouts are small and rarely reloaded.
+    bool LoadSpeakerLayout(const char* path) {
+        std::unique_ptr<SpeakerLayout> layout(new SpeakerLayout());
+        if (!layout->Load(path)) {
+            std::cout << "Could not load speaker layout " << path << std::endl;
+            return false;
+        }
+        std::lock_guard<std::mutex> lock(_layoutMutex);
+        _speakerLayout.store(layout.get(), std::memory_order_release);
+        _layouts.push_back(std::move(layout));
+        return true;
+    }
+
+    const SpeakerLayout* GetSpeakerLayout() const {
+        return _speakerLayout.load(std::memory_order_acquire);
+    }
+
+    bool SetInputConvolution(int port, const float* ir, int length) {
+        if (!initialized) return false;
+        return client->setInputConvolution(port, ir, length);
+    }
+
+    // Speaker alignment on an output port, applied by the JACK client after the ringbuffer
+    bool SetOutputDelay(int port, float milliseconds) {
+        if (!initialized) return false;
+        return client->setOutputDelay(port, milliseconds);
+    }
+
+    // One band of the speaker EQ on an output port, applied by the JACK client after the ringbuffer
+    bool SetOutputEq(int port, int band, int type, float frequency, float gain, float q) {
+        if (!initialized) return false;
+        return client->setOutputEq(port, band, type, frequency, gain, q);
+    }
+
+    // Output protection (DC blocker and lookahead limiter) on a port, or on every port when port is -1
+    bool SetOutputProtection(int port, bool enabled, float thresholdDb) {
+        if (!initialized) return false;
+        if (port >= 0) return client->setOutputProtection(port, enabled, thresholdDb);
+        bool ok = true;
+        for (int i = 0; i < _outputs; i++)
+            ok = client->setOutputProtection(i, enabled, thresholdDb) && ok;
+        return ok;
+    }
+
+    // Direct monitoring: mixes a JACK input port into an output port inside the JACK cycle, 0 removes the route
+    bool SetMonitorRoute(int input, int output, float gain) {
+        if (!initialized) return false;
+        return client->setMonitorRoute(input, output, gain);
+    }
+
+    bool ClearMonitorRoutes() {
+        if (!initialized) return false;
+        return client->clearMonitorRoutes();
+    }
+
+    // Limiter metering: fills up to count ports with their largest gain reduction since the last call, in dB
+    int GetOutputGainReduction(float* reductionDb, int count) {
+        if (!initialized) return 0;
+        return client->getOutputGainReduction(reductionDb, count);
+    }
+
+    // Records the audio path into a Chrome trace at path, until StopTrace. Works with or without a client.
+    bool StartTrace(const char* path) {
+        if (path == nullptr) return false;
+        return TraceRecorder::getInstance().Start(path);
+    }
+
+    void StopTrace() {
+        TraceRecorder::getInstance().Stop();
+    }
+
+    // Takes effect the next time the client is created
+    void SetWorkerThreads(int count) {
+        _workers = count > 0 ? count : 0;
+    }
+
+    // Takes effect the next time the client is created
+    void SetRingFormat(int format) {
+        _format = (format >= 0 && format < RingFormat_Count) ? (RingFormat)format : RingFormat_Float32;
+    }
+
+    // Streams to a UnityJackReceiver at host:port instead of a local JACK server from the next time the client is
+    // created, in blocks of frames (Unity's DSP buffer size). An empty host goes back to JACK.
+    void SetNetworkTarget(const char* host, int port, int frames) {
+        _networkHost = (host != nullptr) ? host : "";
+        _networkPort = port;
+        _networkFrames = (frames > 0 && frames < BUFSIZE) ? frames : BUFSIZE;
+    }
+
+    // Worker and memory settings take effect the next time the client is created,
+    // the Unity thread settings the next time the audio thread hands us data
+    void SetThreadConfig(const ThreadConfig& config) {
+        _threads = config;
+        _unityPriority.store(config.unityPriority, std::memory_order_relaxed);
+        _unityCpus.store(config.unityCpus, std::memory_order_relaxed);
+        _threadsGeneration.fetch_add(1, std::memory_order_release);
+    }
+
+    // Applies the Unity thread settings to whichever thread calls into the send path,
+    // once per configuration change
+    void PromoteCallingThread() {
+        static thread_local int applied = 0;
+        int generation = _threadsGeneration.load(std::memory_order_acquire);
+        if (applied == generation) return;
+        applied = generation;
+        ThreadUtil::SetRealtime(ThreadUtil::CurrentThread(), _unityPriority.load(std::memory_order_relaxed));
+        ThreadUtil::SetAffinity(ThreadUtil::CurrentThread(), _unityCpus.load(std::memory_order_relaxed));
+    }
+
     bool createClient(int inputs, int outputs)
     {
         if (!initialized){
             std::cout << "Creating Client " << inputs << " " << outputs << std::endl;
             _inputs = inputs;
             _outputs = outputs;
-            client.reset(new InternalJackClient("Unity3D",inputs,outputs));
+            _deinterleaveInputs = ChannelKernels::SelectDeinterleave(_inputs);
+            size_t outBytes = BufferArena::Align(_outputs * BUFSIZE * sizeof(float));
+            size_t inBytes = BufferArena::Align(_inputs * BUFSIZE * sizeof(float));
+            size_t busBytes = MixBus::GetArenaBytes(_outputs, BUFSIZE) + BufferArena::Align(_outputs)
+                            + BufferArena::Align(sizeof(float*) * _outputs)
+                            + TrackBlockQueue::GetArenaBytes(_outputs, BUFSIZE);
+            size_t extraBytes = outBytes + 3 * inBytes + busBytes;
+            if (_networkHost.empty())
+                client.reset(new InternalJackClient("Unity3D",inputs,outputs,_workers,_threads,extraBytes,_format));
+            else
+                client.reset(new NetworkBridge::NetworkClient(_networkHost,_networkPort,inputs,outputs,_networkFrames,extraBytes,_format));
 
-            mixedBuffer = (float*)malloc(_outputs * BUFSIZE * sizeof(float));
-            mixedBufferIn = (float*)malloc(_inputs * BUFSIZE * sizeof(float));
+            // the interleaving buffers live in the client's arena, together with its ringbuffers
+            mixedBufferIn = client->arena().Allocate<float>(_inputs * BUFSIZE);
+            receiveBuffer = client->arena().Allocate<float>(2 * _inputs * BUFSIZE);
+            _receiveHalf.store(0, std::memory_order_relaxed);
+            _receiveStamp[0].store(0, std::memory_order_relaxed);
+            _receiveStamp[1].store(0, std::memory_order_relaxed);
+            busBuffer = client->arena().Allocate<float>(_outputs * BUFSIZE);
+            busActive = client->arena().Allocate<uint8_t>(_outputs);
+            planarRows = client->arena().Allocate<const float*>(_outputs);
+            _outputBus.Init(client->arena(), _outputs, BUFSIZE);
+            _trackBlocks.Init(client->arena(), _outputs, BUFSIZE);
             
             initialized = true;
 
@@ -145,8 +372,11 @@ public:
         if (initialized) {
             initialized = false; // important: initialized flag must be false before resetting the client.
             client.reset();
-            free(mixedBuffer);
-            free(mixedBufferIn);
+            mixedBufferIn = nullptr;
+            receiveBuffer = nullptr;
+            busBuffer = nullptr;
+            busActive = nullptr;
+            planarRows = nullptr;
         }
         return initialized;
     }
@@ -157,6 +387,37 @@ private:
     JackClient() {
         std::cout << "Trying to create" << std::endl;
     }
+
+    static bool TrackFlagged(const uint64_t* mask, int track) {
+        return (mask[track / 64] & ((uint64_t)1 << (track % 64))) != 0;
+    }
+
+    // Sends the previous tick's output bus to JACK, once per tick. Only ports that carry sound go through the
+    // ringbuffer: nothing was mixed into the others, or what was mixed cancelled out or decayed to silence.
+    void PublishOutputs(uint64_t tick) {
+        if (!_outputBus.Collect(tick, busBuffer, busActive)) return;
+        TraceScope trace(Trace_PublishOutputs);
+        for (int ch = 0; ch < _outputs; ch++) {
+            if (busActive[ch] && IsSilent(&busBuffer[ch * BUFSIZE], BUFSIZE))
+                busActive[ch] = 0;
+        }
+        client->setAudioChannels(busBuffer, BUFSIZE, busActive);
+    }
+
+    // Deinterleaves one block of every input port into the half of receiveBuffer not being read, or zeroes it
+    // on underrun, then makes it the one receivers read. Only the thread that claimed the tick gets here.
+    void PullInputs(uint64_t stamp, int length) {
+        int half = _receiveHalf.load(std::memory_order_relaxed) ^ 1;
+        float* rows = &receiveBuffer[half * _inputs * BUFSIZE];
+        _receiveStamp[half].store(0, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_release);
+        if (client->readInput(mixedBufferIn, length))
+            _deinterleaveInputs(mixedBufferIn, rows, BUFSIZE, _inputs, length);
+        else
+            memset(rows, 0, _inputs * BUFSIZE * sizeof(float));
+        _receiveStamp[half].store(stamp, std::memory_order_release);
+        _receiveHalf.store(half, std::memory_order_release);
+    }
     
 
 public:
@@ -166,17 +427,37 @@ public:
 private:
 
     // TODO: use better this? http://stackoverflow.com/questions/35008089/elegantly-define-multi-dimensional-array-in-modern-c
-    std::unique_ptr<InternalJackClient> client;
-    // float mixedBuffer[TRACKS * BUFSIZE];
+    std::unique_ptr<AudioTransport> client;
     // float mixedBufferIn[TRACKS * BUFSIZE];
-    float *mixedBuffer;
     float *mixedBufferIn;
+    float *receiveBuffer; // two halves of one row of BUFSIZE per input port, pulled into in turn once per Unity tick
+    ChannelKernels::DeinterleaveFn _deinterleaveInputs;
+    std::atomic<uint64_t> _receiveClaim;
+    std::atomic<uint64_t> _receivedTick;
+    std::atomic<int> _receiveHalf;              // the half last pulled into
+    std::atomic<uint64_t> _receiveStamp[2];     // stamp of the tick each half holds, 0 while it is rewritten
+    MixBus _outputBus;
+    float *busBuffer;   // the output bus summed over all mixer threads, one row per port
+    uint8_t *busActive; // ports of busBuffer that carry sound
+    const float **planarRows;   // SetPlanarData's rows, nullptr for silent tracks
+    TrackBlockQueue _trackBlocks;
+    std::atomic<const SpeakerLayout*> _speakerLayout;
+    std::vector<std::unique_ptr<SpeakerLayout>> _layouts;
+    std::mutex _layoutMutex;
 
     int foo = 5;
-    int track;
     bool initialized;
     int _inputs, _outputs;
     int _index;
+    int _workers;
+    RingFormat _format;
+    std::string _networkHost;
+    int _networkPort;
+    int _networkFrames;
+    ThreadConfig _threads;
+    std::atomic<int> _threadsGeneration;
+    std::atomic<int> _unityPriority;
+    std::atomic<uint64_t> _unityCpus;
 };
     
 } // !namespace TestSharedStack
@@ -0,0 +1,117 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <string.h>
+#include <stdint.h>
+#include <thread>
+
+#if defined(_WIN32)
+    #include <windows.h>
+#else
+    #include <pthread.h>
+    #include <sched.h>
+    #include <sys/mman.h>
+#endif
+
+// Scheduling and memory settings for the threads and buffers of the bridge
+struct ThreadConfig
+{
+    ThreadConfig()
+    : workerPriority(-1)
+    , workerCpus(0)
+    , unityPriority(0)
+    , unityCpus(0)
+    , lockMemory(false)
+    {}
+
+    int workerPriority;     // -1 follows the JACK thread, 0 leaves the workers unprivileged, > 0 is a SCHED_FIFO priority
+    uint64_t workerCpus;    // CPUs the workers are pinned to, one CPU each in turn; 0 lets them float
+    int unityPriority;      // Applied to the Unity audio thread the first time it hands data to the plugin; 0 leaves it alone
+    uint64_t unityCpus;     // CPUs for the Unity audio thread; 0 leaves it alone
+    bool lockMemory;        // mlockall() the process and lock the client's buffer arena into RAM (Windows: the arena only)
+};
+
+namespace ThreadUtil
+{
+
+#if defined(_WIN32)
+    typedef HANDLE thread_t;
+    inline thread_t CurrentThread() { return GetCurrentThread(); }
+#else
+    typedef pthread_t thread_t;
+    inline thread_t CurrentThread() { return pthread_self(); }
+#endif
+
+    inline thread_t NativeHandle(std::thread& thread) { return (thread_t)thread.native_handle(); }
+
+    // SCHED_FIFO at the given priority (time critical on Windows)
+    inline bool SetRealtime(thread_t thread, int priority)
+    {
+        if (priority <= 0) return false;
+#if defined(_WIN32)
+        return SetThreadPriority(thread, THREAD_PRIORITY_TIME_CRITICAL) != 0;
+#else
+        sched_param param;
+        param.sched_priority = priority;
+        return pthread_setschedparam(thread, SCHED_FIFO, &param) == 0;
+#endif
+    }
+
+    // Restricts a thread to the CPUs in the mask. There is no hard affinity on macOS, so this is a no-op there.
+    inline bool SetAffinity(thread_t thread, uint64_t cpus)
+    {
+        if (cpus == 0) return false;
+#if defined(_WIN32)
+        return SetThreadAffinityMask(thread, (DWORD_PTR)cpus) != 0;
+#elif defined(__linux__)
+        cpu_set_t set;
+        CPU_ZERO(&set);
+        for (int cpu = 0; cpu < 64; cpu++)
+            if (cpus & ((uint64_t)1 << cpu)) CPU_SET(cpu, &set);
+        return pthread_setaffinity_np(thread, sizeof(set), &set) == 0;
+#else
+        (void)thread;
+        return false;
+#endif
+    }
+
+    // The n-th set bit of the mask, wrapping around, as a single-CPU mask. Used to give every worker its own core.
+    inline uint64_t NthCpu(uint64_t cpus, int n)
+    {
+        int count = 0;
+        for (int cpu = 0; cpu < 64; cpu++)
+            if (cpus & ((uint64_t)1 << cpu)) count++;
+        if (count == 0) return 0;
+        n %= count;
+        for (int cpu = 0; cpu < 64; cpu++)
+            if ((cpus & ((uint64_t)1 << cpu)) && n-- == 0) return (uint64_t)1 << cpu;
+        return 0;
+    }
+
+    inline bool LockProcessMemory()
+    {
+#if defined(_WIN32)
+        return false;
+#else
+        return mlockall(MCL_CURRENT | MCL_FUTURE) == 0;
+#endif
+    }
+
+} // !namespace ThreadUtil
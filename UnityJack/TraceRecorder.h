@@ -0,0 +1,275 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdio>
+#include <memory>
+#include <mutex>
+#include <stdint.h>
+#include <thread>
+
+// What the trace records. Spans have a begin and an end, counters a value, the others are instants.
+enum TraceEvent
+{
+    Trace_JackProcess = 0,      // span: the JACK process callback
+    Trace_OutputStage,          // span: EQ, delays and protection on the outputs
+    Trace_OutputRing,           // counter: bytes waiting in the output ringbuffer at the start of a cycle
+    Trace_InputRing,            // counter: bytes waiting in the input ringbuffer after a cycle was written
+    Trace_OutputUnderrun,       // Unity had not delivered the cycle JACK is playing
+    Trace_InputOverflow,        // Unity had not read the inputs in time, a cycle was dropped
+    Trace_OutputRingFull,       // a cycle from Unity was dropped for lack of room
+    Trace_InputUnderrun,        // Unity asked for inputs before JACK delivered them
+    Trace_Xrun,                 // reported by the JACK server
+    Trace_ProcessCallback,      // span: a Unity effect's ProcessCallback
+    Trace_SetAllData,           // span: SetAllData from C#
+    Trace_PublishOutputs,       // span: the output bus handed to the transport
+    Trace_Count
+};
+
+// Always-on tracing of the audio path into a fixed ring of events: recording is one compare-and-swap, a clock read
+// and a few stores, with no locks or allocation, from any thread. A background thread drains the ring into a
+// Chrome trace (JSON array format) that chrome://tracing or ui.perfetto.dev open. When the writer falls behind,
+// events are dropped and counted rather than waited for.
+class TraceRecorder
+{
+public:
+    enum { kCapacity = 1 << 16, kFlushMs = 100 };
+
+    static TraceRecorder& getInstance()
+    {
+        static TraceRecorder instance;
+        return instance;
+    }
+
+    // Starts writing a new trace file, replacing the one being written
+    bool Start(const char* path)
+    {
+        std::lock_guard<std::mutex> control(mControlMutex);
+        stopWriter();
+
+        FILE* file = fopen(path, "w");
+        if (file == nullptr) return false;
+        fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n", file);
+        mFile = file;
+        mFirst = true;
+
+        if (!mSlots) mSlots.reset(new Slot[kCapacity]);
+        uint64_t start = mWrite.load(std::memory_order_relaxed);
+        mRead.store(start, std::memory_order_relaxed);
+        mDropped.store(0, std::memory_order_relaxed);
+        mRunning = true;
+        mWriter = std::thread(&TraceRecorder::WriterThread, this);
+        mEnabled.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // Stops recording and finishes the file
+    void Stop()
+    {
+        std::lock_guard<std::mutex> control(mControlMutex);
+        stopWriter();
+    }
+
+    bool IsEnabled() const { return mEnabled.load(std::memory_order_relaxed); }
+
+    // Any thread
+    void Begin(TraceEvent event) { record(event, 'B', 0); }
+    void End(TraceEvent event) { record(event, 'E', 0); }
+    void Instant(TraceEvent event, int64_t value = 0) { record(event, 'i', value); }
+    void Counter(TraceEvent event, int64_t value) { record(event, 'C', value); }
+
+    uint64_t GetDropped() const { return mDropped.load(std::memory_order_relaxed); }
+
+private:
+    struct Event
+    {
+        int64_t time;   // ns since the recorder was created
+        int64_t value;
+        int thread;
+        char event;
+        char phase;
+    };
+
+    struct Slot
+    {
+        Slot() : sequence(0) {}
+        std::atomic<uint64_t> sequence;     // index + 1 once the event is complete
+        Event data;
+    };
+
+    TraceRecorder()
+    : mEpoch(std::chrono::steady_clock::now())
+    , mEnabled(false)
+    , mWrite(0)
+    , mRead(0)
+    , mDropped(0)
+    , mThreads(0)
+    , mFile(nullptr)
+    , mFirst(true)
+    , mRunning(false)
+    {}
+
+    ~TraceRecorder()
+    {
+        Stop();
+    }
+
+    // Small numbers for the threads, in the order they first record
+    int threadId()
+    {
+        static thread_local int id = -1;
+        if (id < 0) id = mThreads.fetch_add(1, std::memory_order_relaxed) + 1;
+        return id;
+    }
+
+    void record(TraceEvent event, char phase, int64_t value)
+    {
+        // acquire: pairs with Start's release, so the slots and mRead it set up are visible here
+        if (!mEnabled.load(std::memory_order_acquire)) return;
+
+        uint64_t index = mWrite.load(std::memory_order_relaxed);
+        do
+        {
+            if (index - mRead.load(std::memory_order_acquire) >= kCapacity)
+            {
+                mDropped.fetch_add(1, std::memory_order_relaxed);
+                return;
+            }
+        } while (!mWrite.compare_exchange_weak(index, index + 1, std::memory_order_relaxed));
+
+        Slot& slot = mSlots[index % kCapacity];
+        slot.data.time = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - mEpoch).count();
+        slot.data.value = value;
+        slot.data.thread = threadId();
+        slot.data.event = (char)event;
+        slot.data.phase = phase;
+        slot.sequence.store(index + 1, std::memory_order_release);
+    }
+
+    static const char* Name(int event)
+    {
+        static const char* names[Trace_Count] = {
+            "jack process", "output stage", "output ring bytes", "input ring bytes", "output underrun", "input overflow",
+            "output ring full", "input underrun", "xrun", "ProcessCallback", "SetAllData", "publish outputs"
+        };
+        return (event >= 0 && event < Trace_Count) ? names[event] : "?";
+    }
+
+    // Writes out the completed events at the head of the ring, true when there were any
+    bool drain()
+    {
+        bool any = false;
+        uint64_t read = mRead.load(std::memory_order_relaxed);
+        while (true)
+        {
+            Slot& slot = mSlots[read % kCapacity];
+            if (slot.sequence.load(std::memory_order_acquire) != read + 1) break;
+            Event e = slot.data;
+            mRead.store(++read, std::memory_order_release);
+            any = true;
+
+            double ts = (double)e.time * 0.001;
+            fputs(mFirst ? "" : ",\n", mFile);
+            mFirst = false;
+            if (e.phase == 'C')
+                fprintf(mFile, "{\"name\":\"%s\",\"ph\":\"C\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"value\":%lld}}",
+                    Name(e.event), ts, e.thread, (long long)e.value);
+            else if (e.phase == 'i')
+                fprintf(mFile, "{\"name\":\"%s\",\"ph\":\"i\",\"s\":\"p\",\"ts\":%.3f,\"pid\":1,\"tid\":%d,\"args\":{\"value\":%lld}}",
+                    Name(e.event), ts, e.thread, (long long)e.value);
+            else
+                fprintf(mFile, "{\"name\":\"%s\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":1,\"tid\":%d}", Name(e.event), e.phase, ts, e.thread);
+        }
+        return any;
+    }
+
+    void WriterThread()
+    {
+        std::unique_lock<std::mutex> lock(mWakeMutex);
+        while (mRunning)
+        {
+            mWake.wait_for(lock, std::chrono::milliseconds(kFlushMs));
+            if (drain()) fflush(mFile);
+        }
+    }
+
+    // Under mControlMutex
+    void stopWriter()
+    {
+        if (mFile == nullptr) return;
+        mEnabled.store(false, std::memory_order_release);
+        {
+            std::lock_guard<std::mutex> lock(mWakeMutex);
+            mRunning = false;
+        }
+        mWake.notify_one();
+        mWriter.join();
+
+        // events claimed before recording stopped are finished within a few instructions, unless their thread was
+        // preempted in between; write out every one of them. Later claims saw recording off and were never made,
+        // or are past this index, where the next Start begins.
+        const uint64_t claimed = mWrite.load(std::memory_order_acquire);
+        while (drain(), mRead.load(std::memory_order_relaxed) < claimed)
+            std::this_thread::yield();
+        uint64_t dropped = mDropped.load(std::memory_order_relaxed);
+        if (dropped > 0)
+            fprintf(mFile, "%s{\"name\":\"dropped events\",\"ph\":\"i\",\"s\":\"g\",\"ts\":0,\"pid\":1,\"tid\":0,\"args\":{\"value\":%llu}}",
+                mFirst ? "" : ",\n", (unsigned long long)dropped);
+        fputs("\n]}\n", mFile);
+        fclose(mFile);
+        mFile = nullptr;
+    }
+
+    const std::chrono::steady_clock::time_point mEpoch;
+    std::atomic<bool> mEnabled;
+    std::unique_ptr<Slot[]> mSlots;
+    alignas(64) std::atomic<uint64_t> mWrite;   // events claimed
+    alignas(64) std::atomic<uint64_t> mRead;    // events written out
+    std::atomic<uint64_t> mDropped;
+    std::atomic<int> mThreads;
+
+    std::mutex mControlMutex;   // Start and Stop
+    FILE* mFile;
+    bool mFirst;                // nothing written after the opening bracket yet
+    bool mRunning;
+    std::mutex mWakeMutex;
+    std::condition_variable mWake;
+    std::thread mWriter;
+};
+
+// Records a span over a scope
+class TraceScope
+{
+public:
+    explicit TraceScope(TraceEvent event) : mEvent(event), mOn(TraceRecorder::getInstance().IsEnabled())
+    {
+        if (mOn) TraceRecorder::getInstance().Begin(mEvent);
+    }
+    ~TraceScope()
+    {
+        if (mOn) TraceRecorder::getInstance().End(mEvent);
+    }
+
+private:
+    TraceEvent mEvent;
+    bool mOn;
+};
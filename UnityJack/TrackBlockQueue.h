@@ -0,0 +1,108 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "BufferArena.h"
+
+#include <atomic>
+#include <stdint.h>
+
+// Blocks of every output track in native memory, which the game fills from wherever it likes (C# jobs, Burst)
+// and the audio thread sends as they are. A single producer acquires a block, fills any of its tracks, possibly
+// from many threads at once, and submits it with the mask of tracks written; the audio thread takes submitted
+// blocks in order. Up to kBlocks can be queued, which absorbs the difference between frame and audio rates.
+class TrackBlockQueue
+{
+public:
+    enum { kBlocks = 4 };
+
+    TrackBlockQueue() : mTracks(0), mFrames(0), mWritten(0), mRead(0) {}
+
+    static int MaskWords(int tracks) { return (tracks + 63) / 64; }
+
+    static size_t GetArenaBytes(int tracks, int frames)
+    {
+        return (BufferArena::Align(sizeof(float) * tracks * frames) + BufferArena::Align(sizeof(uint64_t) * MaskWords(tracks))) * kBlocks;
+    }
+
+    bool Init(BufferArena& arena, int tracks, int frames)
+    {
+        mTracks = tracks;
+        mFrames = frames;
+        bool ok = true;
+        for (int i = 0; i < kBlocks; i++)
+        {
+            mData[i] = arena.Allocate<float>(tracks * frames);
+            mMasks[i] = arena.Allocate<uint64_t>(MaskWords(tracks));
+            ok = ok && mData[i] != nullptr && mMasks[i] != nullptr;
+        }
+        mWritten.store(0, std::memory_order_relaxed);
+        mRead.store(0, std::memory_order_relaxed);
+        return ok;
+    }
+
+    int GetTracks() const { return mTracks; }
+
+    // Samples between the starts of two tracks in a block
+    int GetStride() const { return mFrames; }
+
+    // Producer: the block to fill, track t at GetStride() * t; the same one until it is submitted. nullptr while
+    // kBlocks are waiting to be sent.
+    float* Acquire()
+    {
+        uint64_t written = mWritten.load(std::memory_order_relaxed);
+        if (mData[0] == nullptr || written - mRead.load(std::memory_order_acquire) >= kBlocks) return nullptr;
+        return mData[written % kBlocks];
+    }
+
+    // Producer: queues the acquired block with the tracks written to it, all of them when mask is null
+    bool Submit(const uint64_t* mask)
+    {
+        if (Acquire() == nullptr) return false;
+        uint64_t written = mWritten.load(std::memory_order_relaxed);
+        uint64_t* blockMask = mMasks[written % kBlocks];
+        for (int w = 0; w < MaskWords(mTracks); w++)
+            blockMask[w] = (mask != nullptr) ? mask[w] : ~(uint64_t)0;
+        mWritten.store(written + 1, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer: the oldest submitted block and its mask, or nullptr when there is none
+    const float* Front(const uint64_t** mask) const
+    {
+        uint64_t read = mRead.load(std::memory_order_relaxed);
+        if (mWritten.load(std::memory_order_acquire) == read) return nullptr;
+        *mask = mMasks[read % kBlocks];
+        return mData[read % kBlocks];
+    }
+
+    // Consumer: hands the front block back to the producer
+    void Pop()
+    {
+        mRead.store(mRead.load(std::memory_order_relaxed) + 1, std::memory_order_release);
+    }
+
+private:
+    int mTracks;
+    int mFrames;
+    float* mData[kBlocks];
+    uint64_t* mMasks[kBlocks];
+    alignas(64) std::atomic<uint64_t> mWritten;    // blocks submitted
+    alignas(64) std::atomic<uint64_t> mRead;       // blocks sent
+};
@@ -0,0 +1,64 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include <atomic>
+
+// Hands whole tables of settings from a writer to the audio thread without locks or allocation. The writer fills
+// Back() and publishes it; the reader calls Update() once per cycle and reads Front(), which stays the same until
+// its next Update(). Three copies let either side go ahead without waiting for the other: the third sits in the
+// shared slot, flagged when it is newer than the front. Only one writer at a time, so concurrent writers need
+// their own lock.
+template<typename T>
+class TripleBuffer
+{
+public:
+    TripleBuffer() : mBack(1), mShared(2), mFront(0) {}
+
+    // Writer: the copy to fill, which holds whatever was published two times ago
+    T& Back() { return mSlots[mBack]; }
+
+    // Writer: makes the back copy the newest
+    void Publish()
+    {
+        mBack = mShared.exchange(mBack | kDirty, std::memory_order_acq_rel) & kIndex;
+    }
+
+    // Reader: takes the newest published copy, true when there was one
+    bool Update()
+    {
+        if (!(mShared.load(std::memory_order_relaxed) & kDirty)) return false;
+        mFront = mShared.exchange(mFront, std::memory_order_acq_rel) & kIndex;
+        return true;
+    }
+
+    // Reader
+    const T& Front() const { return mSlots[mFront]; }
+
+    // Before any reader or writer runs, e.g. to size all three copies
+    T& Slot(int i) { return mSlots[i]; }
+
+private:
+    enum { kIndex = 3, kDirty = 4 };
+
+    T mSlots[3];
+    int mBack;
+    std::atomic<int> mShared;
+    int mFront;
+};
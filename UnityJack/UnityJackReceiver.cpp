@@ -0,0 +1,124 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// JACK client that plays the stream the plugin sends in network mode, on the machine the speakers hang off.
+//
+//     UnityJackReceiver [-p port] [-c channels] [-l latency blocks] [-n client name] [-b bind address]
+//
+// Run it next to Unity with the plugin sending to 127.0.0.1 to try the whole path on one machine.
+
+#include "NetworkBridge.h"
+
+#include <jack/jack.h>
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+struct Receiver
+{
+    NetworkBridge::NetworkReceiver* stream;
+    std::vector<jack_port_t*> ports;
+    std::vector<float*> buffers;
+};
+
+static int Process(jack_nframes_t nframes, void* arg)
+{
+    Receiver* receiver = (Receiver*)arg;
+    for (size_t ch = 0; ch < receiver->ports.size(); ch++)
+        receiver->buffers[ch] = (float*)jack_port_get_buffer(receiver->ports[ch], nframes);
+    receiver->stream->Pull(receiver->buffers.data(), (int)nframes);
+    return 0;
+}
+
+int main(int argc, char** argv)
+{
+    int port = NetworkBridge::kDefaultPort, channels = 2, latency = 3;
+    std::string name = "UnityJackReceiver", bind;
+    for (int i = 1; i + 1 < argc; i += 2)
+    {
+        if (strcmp(argv[i], "-p") == 0) port = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-c") == 0) channels = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-l") == 0) latency = atoi(argv[i + 1]);
+        else if (strcmp(argv[i], "-n") == 0) name = argv[i + 1];
+        else if (strcmp(argv[i], "-b") == 0) bind = argv[i + 1];
+        else
+        {
+            fprintf(stderr, "usage: %s [-p port] [-c channels] [-l latency blocks] [-n client name] [-b bind address]\n", argv[0]);
+            return 1;
+        }
+    }
+    if (channels <= 0 || channels > NetworkBridge::kMaxChannels)
+    {
+        fprintf(stderr, "channels must be between 1 and %d\n", (int)NetworkBridge::kMaxChannels);
+        return 1;
+    }
+
+    NetworkBridge::NetworkReceiver stream(channels, latency);
+    if (!stream.Start(bind.c_str(), port))
+    {
+        fprintf(stderr, "Cannot listen on port %d\n", port);
+        return 1;
+    }
+
+    jack_status_t status;
+    jack_client_t* client = jack_client_open(name.c_str(), JackNullOption, &status);
+    if (client == nullptr)
+    {
+        fprintf(stderr, "Cannot connect to the JACK server\n");
+        return 1;
+    }
+
+    Receiver receiver;
+    receiver.stream = &stream;
+    for (int ch = 0; ch < channels; ch++)
+    {
+        std::string portname = "out" + std::to_string(ch);
+        receiver.ports.push_back(jack_port_register(client, portname.c_str(), JACK_DEFAULT_AUDIO_TYPE, JackPortIsOutput, 0));
+    }
+    receiver.buffers.resize(channels);
+    jack_set_process_callback(client, Process, &receiver);
+    if (jack_activate(client) != 0)
+    {
+        fprintf(stderr, "Cannot activate the client\n");
+        jack_client_close(client);
+        return 1;
+    }
+
+    printf("Listening on port %d for %d channels, %d blocks of latency; press enter to quit\n", stream.GetPort(), channels, latency);
+    std::atomic<bool> quit(false);
+    std::thread input([&quit]() { std::cin.get(); quit = true; });
+    while (!quit)
+    {
+        std::this_thread::sleep_for(std::chrono::seconds(1));
+        NetworkBridge::NetworkReceiver::Stats stats = stream.GetStats();
+        printf("\r%d frames/block  packets %llu  late %llu  early %llu  lost blocks %llu  resyncs %llu   ",
+            stream.GetFrames(), (unsigned long long)stats.packets, (unsigned long long)stats.late,
+            (unsigned long long)stats.early, (unsigned long long)stats.lost,
+            (unsigned long long)stats.resyncs);
+        fflush(stdout);
+    }
+    input.join();
+    printf("\n");
+
+    jack_deactivate(client);
+    jack_client_close(client);
+    stream.Stop();
+    return 0;
+}
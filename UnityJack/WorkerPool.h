@@ -0,0 +1,267 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+#pragma once
+
+#include "ThreadConfig.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <stdint.h>
+
+#if defined(__linux__)
+    #include <linux/futex.h>
+    #include <sys/syscall.h>
+    #include <unistd.h>
+    #include <climits>
+#endif
+#if defined(__SSE2__) || defined(_M_X64) || defined(_M_IX86)
+    #include <emmintrin.h>
+    #define WORKERPOOL_PAUSE() _mm_pause()
+#else
+    #define WORKERPOOL_PAUSE() std::atomic_signal_fence(std::memory_order_seq_cst)
+#endif
+
+// Chase-Lev work-stealing deque of fixed capacity. Only the owning thread calls Push and Pop, any thread may Steal.
+// Items are index ranges packed into 64 bits so the slots can be plain atomics.
+class WorkStealingDeque
+{
+public:
+    enum { kCapacity = 256 };
+
+    WorkStealingDeque() : mTop(0), mBottom(0) {}
+
+    static uint64_t Pack(int begin, int end) { return ((uint64_t)(uint32_t)begin << 32) | (uint32_t)end; }
+    static void Unpack(uint64_t item, int& begin, int& end) { begin = (int)(item >> 32); end = (int)(uint32_t)item; }
+
+    bool Push(uint64_t item)
+    {
+        int64_t b = mBottom.load(std::memory_order_relaxed);
+        int64_t t = mTop.load(std::memory_order_acquire);
+        if (b - t >= kCapacity) return false;
+        mItems[b & (kCapacity - 1)].store(item, std::memory_order_relaxed);
+        mBottom.store(b + 1, std::memory_order_release);
+        return true;
+    }
+
+    bool Pop(uint64_t& item)
+    {
+        // seq_cst store/load pair instead of relaxed accesses around a fence, which ThreadSanitizer can't model
+        int64_t b = mBottom.load(std::memory_order_relaxed) - 1;
+        mBottom.store(b, std::memory_order_seq_cst);
+        int64_t t = mTop.load(std::memory_order_seq_cst);
+        if (t > b)
+        {
+            mBottom.store(b + 1, std::memory_order_relaxed);
+            return false;
+        }
+        item = mItems[b & (kCapacity - 1)].load(std::memory_order_relaxed);
+        if (t == b)
+        {
+            // Last item, race against thieves for it
+            bool won = mTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+            mBottom.store(b + 1, std::memory_order_relaxed);
+            return won;
+        }
+        return true;
+    }
+
+    bool Steal(uint64_t& item)
+    {
+        int64_t t = mTop.load(std::memory_order_seq_cst);
+        int64_t b = mBottom.load(std::memory_order_seq_cst);
+        if (t >= b) return false;
+        item = mItems[t & (kCapacity - 1)].load(std::memory_order_relaxed);
+        return mTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+    }
+
+private:
+    alignas(64) std::atomic<int64_t> mTop;
+    alignas(64) std::atomic<int64_t> mBottom;
+    alignas(64) std::atomic<uint64_t> mItems[kCapacity];
+};
+
+// Pre-spawned helper threads the JACK process callback can fan per-port work out to. Run() splits [0, count)
+// into ranges that are halved on demand and stolen by idle workers; the calling thread works too and returns
+// once every index has been processed. Idle workers spin briefly and then sleep on a futex (a condition
+// variable where futexes aren't available), so waking them costs no syscall while they are still spinning.
+class WorkerPool
+{
+public:
+    typedef void (*Task)(void *context, int index);
+
+    enum { kSpinIterations = 20000, kYieldInterval = 64 };
+
+    // priority > 0 requests SCHED_FIFO at that priority for the workers, failure leaves them at normal priority.
+    // With a cpu mask every worker is pinned to one CPU of it in turn.
+    WorkerPool(int workers, int priority = 0, uint64_t cpus = 0)
+    : mEpoch(0)
+    , mSleepers(0)
+    , mRunning(true)
+    , mTask(nullptr)
+    , mContext(nullptr)
+    , mGrain(1)
+    , mRemaining(0)
+    , mDeques(workers + 1)
+    {
+        for (int i = 0; i < workers; i++)
+        {
+            mThreads.push_back(std::thread(&WorkerPool::WorkerThread, this, i + 1));
+            ThreadUtil::SetRealtime(ThreadUtil::NativeHandle(mThreads.back()), priority);
+            ThreadUtil::SetAffinity(ThreadUtil::NativeHandle(mThreads.back()), ThreadUtil::NthCpu(cpus, i));
+        }
+    }
+
+    ~WorkerPool()
+    {
+        mRunning.store(false, std::memory_order_release);
+        Wake();
+        for (size_t i = 0; i < mThreads.size(); i++)
+            mThreads[i].join();
+    }
+
+    int GetNumWorkers() const { return (int)mThreads.size(); }
+
+    // Must only be called from one thread at a time (the JACK process thread)
+    void Run(int count, Task task, void *context, int grain = 1)
+    {
+        if (count <= 0) return;
+        if (mThreads.empty() || count <= grain)
+        {
+            for (int i = 0; i < count; i++)
+                task(context, i);
+            return;
+        }
+
+        mTask = task;
+        mContext = context;
+        mGrain = grain;
+        mRemaining.store(count, std::memory_order_relaxed);
+        mDeques[0].Push(WorkStealingDeque::Pack(0, count));
+        Wake();
+
+        Join(0);
+    }
+
+private:
+    void Wake()
+    {
+        mEpoch.fetch_add(1, std::memory_order_seq_cst);
+        if (mSleepers.load(std::memory_order_seq_cst) == 0) return;
+#if defined(__linux__)
+        syscall(SYS_futex, (uint32_t *)&mEpoch, FUTEX_WAKE_PRIVATE, INT_MAX, nullptr, nullptr, 0);
+#else
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+        mSleepCondition.notify_all();
+#endif
+    }
+
+    void Sleep(uint32_t seen)
+    {
+        mSleepers.fetch_add(1, std::memory_order_seq_cst);
+#if defined(__linux__)
+        // Returns immediately if the epoch moved on after we last looked
+        syscall(SYS_futex, (uint32_t *)&mEpoch, FUTEX_WAIT_PRIVATE, seen, nullptr, nullptr, 0);
+#else
+        std::unique_lock<std::mutex> lock(mSleepMutex);
+        while (mEpoch.load(std::memory_order_acquire) == seen)
+            mSleepCondition.wait(lock);
+#endif
+        mSleepers.fetch_sub(1, std::memory_order_relaxed);
+    }
+
+    // Takes a range from our own deque or steals one, splits off halves for others and runs the rest
+    bool ExecuteOne(int self)
+    {
+        uint64_t item;
+        if (!mDeques[self].Pop(item))
+        {
+            bool stolen = false;
+            for (size_t i = 1; i <= mDeques.size() && !stolen; i++)
+                stolen = mDeques[(self + i) % mDeques.size()].Steal(item);
+            if (!stolen) return false;
+        }
+
+        int begin, end;
+        WorkStealingDeque::Unpack(item, begin, end);
+        while (end - begin > mGrain)
+        {
+            int mid = begin + (end - begin) / 2;
+            if (!mDeques[self].Push(WorkStealingDeque::Pack(mid, end))) break;
+            end = mid;
+        }
+        for (int i = begin; i < end; i++)
+            mTask(mContext, i);
+        mRemaining.fetch_sub(end - begin, std::memory_order_acq_rel);
+        return true;
+    }
+
+    // Helps until every index of the current Run is done. Yields now and then, in case the thread holding the
+    // last range shares our core.
+    void Join(int self)
+    {
+        int idle = 0;
+        while (mRemaining.load(std::memory_order_acquire) > 0)
+        {
+            if (ExecuteOne(self))
+                idle = 0;
+            else if (++idle % kYieldInterval == 0)
+                std::this_thread::yield();
+            else
+                WORKERPOOL_PAUSE();
+        }
+    }
+
+    void WorkerThread(int self)
+    {
+        uint32_t seen = mEpoch.load(std::memory_order_acquire);
+        while (mRunning.load(std::memory_order_acquire))
+        {
+            int spins = 0;
+            while (mEpoch.load(std::memory_order_acquire) == seen)
+            {
+                if (++spins < kSpinIterations)
+                    WORKERPOOL_PAUSE();
+                else
+                    Sleep(seen);
+            }
+            seen = mEpoch.load(std::memory_order_acquire);
+
+            Join(self);
+        }
+    }
+
+    alignas(64) std::atomic<uint32_t> mEpoch;
+    alignas(64) std::atomic<int> mSleepers;
+    std::atomic<bool> mRunning;
+
+    Task mTask;
+    void *mContext;
+    int mGrain;
+    alignas(64) std::atomic<int> mRemaining;
+
+    std::vector<WorkStealingDeque> mDeques; // [0] belongs to the thread calling Run
+    std::vector<std::thread> mThreads;
+#if !defined(__linux__)
+    std::mutex mSleepMutex;
+    std::condition_variable mSleepCondition;
+#endif
+};
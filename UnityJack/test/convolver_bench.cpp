@@ -0,0 +1,76 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Cost of a 4 s impulse response at 48 kHz on one core, per JACK block size: the mean block, the heaviest cycle of
+// the tail period on average, the worst block, and how many such inserts one core keeps up with by the mean and by the
+// worst. The tail stage is spread over its period, so the heaviest cycle should be close to the mean; the worst block
+// also carries whatever the scheduler did to the run.
+// Usage: convolver_bench [seconds of impulse response]
+
+#include "../Convolver.h"
+
+#include <chrono>
+#include <vector>
+
+int main(int argc, char** argv)
+{
+    const float samplerate = 48000.0f;
+    const float seconds = (argc > 1) ? (float)atof(argv[1]) : 4.0f;
+    const int irlength = (int)(seconds * samplerate);
+
+    Random random;
+    random.Seed(99);
+    std::vector<float> ir(irlength);
+    for (int i = 0; i < irlength; i++)
+        ir[i] = random.GetFloat(-1.0f, 1.0f) * expf(-6.0f * (float)i / (float)irlength);
+
+    printf("%.1f s impulse response at %.0f Hz, one core\n", seconds, samplerate);
+    printf("block  budget(us)  mean(us)  heaviest cycle(us)  worst(us)  inserts by mean  inserts by worst\n");
+    const int blocksizes[] = { 64, 128, 256, 512, 1024 };
+    for (int b = 0; b < 5; b++)
+    {
+        const int blocksize = blocksizes[b];
+        PartitionedConvolver convolver;
+        convolver.Init(ir.data(), irlength, blocksize);
+
+        std::vector<float> input(blocksize), output(blocksize);
+        for (int n = 0; n < blocksize; n++)
+            input[n] = random.GetFloat(-1.0f, 1.0f);
+
+        // whole tail periods, so the mean includes its share of tail blocks
+        const int numblocks = PartitionedConvolver::kTailFactor * (int)(2.0f * samplerate / (blocksize * PartitionedConvolver::kTailFactor) + 1);
+        for (int i = 0; i < PartitionedConvolver::kTailFactor; i++)
+            convolver.Process(input.data(), output.data());
+        double total = 0.0, worst = 0.0, cycles[PartitionedConvolver::kTailFactor] = { 0.0 };
+        for (int i = 0; i < numblocks; i++)
+        {
+            auto start = std::chrono::steady_clock::now();
+            convolver.Process(input.data(), output.data());
+            double us = std::chrono::duration<double, std::micro>(std::chrono::steady_clock::now() - start).count();
+            total += us;
+            worst = std::max(worst, us);
+            cycles[i % PartitionedConvolver::kTailFactor] += us;
+        }
+        double heaviest = 0.0;
+        for (int i = 0; i < PartitionedConvolver::kTailFactor; i++)
+            heaviest = std::max(heaviest, cycles[i] * PartitionedConvolver::kTailFactor / numblocks);
+        double budget = 1e6 * blocksize / samplerate, mean = total / numblocks;
+        printf("%5d  %10.0f  %8.1f  %18.1f  %9.1f  %15.1f  %16.1f\n", blocksize, budget, mean, heaviest, worst, budget / mean, budget / worst);
+    }
+    return 0;
+}
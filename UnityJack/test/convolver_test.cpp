@@ -0,0 +1,129 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Checks PartitionedConvolver and ConvolutionEngine against direct convolution, with impulse responses around the
+// head/tail boundary at 2 * kTailFactor blocks, where the tail stage takes over.
+
+#include "../Convolver.h"
+
+#include <vector>
+
+static int failures = 0;
+
+// Runs numblocks blocks of random input through the convolver and compares with the direct sum in double precision.
+// Returns the largest error relative to the largest output sample.
+static double Compare(PartitionedConvolver& convolver, const std::vector<float>& ir, int blocksize, int numblocks, Random& random)
+{
+    std::vector<float> input(blocksize * numblocks), output(blocksize * numblocks);
+    for (size_t i = 0; i < input.size(); i++)
+        input[i] = random.GetFloat(-1.0f, 1.0f);
+    for (int b = 0; b < numblocks; b++)
+        convolver.Process(&input[b * blocksize], &output[b * blocksize]);
+
+    double error = 0.0, peak = 1e-9;
+    for (size_t n = 0; n < output.size(); n++)
+    {
+        double sum = 0.0;
+        for (size_t k = 0; k < ir.size() && k <= n; k++)
+            sum += (double)ir[k] * input[n - k];
+        error = std::max(error, fabs(sum - output[n]));
+        peak = std::max(peak, fabs(sum));
+    }
+    return error / peak;
+}
+
+int main()
+{
+    Random random;
+    random.Seed(777);
+
+    const int blocksizes[] = { 32, 64, 256 };
+    for (int b = 0; b < 3; b++)
+    {
+        const int blocksize = blocksizes[b];
+        const int tail = blocksize * PartitionedConvolver::kTailFactor, head = 2 * tail;
+
+        // head only, a partial last head partition, exactly the head, one sample into the tail, and several tail partitions
+        const int lengths[] = { 1, blocksize / 2 + 3, blocksize * 3, head - 1, head, head + 1, head + blocksize, head + 9 * tail + 17 };
+        for (int l = 0; l < 8; l++)
+        {
+            std::vector<float> ir(lengths[l]);
+            for (size_t i = 0; i < ir.size(); i++)
+                ir[i] = random.GetFloat(-1.0f, 1.0f) * expf(-3.0f * (float)i / (float)ir.size());
+
+            PartitionedConvolver convolver;
+            convolver.Init(ir.data(), (int)ir.size(), blocksize);
+            // long enough for the tail to be played several times over
+            int numblocks = (lengths[l] + 4 * tail) / blocksize;
+            double error = Compare(convolver, ir, blocksize, numblocks, random);
+            if (error > 1e-5)
+            {
+                printf("FAIL block %d, ir length %d: relative error %g\n", blocksize, lengths[l], error);
+                failures++;
+            }
+        }
+    }
+
+    // The engine hands the convolver over from its loader thread; until then the channel passes nothing
+    {
+        const int blocksize = 64;
+        std::vector<float> ir(blocksize * PartitionedConvolver::kTailFactor * 3 + 5);
+        for (size_t i = 0; i < ir.size(); i++)
+            ir[i] = random.GetFloat(-1.0f, 1.0f);
+        PartitionedConvolver reference;
+        reference.Init(ir.data(), (int)ir.size(), blocksize);
+
+        ConvolutionEngine engine(2, blocksize);
+        engine.Load(1, ir.data(), (int)ir.size());
+        std::vector<float> input(blocksize), expected(blocksize), output(blocksize);
+        bool loaded = false;
+        for (int wait = 0; wait < 5000 && !loaded; wait++)
+        {
+            loaded = engine.Process(1, input.data(), output.data(), blocksize);
+            if (!loaded) std::this_thread::sleep_for(std::chrono::milliseconds(1));
+        }
+        if (!loaded || engine.Process(0, input.data(), output.data(), blocksize))
+        {
+            printf("FAIL engine: the impulse response %s\n", loaded ? "reached the wrong channel" : "was never loaded");
+            failures++;
+        }
+        else
+        {
+            // the block that loaded it was silence, so the reference starts from the same state after one block of silence
+            reference.Process(input.data(), expected.data());
+            float error = 0.0f;
+            for (int b = 0; b < 40; b++)
+            {
+                for (int n = 0; n < blocksize; n++)
+                    input[n] = random.GetFloat(-1.0f, 1.0f);
+                engine.Process(1, input.data(), output.data(), blocksize);
+                reference.Process(input.data(), expected.data());
+                for (int n = 0; n < blocksize; n++)
+                    error = FastMax(error, fabsf(output[n] - expected[n]));
+            }
+            if (error > 1e-6f)
+            {
+                printf("FAIL engine: differs from the convolver it loaded by %g\n", error);
+                failures++;
+            }
+        }
+    }
+
+    printf("%s\n", failures == 0 ? "convolver OK" : "convolver FAILED");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,120 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Compares the planned FFT in AudioPluginUtil against the original per-call-twiddle implementation.
+
+#include "../AudioPluginUtil.h"
+
+#include <chrono>
+#include <iostream>
+#include <vector>
+
+// The FFT as it was before FFTPlan, kept here as the baseline
+static void ReferenceFFT(UnityComplexNumber* data, int numsamples, bool forward)
+{
+    int j = 0;
+    for (int i = 0; i < numsamples - 1; i++)
+    {
+        if (i < j)
+        {
+            float t = data[i].re; data[i].re = data[j].re; data[j].re = t;
+            t = data[i].im; data[i].im = data[j].im; data[j].im = t;
+        }
+        int m = numsamples >> 1;
+        j ^= m;
+        while ((j & m) == 0)
+        {
+            m >>= 1;
+            j ^= m;
+        }
+    }
+    const float k = (forward) ? -kPI : kPI;
+    for (int j = 1; j < numsamples; j <<= 1)
+    {
+        const float w0 = k / (float)j;
+        UnityComplexNumber wr; wr.Set(cosf(w0), sinf(w0));
+        UnityComplexNumber w; w.Set(1.0f, 0.0f);
+        for (int m = 0; m < j; m++)
+        {
+            for (int i = m; i < numsamples; i += j << 1)
+            {
+                UnityComplexNumber t; UnityComplexNumber::Mul(w, data[i + j], t);
+                UnityComplexNumber::Sub(data[i], t, data[i + j]);
+                UnityComplexNumber::Add(data[i], t, data[i]);
+            }
+            UnityComplexNumber::Mul(w, wr, w);
+        }
+    }
+}
+
+template<typename F> static double NanosecondsPerCall(F f, int iterations)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < iterations; i++)
+        f();
+    auto end = std::chrono::steady_clock::now();
+    return std::chrono::duration<double, std::nano>(end - start).count() / iterations;
+}
+
+int main()
+{
+    Random random;
+    random.Seed(12345);
+
+    // speedup compares the complex transforms at the same size; real gain is what a real input saves on top of that
+    std::cout << "size      reference(ns)  planned(ns)  speedup  real(ns)  real gain  max error" << std::endl;
+    for (int n = 64; n <= FFTPlan::kMaxSize; n <<= 1)
+    {
+        std::vector<float> signal(n);
+        for (int i = 0; i < n; i++)
+            signal[i] = random.GetFloat(-1.0f, 1.0f);
+
+        std::vector<UnityComplexNumber> a(n), b(n), c(n / 2 + 1);
+        for (int i = 0; i < n; i++)
+        {
+            a[i].Set(signal[i], 0.0f);
+            b[i].Set(signal[i], 0.0f);
+        }
+        std::vector<UnityComplexNumber> input(b);
+        ReferenceFFT(a.data(), n, true);
+        FFT::Forward(b.data(), n);
+        FFT::ForwardReal(signal.data(), c.data(), n);
+
+        float maxerror = 0.0f;
+        for (int i = 0; i <= n / 2; i++)
+        {
+            maxerror = FastMax(maxerror, (a[i] - b[i]).Magnitude());
+            maxerror = FastMax(maxerror, (a[i] - c[i]).Magnitude());
+        }
+
+        std::vector<float> roundtrip(n);
+        FFT::BackwardReal(c.data(), roundtrip.data(), n);
+        for (int i = 0; i < n; i++)
+            maxerror = FastMax(maxerror, fabsf(roundtrip[i] - signal[i]));
+
+        // Every complex variant starts from a fresh copy of the input so repeated transforms don't overflow
+        const int iterations = (1 << 22) / n;
+        double tref = NanosecondsPerCall([&] { a = input; ReferenceFFT(a.data(), n, true); }, iterations);
+        double tplan = NanosecondsPerCall([&] { b = input; FFT::Forward(b.data(), n); }, iterations);
+        double treal = NanosecondsPerCall([&] { FFT::ForwardReal(signal.data(), c.data(), n); }, iterations);
+
+        printf("%-8d  %13.0f  %11.0f  %6.1fx  %8.0f  %8.1fx  %g\n", n, tref, tplan, tref / tplan, treal, tplan / treal,
+            maxerror / sqrtf((float)n));
+    }
+    return 0;
+}
@@ -0,0 +1,98 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Checks the FFT against a direct DFT at small sizes, and that Backward and BackwardReal invert Forward and
+// ForwardReal at every planned size and past kMaxSize, where the unplanned transform takes over.
+
+#include "../AudioPluginUtil.h"
+
+#include <vector>
+
+static int failures = 0;
+
+static void Check(bool ok, const char* what, int n, double error)
+{
+    if (ok) return;
+    printf("FAIL %s, size %d: error %g\n", what, n, error);
+    failures++;
+}
+
+int main()
+{
+    Random random;
+    random.Seed(4321);
+
+    // Forward against the definition, X[k] = sum x[n] exp(-2 pi i k n / N), and Backward against its inverse
+    for (int n = 1; n <= 256; n <<= 1)
+    {
+        std::vector<UnityComplexNumber> x(n), y(n);
+        for (int i = 0; i < n; i++)
+            x[i].Set(random.GetFloat(-1.0f, 1.0f), random.GetFloat(-1.0f, 1.0f));
+        y = x;
+        FFT::Forward(y.data(), n);
+        double error = 0.0;
+        for (int k = 0; k < n; k++)
+        {
+            double re = 0.0, im = 0.0;
+            for (int i = 0; i < n; i++)
+            {
+                double w = -2.0 * 3.14159265358979323846 * (double)((k * i) % n) / (double)n;
+                re += x[i].re * cos(w) - x[i].im * sin(w);
+                im += x[i].re * sin(w) + x[i].im * cos(w);
+            }
+            error = std::max(error, (double)hypot(re - y[k].re, im - y[k].im));
+        }
+        Check(error < 1e-5 * n, "Forward vs DFT", n, error);
+
+        FFT::Backward(y.data(), n);
+        error = 0.0;
+        for (int i = 0; i < n; i++)
+            error = std::max(error, (double)(y[i] - x[i]).Magnitude());
+        Check(error < 1e-5, "Backward(Forward(x))", n, error);
+    }
+
+    for (int n = 4; n <= 4 * FFTPlan::kMaxSize; n <<= 1)
+    {
+        std::vector<UnityComplexNumber> x(n), y(n), spectrum(n / 2 + 1);
+        std::vector<float> signal(n), output(n);
+        for (int i = 0; i < n; i++)
+        {
+            x[i].Set(random.GetFloat(-1.0f, 1.0f), random.GetFloat(-1.0f, 1.0f));
+            signal[i] = random.GetFloat(-1.0f, 1.0f);
+        }
+
+        y = x;
+        FFT::Forward(y.data(), n);
+        FFT::Backward(y.data(), n);
+        double error = 0.0;
+        for (int i = 0; i < n; i++)
+            error = std::max(error, (double)(y[i] - x[i]).Magnitude());
+        // past kMaxSize the twiddles come from a recurrence, which loses a few more bits
+        Check(error < (n > FFTPlan::kMaxSize ? 1e-2 : 1e-5 * log2((double)n)), "complex round trip", n, error);
+
+        FFT::ForwardReal(signal.data(), spectrum.data(), n);
+        FFT::BackwardReal(spectrum.data(), output.data(), n);
+        error = 0.0;
+        for (int i = 0; i < n; i++)
+            error = std::max(error, (double)fabsf(output[i] - signal[i]));
+        Check(error < (n / 2 > FFTPlan::kMaxSize ? 1e-2 : 1e-5 * log2((double)n)), "real round trip", n, error);
+    }
+
+    printf("%s\n", failures == 0 ? "fft round trips OK" : "fft round trips FAILED");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,89 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Mixes into a MixBus from many short-lived threads, a few per tick and far more than kMaxThreads over the run,
+// the way Unity's mixer threads come and go, and checks that every tick collects the sum of what each thread mixed.
+
+#include "../MixBus.h"
+
+#include <thread>
+#include <vector>
+
+int main()
+{
+    const int channels = 4, frames = 64, ticks = 200;
+    BufferArena arena;
+    MixBus bus;
+    if (!arena.Reserve(MixBus::GetArenaBytes(channels, frames), false) || !bus.Init(arena, channels, frames))
+    {
+        printf("FAIL cannot set up the bus\n");
+        return 1;
+    }
+
+    std::vector<float> block(frames), out(channels * frames);
+    int failures = 0, threads = 0;
+    for (int t = 0; t < ticks; t++)
+    {
+        const uint64_t tick = (uint64_t)t * frames;
+        bus.Collect(tick, out.data());
+
+        // each thread adds its number to channel (number % channels), twice, as two effects on the thread would
+        const int perTick = 1 + t % MixBus::kMaxThreads;
+        std::vector<std::thread> mixers;
+        for (int m = 0; m < perTick; m++)
+        {
+            const int number = ++threads;
+            mixers.push_back(std::thread([&bus, tick, number] {
+                std::vector<float> ones(frames, 1.0f);
+                for (int effect = 0; effect < 2; effect++)
+                {
+                    MixBus::Bank* bank = bus.Begin(tick);
+                    if (bank != nullptr)
+                        MixAccumulate(bank->Row(number % channels), ones.data(), (float)number, (float)number, frames);
+                }
+            }));
+        }
+        for (size_t m = 0; m < mixers.size(); m++)
+            mixers[m].join();
+
+        float expected[channels] = { 0.0f };
+        for (int number = threads - perTick + 1; number <= threads; number++)
+            expected[number % channels] += 2.0f * number;
+
+        uint8_t active[channels];
+        if (!bus.Collect(tick + frames, out.data(), active))
+        {
+            printf("FAIL tick %d was not collected\n", t);
+            failures++;
+            continue;
+        }
+        for (int ch = 0; ch < channels; ch++)
+        {
+            if (out[ch * frames] != expected[ch] || out[ch * frames + frames - 1] != expected[ch]
+                || active[ch] != (expected[ch] != 0.0f ? 1 : 0))
+            {
+                printf("FAIL tick %d, %d threads so far: channel %d has %g, expected %g\n", t, threads, ch,
+                    out[ch * frames], expected[ch]);
+                failures++;
+            }
+        }
+    }
+
+    printf("%d mixer threads over %d ticks: %s\n", threads, ticks, failures == 0 ? "OK" : "FAILED");
+    return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,185 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Runs InternalJackClient against the mock JACK server in test/mockjack, no jackd needed. First cycle by cycle
+// on the manual clock, checking that what Unity writes plays on the output ports and what arrives on the input
+// ports reaches Unity, sample for sample; then on the realtime clock with jitter and missed deadlines, with a
+// Unity thread feeding it, reporting underruns and the time spent in the JACK callback.
+
+#include "../InternalJackClient.h"
+#include "MockJack.h"
+
+#include <atomic>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <thread>
+#include <vector>
+
+static int PortIndex(const char *port)
+{
+    const char *digits = port + strlen(port);
+    while (digits > port && digits[-1] >= '0' && digits[-1] <= '9') digits--;
+    return atoi(digits);
+}
+
+static float InputSample(int port, uint64_t frame)
+{
+    return 0.25f * port + (float)(frame % 61) / 64.0f;
+}
+
+static float OutputSample(int port, int cycle, int i)
+{
+    return 0.125f * (port + 1) + 0.001f * (cycle % 100) + 1.0e-6f * i;
+}
+
+static void FillInput(void *arg, const char *port, uint64_t frame, float *buffer, int nframes)
+{
+    int index = PortIndex(port);
+    for (int i = 0; i < nframes; i++)
+        buffer[i] = InputSample(index, frame + i);
+}
+
+// The manual clock: the outputs of the last cycle
+struct Capture
+{
+    std::vector<std::vector<float> > ports;
+};
+
+static void CaptureOutput(void *arg, const char *port, uint64_t frame, float *buffer, int nframes)
+{
+    Capture *capture = (Capture *)arg;
+    capture->ports[PortIndex(port)].assign(buffer, buffer + nframes);
+}
+
+static bool RunManual()
+{
+    const int inputs = 2, outputs = 4, frames = 256, cycles = 200;
+    Capture capture;
+    capture.ports.resize(outputs);
+
+    MockJack::Config config;
+    config.bufferSize = frames;
+    config.input = FillInput;
+    config.output = CaptureOutput;
+    config.outputArg = &capture;
+    MockJack::Configure(config);
+
+    InternalJackClient client("mock", inputs, outputs);
+    std::vector<float> block(frames * outputs), received(frames * inputs);
+    int outputErrors = 0, inputErrors = 0;
+    for (int cycle = 0; cycle < cycles; cycle++)
+    {
+        for (int i = 0; i < frames; i++)
+            for (int ch = 0; ch < outputs; ch++)
+                block[i * outputs + ch] = OutputSample(ch, cycle, i);
+        client.setAudioBuffer(block.data());
+
+        uint64_t frame = MockJack::GetStats().frames;
+        MockJack::RunCycles(1);
+
+        for (int ch = 0; ch < outputs; ch++)
+            for (int i = 0; i < frames; i++)
+                if (capture.ports[ch][i] != OutputSample(ch, cycle, i)) outputErrors++;
+
+        if (!client.readInput(received.data(), frames)) inputErrors += frames * inputs;
+        else
+            for (int i = 0; i < frames; i++)
+                for (int ch = 0; ch < inputs; ch++)
+                    if (received[i * inputs + ch] != InputSample(ch, frame + i)) inputErrors++;
+    }
+
+    // nothing written: the cycle plays silence, and there is nothing more to read
+    MockJack::RunCycles(1);
+    bool silent = true;
+    for (int ch = 0; ch < outputs; ch++)
+        for (int i = 0; i < frames; i++)
+            silent = silent && capture.ports[ch][i] == 0.0f;
+    client.readInput(received.data(), frames);
+    bool drained = !client.readInput(received.data(), frames);
+
+    bool ok = outputErrors == 0 && inputErrors == 0 && silent && drained;
+    printf("manual clock: %d cycles, %d output errors, %d input errors, underrun %s, %s\n", cycles, outputErrors,
+        inputErrors, silent ? "silent" : "NOT silent", ok ? "ok" : "FAILED");
+    return ok;
+}
+
+// The realtime clock: output cycles that played silence although Unity was running
+static std::atomic<int> gSilentCycles(0);
+
+static void CountSilence(void *arg, const char *port, uint64_t frame, float *buffer, int nframes)
+{
+    if (PortIndex(port) != 0) return;
+    for (int i = 0; i < nframes; i++)
+        if (buffer[i] != 0.0f) return;
+    gSilentCycles++;
+}
+
+static void RunRealtime(int frames, float jitter, float missRate, int seconds)
+{
+    const int inputs = 8, outputs = 8;
+    MockJack::Config config;
+    config.bufferSize = frames;
+    config.input = FillInput;
+    config.output = CountSilence;
+    MockJack::Configure(config);
+
+    InternalJackClient client("mock", inputs, outputs);
+    std::vector<float> block(frames * outputs, 0.5f), received(frames * inputs);
+    for (int i = 0; i < 2; i++)
+        client.setAudioBuffer(block.data());    // a little headroom before the clock starts
+
+    config.clock = MockJack::Clock_Realtime;
+    config.jitter = jitter;
+    config.missRate = missRate;
+    MockJack::Configure(config);
+    gSilentCycles = 0;
+
+    // Unity: a block per period on its own clock, which drifts against the server's by the same jitter
+    std::chrono::duration<double> period((double)frames / config.sampleRate);
+    std::chrono::steady_clock::time_point next = std::chrono::steady_clock::now(), end = next + std::chrono::seconds(seconds);
+    unsigned seed = 12345;
+    while (std::chrono::steady_clock::now() < end)
+    {
+        seed = seed * 1664525u + 1013904223u;
+        float error = jitter * ((float)(seed >> 8) / (float)(1 << 24) * 2.0f - 1.0f);
+        next += std::chrono::duration_cast<std::chrono::steady_clock::duration>(period);
+        std::this_thread::sleep_until(next + std::chrono::duration_cast<std::chrono::steady_clock::duration>(period * error));
+        client.setAudioBuffer(block.data());
+        client.readInput(received.data(), frames);
+    }
+
+    MockJack::Stats stats = MockJack::GetStats();
+    config.clock = MockJack::Clock_Manual;
+    MockJack::Configure(config);
+    printf("realtime clock, %4d frames, jitter %.2f, miss rate %.3f: %llu cycles, %llu missed, %llu overruns, "
+        "%d silent, callback %.2f us mean %.2f us max\n", frames, jitter, missRate, (unsigned long long)stats.cycles,
+        (unsigned long long)stats.missed, (unsigned long long)stats.overruns, gSilentCycles.load(),
+        stats.processMeanUs, stats.processMaxUs);
+}
+
+int main(int argc, char **argv)
+{
+    int seconds = argc > 1 ? atoi(argv[1]) : 2;
+    bool ok = RunManual();
+    RunRealtime(256, 0.0f, 0.0f, seconds);
+    RunRealtime(256, 0.3f, 0.0f, seconds);
+    RunRealtime(128, 0.3f, 0.01f, seconds);
+    RunRealtime(64, 0.5f, 0.01f, seconds);
+    return ok ? 0 : 1;
+}
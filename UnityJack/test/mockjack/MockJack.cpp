@@ -0,0 +1,578 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// The mock server behind jack/jack.h and jack/ringbuffer.h; see MockJack.h.
+
+#include "MockJack.h"
+
+#include <jack/ringbuffer.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <random>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define MOCK_MAX_FRAMES 8192   // port buffers are this long, the largest buffer size the mock runs
+
+struct _jack_port
+{
+    std::string name;
+    unsigned long flags;
+    std::vector<float> buffer;
+};
+
+struct _jack_client
+{
+    _jack_client()
+    : process(nullptr), processArg(nullptr)
+    , bufferSize(nullptr), bufferSizeArg(nullptr)
+    , xrun(nullptr), xrunArg(nullptr)
+    , shutdown(nullptr), shutdownArg(nullptr)
+    , active(false)
+    {}
+
+    std::string name;
+    JackProcessCallback process;
+    void *processArg;
+    JackBufferSizeCallback bufferSize;
+    void *bufferSizeArg;
+    JackXRunCallback xrun;
+    void *xrunArg;
+    JackShutdownCallback shutdown;
+    void *shutdownArg;
+    std::vector<std::unique_ptr<_jack_port> > ports;
+    bool active;
+};
+
+namespace
+{
+    typedef std::chrono::steady_clock Clock;
+
+    struct Server
+    {
+        Server()
+        : bufferSize(256)
+        , sampleRate(48000)
+        , frames(0)
+        , realtime(false)
+        , epoch(Clock::now())
+        , driverStop(false)
+        {
+            reset();
+        }
+
+        void reset()
+        {
+            random.seed(config.seed);
+            cycles = missed = overruns = 0;
+            processTotalUs = processMaxUs = 0.0;
+        }
+
+        // Joins the driver thread, without the mutex held
+        void stopDriver()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mutex);
+                driverStop = true;
+            }
+            wake.notify_all();
+            if (driver.joinable()) driver.join();
+            driverStop = false;
+        }
+
+        // Under the mutex
+        void startDriver()
+        {
+            if (config.clock != MockJack::Clock_Realtime || driver.joinable()) return;
+            for (size_t i = 0; i < clients.size(); i++)
+            {
+                if (!clients[i]->active) continue;
+                driver = std::thread(&Server::Drive, this);
+                return;
+            }
+        }
+
+        bool anyActive() const
+        {
+            for (size_t i = 0; i < clients.size(); i++)
+                if (clients[i]->active) return true;
+            return false;
+        }
+
+        // One period of the graph, under the mutex
+        void cycle()
+        {
+            jack_nframes_t size = (jack_nframes_t)std::max(1, std::min(config.bufferSize, MOCK_MAX_FRAMES));
+            if (size != bufferSize.load())
+            {
+                bufferSize = size;
+                for (size_t i = 0; i < clients.size(); i++)
+                    if (clients[i]->active && clients[i]->bufferSize)
+                        clients[i]->bufferSize(size, clients[i]->bufferSizeArg);
+            }
+            sampleRate = config.sampleRate;
+            uint64_t frame = frames.load();
+
+            if (config.missRate > 0.0f && std::uniform_real_distribution<float>(0.0f, 1.0f)(random) < config.missRate)
+            {
+                missed++;
+                xruns();
+                frames = frame + size;
+                return;
+            }
+
+            double us = 0.0;
+            for (size_t i = 0; i < clients.size(); i++)
+            {
+                jack_client_t *client = clients[i];
+                if (!client->active) continue;
+                for (size_t p = 0; p < client->ports.size(); p++)
+                {
+                    _jack_port &port = *client->ports[p];
+                    if (!(port.flags & JackPortIsInput)) continue;
+                    if (config.input) config.input(config.inputArg, port.name.c_str(), frame, port.buffer.data(), size);
+                    else memset(port.buffer.data(), 0, size * sizeof(float));
+                }
+
+                Clock::time_point start = Clock::now();
+                if (client->process) client->process(size, client->processArg);
+                us += std::chrono::duration<double, std::micro>(Clock::now() - start).count();
+
+                for (size_t p = 0; p < client->ports.size(); p++)
+                {
+                    _jack_port &port = *client->ports[p];
+                    if ((port.flags & JackPortIsOutput) && config.output)
+                        config.output(config.outputArg, port.name.c_str(), frame, port.buffer.data(), size);
+                }
+            }
+
+            cycles++;
+            processTotalUs += us;
+            processMaxUs = std::max(processMaxUs, us);
+            if (config.clock == MockJack::Clock_Realtime && us > 1.0e6 * size / config.sampleRate)
+            {
+                overruns++;
+                xruns();
+            }
+            frames = frame + size;
+        }
+
+        void xruns()
+        {
+            for (size_t i = 0; i < clients.size(); i++)
+                if (clients[i]->active && clients[i]->xrun)
+                    clients[i]->xrun(clients[i]->xrunArg);
+        }
+
+        // The realtime clock: a cycle per period, each woken early or late by up to jitter periods
+        void Drive()
+        {
+            std::unique_lock<std::mutex> lock(mutex);
+            Clock::time_point next = Clock::now();
+            while (!driverStop)
+            {
+                std::chrono::duration<double> period((double)bufferSize.load() / config.sampleRate);
+                next += std::chrono::duration_cast<Clock::duration>(period);
+                float error = std::uniform_real_distribution<float>(-1.0f, 1.0f)(random) * config.jitter;
+                Clock::time_point due = next + std::chrono::duration_cast<Clock::duration>(period * error);
+                if (wake.wait_until(lock, due, [this] { return driverStop; })) break;
+                cycle();
+                // a server that fell behind starts again from now rather than catching up in a burst
+                if (Clock::now() > next + std::chrono::duration_cast<Clock::duration>(period)) next = Clock::now();
+            }
+        }
+
+        std::mutex mutex;                       // everything but the atomics, held for the whole of a cycle
+        MockJack::Config config;
+        std::vector<jack_client_t *> clients;   // in the order they were activated
+        std::mt19937 random;
+        uint64_t cycles, missed, overruns;
+        double processTotalUs, processMaxUs;
+
+        std::atomic<jack_nframes_t> bufferSize; // as of the last cycle
+        std::atomic<int> sampleRate;
+        std::atomic<uint64_t> frames;
+        std::atomic<bool> realtime;             // config.clock, for jack_get_time
+        const Clock::time_point epoch;
+
+        std::thread driver;
+        bool driverStop;
+        std::condition_variable wake;
+    };
+
+    // Never destroyed, so clients closed from other static destructors still find it
+    Server &server()
+    {
+        static Server *instance = new Server;
+        return *instance;
+    }
+}
+
+namespace MockJack
+{
+    void Configure(const Config &config)
+    {
+        Server &s = server();
+        s.stopDriver();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        s.config = config;
+        s.realtime = config.clock == Clock_Realtime;
+        s.reset();
+        if (!s.anyActive())
+        {
+            s.bufferSize = (jack_nframes_t)std::max(1, std::min(config.bufferSize, MOCK_MAX_FRAMES));
+            s.sampleRate = config.sampleRate;
+        }
+        s.startDriver();
+    }
+
+    Config GetConfig()
+    {
+        std::lock_guard<std::mutex> lock(server().mutex);
+        return server().config;
+    }
+
+    int RunCycles(int count)
+    {
+        Server &s = server();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        if (s.config.clock != Clock_Manual) return 0;
+        for (int i = 0; i < count; i++)
+            s.cycle();
+        return count;
+    }
+
+    void Shutdown()
+    {
+        Server &s = server();
+        s.stopDriver();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        for (size_t i = 0; i < s.clients.size(); i++)
+        {
+            jack_client_t *client = s.clients[i];
+            if (!client->active) continue;
+            client->active = false;
+            if (client->shutdown) client->shutdown(client->shutdownArg);
+        }
+    }
+
+    Stats GetStats()
+    {
+        Server &s = server();
+        std::lock_guard<std::mutex> lock(s.mutex);
+        Stats stats;
+        stats.cycles = s.cycles;
+        stats.missed = s.missed;
+        stats.overruns = s.overruns;
+        stats.frames = s.frames;
+        stats.processMeanUs = s.cycles > 0 ? s.processTotalUs / s.cycles : 0.0;
+        stats.processMaxUs = s.processMaxUs;
+        return stats;
+    }
+}
+
+extern "C" {
+
+jack_client_t *jack_client_open(const char *client_name, jack_options_t options, jack_status_t *status, ...)
+{
+    Server &s = server();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (s.config.failOpen)
+    {
+        if (status) *status = (jack_status_t)(JackFailure | JackServerFailed);
+        return nullptr;
+    }
+    jack_client_t *client = new _jack_client;
+    client->name = client_name;
+    s.clients.push_back(client);
+    if (status) *status = (jack_status_t)0;
+    return client;
+}
+
+int jack_client_close(jack_client_t *client)
+{
+    if (client == nullptr) return 1;
+    jack_deactivate(client);
+    Server &s = server();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    s.clients.erase(std::remove(s.clients.begin(), s.clients.end(), client), s.clients.end());
+    delete client;
+    return 0;
+}
+
+int jack_activate(jack_client_t *client)
+{
+    Server &s = server();
+    std::lock_guard<std::mutex> lock(s.mutex);
+    if (client->active) return 0;
+    client->active = true;
+    s.clients.erase(std::remove(s.clients.begin(), s.clients.end(), client), s.clients.end());
+    s.clients.push_back(client);
+    if (client->bufferSize) client->bufferSize(s.bufferSize, client->bufferSizeArg);
+    s.startDriver();
+    return 0;
+}
+
+int jack_deactivate(jack_client_t *client)
+{
+    Server &s = server();
+    bool last;
+    {
+        std::lock_guard<std::mutex> lock(s.mutex);
+        client->active = false;
+        last = !s.anyActive();
+    }
+    if (last) s.stopDriver();
+    return 0;
+}
+
+int jack_set_process_callback(jack_client_t *client, JackProcessCallback process_callback, void *arg)
+{
+    std::lock_guard<std::mutex> lock(server().mutex);
+    client->process = process_callback;
+    client->processArg = arg;
+    return 0;
+}
+
+int jack_set_buffer_size_callback(jack_client_t *client, JackBufferSizeCallback bufsize_callback, void *arg)
+{
+    std::lock_guard<std::mutex> lock(server().mutex);
+    client->bufferSize = bufsize_callback;
+    client->bufferSizeArg = arg;
+    return 0;
+}
+
+int jack_set_xrun_callback(jack_client_t *client, JackXRunCallback xrun_callback, void *arg)
+{
+    std::lock_guard<std::mutex> lock(server().mutex);
+    client->xrun = xrun_callback;
+    client->xrunArg = arg;
+    return 0;
+}
+
+void jack_on_shutdown(jack_client_t *client, JackShutdownCallback shutdown_callback, void *arg)
+{
+    std::lock_guard<std::mutex> lock(server().mutex);
+    client->shutdown = shutdown_callback;
+    client->shutdownArg = arg;
+}
+
+jack_port_t *jack_port_register(jack_client_t *client, const char *port_name, const char *port_type,
+    unsigned long flags, unsigned long buffer_size)
+{
+    std::lock_guard<std::mutex> lock(server().mutex);
+    std::unique_ptr<_jack_port> port(new _jack_port);
+    port->name = client->name + ":" + port_name;
+    port->flags = flags;
+    port->buffer.assign(MOCK_MAX_FRAMES, 0.0f);
+    client->ports.push_back(std::move(port));
+    return client->ports.back().get();
+}
+
+void *jack_port_get_buffer(jack_port_t *port, jack_nframes_t nframes)
+{
+    return port->buffer.data();
+}
+
+const char *jack_port_name(const jack_port_t *port)
+{
+    return port->name.c_str();
+}
+
+jack_nframes_t jack_get_buffer_size(jack_client_t *client)
+{
+    return server().bufferSize;
+}
+
+jack_nframes_t jack_get_sample_rate(jack_client_t *client)
+{
+    return (jack_nframes_t)server().sampleRate.load();
+}
+
+jack_nframes_t jack_frame_time(const jack_client_t *client)
+{
+    return (jack_nframes_t)server().frames.load();
+}
+
+// Wall time with the realtime clock; with the manual one, the time the frames played so far would have taken
+jack_time_t jack_get_time(void)
+{
+    Server &s = server();
+    if (s.realtime)
+        return (jack_time_t)std::chrono::duration_cast<std::chrono::microseconds>(Clock::now() - s.epoch).count();
+    return (jack_time_t)(s.frames.load() * 1000000 / (uint64_t)s.sampleRate.load());
+}
+
+int jack_is_realtime(jack_client_t *client)
+{
+    return 0;
+}
+
+int jack_client_real_time_priority(jack_client_t *client)
+{
+    return -1;
+}
+
+// The ringbuffer is JACK's, with the pointers loaded and stored with acquire and release ordering so the mock
+// is also clean under ThreadSanitizer.
+
+static size_t LoadPointer(const volatile size_t *p) { return __atomic_load_n(p, __ATOMIC_ACQUIRE); }
+static void StorePointer(volatile size_t *p, size_t value) { __atomic_store_n(p, value, __ATOMIC_RELEASE); }
+
+jack_ringbuffer_t *jack_ringbuffer_create(size_t sz)
+{
+    jack_ringbuffer_t *rb = (jack_ringbuffer_t *)malloc(sizeof(jack_ringbuffer_t));
+    if (rb == nullptr) return nullptr;
+    size_t size = 1;
+    while (size < sz) size <<= 1;
+    rb->buf = (char *)malloc(size);
+    if (rb->buf == nullptr)
+    {
+        free(rb);
+        return nullptr;
+    }
+    rb->size = size;
+    rb->size_mask = size - 1;
+    rb->write_ptr = 0;
+    rb->read_ptr = 0;
+    rb->mlocked = 0;
+    return rb;
+}
+
+void jack_ringbuffer_free(jack_ringbuffer_t *rb)
+{
+    if (rb == nullptr) return;
+    free(rb->buf);
+    free(rb);
+}
+
+int jack_ringbuffer_mlock(jack_ringbuffer_t *rb)
+{
+    rb->mlocked = 1;
+    return 0;
+}
+
+void jack_ringbuffer_reset(jack_ringbuffer_t *rb)
+{
+    StorePointer(&rb->read_ptr, 0);
+    StorePointer(&rb->write_ptr, 0);
+}
+
+size_t jack_ringbuffer_read_space(const jack_ringbuffer_t *rb)
+{
+    size_t w = LoadPointer(&rb->write_ptr), r = LoadPointer(&rb->read_ptr);
+    return (w - r) & rb->size_mask;
+}
+
+size_t jack_ringbuffer_write_space(const jack_ringbuffer_t *rb)
+{
+    size_t w = LoadPointer(&rb->write_ptr), r = LoadPointer(&rb->read_ptr);
+    return ((r - w - 1) & rb->size_mask);
+}
+
+void jack_ringbuffer_get_read_vector(const jack_ringbuffer_t *rb, jack_ringbuffer_data_t *vec)
+{
+    size_t r = LoadPointer(&rb->read_ptr);
+    size_t free = jack_ringbuffer_read_space(rb);
+    size_t end = r + free;
+    if (end > rb->size)
+    {
+        vec[0].buf = &rb->buf[r];
+        vec[0].len = rb->size - r;
+        vec[1].buf = rb->buf;
+        vec[1].len = end & rb->size_mask;
+    }
+    else
+    {
+        vec[0].buf = &rb->buf[r];
+        vec[0].len = free;
+        vec[1].buf = rb->buf;
+        vec[1].len = 0;
+    }
+}
+
+void jack_ringbuffer_get_write_vector(const jack_ringbuffer_t *rb, jack_ringbuffer_data_t *vec)
+{
+    size_t w = LoadPointer(&rb->write_ptr);
+    size_t free = jack_ringbuffer_write_space(rb);
+    size_t end = w + free;
+    if (end > rb->size)
+    {
+        vec[0].buf = &rb->buf[w];
+        vec[0].len = rb->size - w;
+        vec[1].buf = rb->buf;
+        vec[1].len = end & rb->size_mask;
+    }
+    else
+    {
+        vec[0].buf = &rb->buf[w];
+        vec[0].len = free;
+        vec[1].buf = rb->buf;
+        vec[1].len = 0;
+    }
+}
+
+size_t jack_ringbuffer_peek(jack_ringbuffer_t *rb, char *dest, size_t cnt)
+{
+    jack_ringbuffer_data_t vec[2];
+    jack_ringbuffer_get_read_vector(rb, vec);
+    size_t n = std::min(cnt, vec[0].len + vec[1].len);
+    size_t first = std::min(n, vec[0].len);
+    memcpy(dest, vec[0].buf, first);
+    if (n > first) memcpy(dest + first, vec[1].buf, n - first);
+    return n;
+}
+
+void jack_ringbuffer_read_advance(jack_ringbuffer_t *rb, size_t cnt)
+{
+    StorePointer(&rb->read_ptr, (LoadPointer(&rb->read_ptr) + cnt) & rb->size_mask);
+}
+
+size_t jack_ringbuffer_read(jack_ringbuffer_t *rb, char *dest, size_t cnt)
+{
+    size_t n = jack_ringbuffer_peek(rb, dest, cnt);
+    jack_ringbuffer_read_advance(rb, n);
+    return n;
+}
+
+void jack_ringbuffer_write_advance(jack_ringbuffer_t *rb, size_t cnt)
+{
+    StorePointer(&rb->write_ptr, (LoadPointer(&rb->write_ptr) + cnt) & rb->size_mask);
+}
+
+size_t jack_ringbuffer_write(jack_ringbuffer_t *rb, const char *src, size_t cnt)
+{
+    jack_ringbuffer_data_t vec[2];
+    jack_ringbuffer_get_write_vector(rb, vec);
+    size_t n = std::min(cnt, vec[0].len + vec[1].len);
+    size_t first = std::min(n, vec[0].len);
+    memcpy(vec[0].buf, src, first);
+    if (n > first) memcpy(vec[1].buf, src + first, n - first);
+    jack_ringbuffer_write_advance(rb, n);
+    return n;
+}
+
+}
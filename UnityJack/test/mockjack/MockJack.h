@@ -0,0 +1,98 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// An in-process stand-in for the JACK server, so the bridge can be tested and benchmarked without jackd. Build
+// with -DUSE_MOCK_JACK=ON and the jack_* calls land in MockJack.cpp instead of libjack.
+//
+// The server runs every active client's process callback once per period, in the order they were activated.
+// With the manual clock nothing happens until RunCycles is called, so a test drives the graph cycle by cycle and
+// every run is the same. With the realtime clock a driver thread wakes once per period, late or early by a random
+// fraction of it, and reports an xrun to the clients when a cycle takes longer than the period. With either
+// clock a seeded fraction of the cycles can miss their deadline outright: the clients get an xrun instead of the
+// cycle, as when the server is starved.
+
+#pragma once
+
+#include <jack/jack.h>
+
+#include <stdint.h>
+
+namespace MockJack
+{
+    enum Clock
+    {
+        Clock_Manual,       // cycles run only from RunCycles
+        Clock_Realtime      // a driver thread runs them at the sample rate
+    };
+
+    // Fills an input port for a cycle, or reads an output port after one. port is the full "client:port" name,
+    // frame the server's frame time at the start of the cycle.
+    typedef void (*PortCallback)(void *arg, const char *port, uint64_t frame, float *buffer, int nframes);
+
+    struct Config
+    {
+        Config()
+        : bufferSize(256)
+        , sampleRate(48000)
+        , clock(Clock_Manual)
+        , jitter(0.0f)
+        , missRate(0.0f)
+        , seed(1)
+        , failOpen(false)
+        , input(nullptr)
+        , inputArg(nullptr)
+        , output(nullptr)
+        , outputArg(nullptr)
+        {}
+
+        int bufferSize;
+        int sampleRate;
+        Clock clock;
+        float jitter;           // largest wake-up error of the realtime clock, as a fraction of the period
+        float missRate;         // probability that a cycle misses its deadline and is skipped with an xrun
+        unsigned seed;          // of the jitter and the missed cycles
+        bool failOpen;          // jack_client_open fails, as without a server
+        PortCallback input;     // silence on the inputs when null
+        void *inputArg;
+        PortCallback output;
+        void *outputArg;
+    };
+
+    struct Stats
+    {
+        uint64_t cycles;        // run through the clients
+        uint64_t missed;        // skipped with an xrun
+        uint64_t overruns;      // took longer than the period, realtime clock only
+        uint64_t frames;        // frame time, including the missed cycles
+        double processMeanUs;   // time spent in the process callbacks per cycle
+        double processMaxUs;
+    };
+
+    // Replaces the configuration and clears the statistics. The clock and the buffer size apply from the next
+    // cycle; a change of buffer size calls the buffer size callbacks first, as JACK does.
+    void Configure(const Config &config);
+    Config GetConfig();
+
+    // Runs count cycles of the graph on the calling thread, manual clock only. Returns the cycles run.
+    int RunCycles(int count);
+
+    // Simulates the server going away: every client gets its shutdown callback and is deactivated.
+    void Shutdown();
+
+    Stats GetStats();
+}
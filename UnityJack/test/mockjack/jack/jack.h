@@ -0,0 +1,54 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// The part of <jack/jack.h> the bridge uses. MockJack.h controls the server behind it.
+
+#pragma once
+
+#include <jack/types.h>
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+jack_client_t *jack_client_open(const char *client_name, jack_options_t options, jack_status_t *status, ...);
+int jack_client_close(jack_client_t *client);
+int jack_activate(jack_client_t *client);
+int jack_deactivate(jack_client_t *client);
+
+int jack_set_process_callback(jack_client_t *client, JackProcessCallback process_callback, void *arg);
+int jack_set_buffer_size_callback(jack_client_t *client, JackBufferSizeCallback bufsize_callback, void *arg);
+int jack_set_xrun_callback(jack_client_t *client, JackXRunCallback xrun_callback, void *arg);
+void jack_on_shutdown(jack_client_t *client, JackShutdownCallback shutdown_callback, void *arg);
+
+jack_port_t *jack_port_register(jack_client_t *client, const char *port_name, const char *port_type,
+    unsigned long flags, unsigned long buffer_size);
+void *jack_port_get_buffer(jack_port_t *port, jack_nframes_t nframes);
+const char *jack_port_name(const jack_port_t *port);
+
+jack_nframes_t jack_get_buffer_size(jack_client_t *client);
+jack_nframes_t jack_get_sample_rate(jack_client_t *client);
+jack_nframes_t jack_frame_time(const jack_client_t *client);
+jack_time_t jack_get_time(void);
+
+int jack_is_realtime(jack_client_t *client);
+int jack_client_real_time_priority(jack_client_t *client);
+
+#ifdef __cplusplus
+}
+#endif
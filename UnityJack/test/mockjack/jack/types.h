@@ -0,0 +1,78 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// The part of <jack/types.h> the bridge uses, with the same names and values as the real header, for building
+// against the mock server in MockJack.cpp instead of libjack.
+
+#pragma once
+
+#include <stddef.h>
+#include <stdint.h>
+
+typedef uint32_t jack_nframes_t;
+typedef uint64_t jack_time_t;
+typedef float jack_default_audio_sample_t;
+
+typedef struct _jack_port jack_port_t;
+typedef struct _jack_client jack_client_t;
+
+enum JackOptions
+{
+    JackNullOption = 0x00,
+    JackNoStartServer = 0x01,
+    JackUseExactName = 0x02,
+    JackServerName = 0x04,
+    JackLoadName = 0x08,
+    JackLoadInit = 0x10,
+    JackSessionID = 0x20
+};
+typedef enum JackOptions jack_options_t;
+
+enum JackStatus
+{
+    JackFailure = 0x01,
+    JackInvalidOption = 0x02,
+    JackNameNotUnique = 0x04,
+    JackServerStarted = 0x08,
+    JackServerFailed = 0x10,
+    JackServerError = 0x20,
+    JackNoSuchClient = 0x40,
+    JackLoadFailure = 0x80,
+    JackInitFailure = 0x100,
+    JackShmFailure = 0x200,
+    JackVersionError = 0x400,
+    JackBackendError = 0x800,
+    JackClientZombie = 0x1000
+};
+typedef enum JackStatus jack_status_t;
+
+enum JackPortFlags
+{
+    JackPortIsInput = 0x1,
+    JackPortIsOutput = 0x2,
+    JackPortIsPhysical = 0x4,
+    JackPortCanMonitor = 0x8,
+    JackPortIsTerminal = 0x10
+};
+
+typedef int (*JackProcessCallback)(jack_nframes_t nframes, void *arg);
+typedef int (*JackBufferSizeCallback)(jack_nframes_t nframes, void *arg);
+typedef int (*JackXRunCallback)(void *arg);
+typedef void (*JackShutdownCallback)(void *arg);
+
+#define JACK_DEFAULT_AUDIO_TYPE "32 bit float mono audio"
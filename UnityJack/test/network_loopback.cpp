@@ -0,0 +1,184 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Sends a few hundred blocks through NetworkClient to a NetworkReceiver on 127.0.0.1 and checks what comes out
+// of the jitter buffer, for every ring format, and that a channel arriving after its block started playing is
+// dropped rather than played from the middle. No JACK server needed.
+
+#include "../NetworkBridge.h"
+
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+
+static float Signal(int channel, long frame)
+{
+    return 0.5f * sinf(0.01f * (channel + 1) * (float)frame + 1.0f);
+}
+
+static bool RunFormat(RingFormat format, float tolerance)
+{
+    const int channels = 8, frames = 256, blocks = 200, latency = 4, pull = 100;
+    NetworkBridge::NetworkReceiver receiver(channels, latency);
+    if (!receiver.Start("127.0.0.1", 0))
+    {
+        printf("cannot bind\n");
+        return false;
+    }
+    NetworkBridge::NetworkClient sender("127.0.0.1", receiver.GetPort(), 0, channels, frames, 0, format);
+
+    // Odd channels are silent and not sent at all
+    std::vector<float> block(channels * frames);
+    uint8_t active[channels];
+    for (int ch = 0; ch < channels; ch++)
+        active[ch] = (ch % 2) == 0;
+
+    std::vector<std::vector<float> > out(channels, std::vector<float>(frames));
+    std::vector<float*> outputs(channels);
+    for (int ch = 0; ch < channels; ch++)
+        outputs[ch] = out[ch].data();
+
+    bool found = false;
+    long first = 0;     // stream frame minus output frame, once the output has started
+    long played = 0;
+    float error = 0.0f;
+    bool silent = true;
+    for (int b = 0; b < blocks; b++)
+    {
+        for (int ch = 0; ch < channels; ch++)
+            for (int i = 0; i < frames; i++)
+                block[ch * frames + i] = active[ch] ? Signal(ch, (long)b * frames + i) : 0.0f;
+        sender.setAudioChannels(block.data(), frames, active);
+        std::this_thread::sleep_for(std::chrono::microseconds(500));
+
+        // pull a block's worth per block sent, in cycles that don't line up with the blocks
+        for (int p = 0; p < 2; p++)
+        {
+            int cycle = p == 0 ? pull : frames - pull;
+            receiver.Pull(outputs.data(), cycle);
+            for (int i = 0; i < cycle; i++, played++)
+            {
+                if (!found && out[0][i] != 0.0f)
+                {
+                    // playback starts on a block boundary, find the block by its first samples
+                    float best = 1.0e30f;
+                    for (int k = 0; k < blocks; k++)
+                    {
+                        float distance = 0.0f;
+                        for (int ch = 0; ch < channels; ch++)
+                            for (int j = 0; j + i < cycle && j < 8; j++)
+                                distance += fabsf(out[ch][i + j] - (active[ch] ? Signal(ch, (long)k * frames + j) : 0.0f));
+                        if (distance < best)
+                        {
+                            best = distance;
+                            first = (long)k * frames - played;
+                        }
+                    }
+                    found = true;
+                }
+                if (!found) continue;
+                for (int ch = 0; ch < channels; ch++)
+                {
+                    float expected = active[ch] ? Signal(ch, first + played) : 0.0f;
+                    error = std::max(error, fabsf(out[ch][i] - expected));
+                    silent = silent && (active[ch] || out[ch][i] == 0.0f);
+                }
+            }
+        }
+    }
+    NetworkBridge::NetworkReceiver::Stats stats = receiver.GetStats();
+    receiver.Stop();
+
+    bool ok = found && error <= tolerance && silent && stats.lost == 0 && stats.resyncs == 0 && stats.early == 0;
+    printf("format %d: %s  max error %g  packets %llu  late %llu  early %llu  lost %llu  resyncs %llu\n", (int)format,
+        ok ? "ok" : "FAILED", error, (unsigned long long)stats.packets, (unsigned long long)stats.late,
+        (unsigned long long)stats.early, (unsigned long long)stats.lost,
+        (unsigned long long)stats.resyncs);
+    return ok;
+}
+
+// Sends channel 0 of every block in time and channel 1 only once the block is half played: channel 1 has to stay
+// silent, and every one of its packets count as late
+static bool LateChannels()
+{
+    const int channels = 2, frames = 64, blocks = 100, latency = 2;
+    NetworkBridge::NetworkReceiver receiver(channels, latency);
+    NetworkBridge::UdpSocket socket;
+    if (!receiver.Start("127.0.0.1", 0) || !socket.Connect("127.0.0.1", receiver.GetPort()))
+    {
+        printf("cannot bind\n");
+        return false;
+    }
+
+    std::vector<uint8_t> packet(sizeof(NetworkBridge::PacketHeader) + sizeof(float) * frames);
+    NetworkBridge::PacketHeader* header = (NetworkBridge::PacketHeader*)packet.data();
+    float* row = (float*)(packet.data() + sizeof(NetworkBridge::PacketHeader));
+    auto send = [&](uint32_t block, int channel) {
+        header->magic = NetworkBridge::kMagic;
+        header->sequence = block;
+        header->frames = frames;
+        header->channels = channels;
+        header->first = (uint16_t)channel;
+        header->count = 1;
+        header->format = RingFormat_Float32;
+        header->version = NetworkBridge::kVersion;
+        header->reserved = 0;
+        for (int i = 0; i < frames; i++)
+            row[i] = (float)(block + 1) * (channel == 0 ? 1.0f : -1.0f);
+        socket.Send(packet.data(), (int)packet.size());
+        std::this_thread::sleep_for(std::chrono::milliseconds(2));
+    };
+
+    std::vector<float> out0(frames / 2), out1(frames / 2);
+    float* outputs[channels] = { out0.data(), out1.data() };
+    int sent = 0;
+    bool leaked = false;
+    for (int b = 0; b < blocks; b++)
+    {
+        send(b, 0);
+        for (int half = 0; half < 2; half++)
+        {
+            receiver.Pull(outputs, frames / 2);
+            for (int i = 0; i < frames / 2; i++)
+                leaked = leaked || out1[i] != 0.0f;
+            if (half == 0 && out0[0] != 0.0f)
+            {
+                // the block playing is the one channel 0 says it is
+                send((uint32_t)out0[0] - 1, 1);
+                sent++;
+            }
+        }
+    }
+    NetworkBridge::NetworkReceiver::Stats stats = receiver.GetStats();
+    receiver.Stop();
+
+    bool ok = sent > blocks / 2 && !leaked && stats.late == (uint64_t)sent;
+    printf("late channels: %s  blocks played %d  channel 1 %s  late %llu\n", ok ? "ok" : "FAILED", sent,
+        leaked ? "played" : "silent", (unsigned long long)stats.late);
+    return ok;
+}
+
+int main()
+{
+    bool ok = RunFormat(RingFormat_Float32, 0.0f);
+    ok = RunFormat(RingFormat_Int16, 1.0e-4f) && ok;
+    ok = RunFormat(RingFormat_Int24, 1.0e-6f) && ok;
+    ok = RunFormat(RingFormat_Float16, 5.0e-4f) && ok;
+    ok = LateChannels() && ok;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,308 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Stress test of the Unity/JACK handoff through InternalJackClient's ringbuffers, on the mock JACK server in
+// test/mockjack. Every round picks a buffer size, ring format, port counts, worker count, clock jitter and rate
+// of missed cycles at random, creates a client, and runs a Unity output thread and a Unity input thread against
+// the realtime clock until the client is torn down under them.
+//
+// Every sample carries a code: on the outputs the frame number Unity wrote it at, on the inputs the server's
+// frame time, each offset per port. The checks:
+//   outputs: a cycle of a port is silent or all of one Unity cycle, the ports of a JACK cycle play the same Unity
+//            cycle, and Unity cycles only go forward
+//   inputs:  every block Unity reads continues the previous one, except for whole JACK cycles dropped by the
+//            server or by the client, and all ports of a frame agree
+//
+// Build with -DUSE_MOCK_JACK=ON -DBUILD_BENCHMARKS=ON, and -DSANITIZE_THREADS=ON to run it under ThreadSanitizer.
+// Usage: ring_stress [seconds] [seed]
+
+#include "../InternalJackClient.h"
+#include "MockJack.h"
+
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstring>
+#include <random>
+#include <thread>
+#include <vector>
+
+#define MAX_PORTS 8
+
+// Float32 rings carry 20 bit codes exactly; the compact formats 6 bit codes, far apart enough to survive
+// dither and half precision
+struct Coding
+{
+    int bits;
+
+    int Modulus() const { return 1 << bits; }
+
+    float Encode(int64_t counter, int port) const
+    {
+        int code = (int)((counter + 13 * port) & (Modulus() - 1));
+        if (bits > 6) return ((float)code + 0.5f) / (float)Modulus();
+        return ((float)code - 31.5f) / 64.0f;
+    }
+
+    // The counter modulo Modulus(), -1 for a value that is no code
+    int Decode(float value, int port) const
+    {
+        float code = (bits > 6) ? value * Modulus() - 0.5f : value * 64.0f + 31.5f;
+        int rounded = (int)floorf(code + 0.5f);
+        if (fabsf(code - rounded) > 0.25f || rounded < 0 || rounded >= Modulus()) return -1;
+        return (rounded - 13 * port) & (Modulus() - 1);
+    }
+};
+
+struct Round
+{
+    Coding coding;
+    int frames;
+    int inputs;
+    int outputs;
+
+    // output checks, on the JACK thread
+    std::vector<int64_t> lastBase;      // per port, -1 before its first cycle
+    int64_t cycleFrame;                 // server frame of the JACK cycle being checked
+    int cycleBase;                      // Unity cycle the non-silent ports of that JACK cycle play, -1 for none yet
+    std::atomic<uint64_t> outputCycles;
+    std::atomic<uint64_t> silentCycles;
+    std::atomic<uint64_t> outputErrors;
+};
+
+static Round gRound;
+
+static int PortIndex(const char *port)
+{
+    const char *digits = port + strlen(port);
+    while (digits > port && digits[-1] >= '0' && digits[-1] <= '9') digits--;
+    return atoi(digits);
+}
+
+static void FillInput(void *arg, const char *port, uint64_t frame, float *buffer, int nframes)
+{
+    int index = PortIndex(port);
+    for (int i = 0; i < nframes; i++)
+        buffer[i] = gRound.coding.Encode((int64_t)frame + i, index);
+}
+
+static void CheckOutput(void *arg, const char *port, uint64_t frame, float *buffer, int nframes)
+{
+    Round &r = gRound;
+    int index = PortIndex(port);
+    if ((int64_t)frame != r.cycleFrame)
+    {
+        r.cycleFrame = frame;
+        r.cycleBase = -1;
+    }
+
+    bool silent = true;
+    for (int i = 0; i < nframes && silent; i++)
+        silent = buffer[i] == 0.0f;
+    if (silent)
+    {
+        r.silentCycles++;
+        return;
+    }
+    r.outputCycles++;
+
+    int m = r.coding.Modulus();
+    int base = r.coding.Decode(buffer[0], index);
+    bool torn = base < 0;
+    for (int i = 1; i < nframes && !torn; i++)
+        torn = r.coding.Decode(buffer[i], index) != ((base + i) & (m - 1));
+    if (torn)
+    {
+        if (r.outputErrors++ < 10) printf("  %s: torn cycle at frame %llu\n", port, (unsigned long long)frame);
+        return;
+    }
+    if (r.cycleBase >= 0 && base != r.cycleBase)
+    {
+        if (r.outputErrors++ < 10) printf("  %s: plays another Unity cycle than the other ports\n", port);
+        return;
+    }
+    r.cycleBase = base;
+
+    // with 20 bit codes a cycle that does not move forward by at least one cycle was repeated or reordered
+    int64_t last = r.lastBase[index];
+    if (last >= 0 && r.coding.bits > 6)
+    {
+        int64_t step = (base - last) & (m - 1);
+        if (step == 0 || step % r.frames != 0 || step > m / 2)
+        {
+            if (r.outputErrors++ < 10) printf("  %s: Unity cycle moved by %lld frames\n", port, (long long)step);
+        }
+    }
+    r.lastBase[index] = base;
+}
+
+template<typename T> static T Pick(std::mt19937 &random, const std::vector<T> &choices)
+{
+    return choices[std::uniform_int_distribution<int>(0, (int)choices.size() - 1)(random)];
+}
+
+// Writes Unity cycles through all three entry points, at a rate around the server's with bursts and stalls
+static void OutputThread(InternalJackClient *client, unsigned seed, std::atomic<bool> *running)
+{
+    Round &r = gRound;
+    std::mt19937 random(seed);
+    std::uniform_real_distribution<float> uniform(0.0f, 1.0f);
+    std::vector<float> interleaved(r.frames * r.outputs), planar(r.frames * r.outputs);
+    std::vector<const float *> rows(r.outputs);
+    std::vector<uint8_t> active(r.outputs);
+    double period = (double)r.frames / MockJack::GetConfig().sampleRate;
+    int64_t counter = 0;
+    while (running->load())
+    {
+        for (int ch = 0; ch < r.outputs; ch++)
+            for (int i = 0; i < r.frames; i++)
+            {
+                float v = r.coding.Encode(counter + i, ch);
+                interleaved[i * r.outputs + ch] = v;
+                planar[ch * r.frames + i] = v;
+            }
+        counter += r.frames;
+
+        switch (std::uniform_int_distribution<int>(0, 2)(random))
+        {
+            case 0:
+                client->setAudioBuffer(interleaved.data());
+                break;
+            case 1:
+                for (int ch = 0; ch < r.outputs; ch++)
+                    rows[ch] = uniform(random) < 0.8f ? &planar[ch * r.frames] : nullptr;
+                client->setAudioRows(rows.data());
+                break;
+            default:
+                for (int ch = 0; ch < r.outputs; ch++)
+                    active[ch] = uniform(random) < 0.8f;
+                client->setAudioChannels(planar.data(), r.frames, uniform(random) < 0.2f ? nullptr : active.data());
+                break;
+        }
+
+        float p = uniform(random);
+        double wait = period * (0.7 + 0.6 * uniform(random));
+        if (p < 0.05f) wait = 0.0;                  // burst
+        else if (p < 0.07f) wait = 4.0 * period;    // stall
+        std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+    }
+}
+
+// Reads blocks of random length and checks they continue each other
+static void InputThread(InternalJackClient *client, unsigned seed, std::atomic<bool> *running, std::atomic<uint64_t> *errors, std::atomic<uint64_t> *blocks)
+{
+    Round &r = gRound;
+    std::mt19937 random(seed);
+    std::vector<float> buffer(3 * r.frames * r.inputs);
+    double period = (double)r.frames / MockJack::GetConfig().sampleRate;
+    int m = r.coding.Modulus();
+    int step = std::min(m, r.frames);   // frames skip by whole JACK cycles
+    int last = -1;
+    while (running->load())
+    {
+        int length = std::uniform_int_distribution<int>(1, 3 * r.frames)(random);
+        if (client->readInput(buffer.data(), length))
+        {
+            (*blocks)++;
+            for (int i = 0; i < length; i++)
+            {
+                int code = r.coding.Decode(buffer[i * r.inputs], 0);
+                bool ok = code >= 0;
+                for (int ch = 1; ch < r.inputs && ok; ch++)
+                    ok = r.coding.Decode(buffer[i * r.inputs + ch], ch) == code;
+                if (ok && last >= 0)
+                {
+                    int delta = (code - last - 1) & (m - 1);
+                    ok = delta % step == 0;
+                }
+                if (!ok && (*errors)++ < 10) printf("  input frame %d of a block of %d does not follow\n", i, length);
+                last = code;
+            }
+        }
+        std::this_thread::sleep_for(std::chrono::duration<double>(period * length / r.frames * (0.5 + std::uniform_real_distribution<double>(0.0, 1.0)(random))));
+    }
+}
+
+int main(int argc, char **argv)
+{
+    double seconds = argc > 1 ? atof(argv[1]) : 10.0;
+    unsigned seed = argc > 2 ? (unsigned)atoi(argv[2]) : 1;
+    std::mt19937 random(seed);
+
+    const char *formats[RingFormat_Count] = { "float32", "int16", "int24", "float16" };
+    uint64_t failures = 0, rounds = 0;
+    std::chrono::steady_clock::time_point end = std::chrono::steady_clock::now() + std::chrono::duration_cast<std::chrono::steady_clock::duration>(std::chrono::duration<double>(seconds));
+    while (std::chrono::steady_clock::now() < end)
+    {
+        Round &r = gRound;
+        RingFormat format = (RingFormat)std::uniform_int_distribution<int>(0, RingFormat_Count - 1)(random);
+        r.coding.bits = format == RingFormat_Float32 ? 20 : 6;
+        r.frames = Pick(random, std::vector<int>{ 32, 64, 128, 256 });
+        r.inputs = Pick(random, std::vector<int>{ 1, 2, 3, 8 });
+        r.outputs = Pick(random, std::vector<int>{ 1, 2, 5, 8 });
+        r.lastBase.assign(MAX_PORTS, -1);
+        r.cycleFrame = -1;
+        r.cycleBase = -1;
+        r.outputCycles = r.silentCycles = r.outputErrors = 0;
+        int workers = std::uniform_int_distribution<int>(0, 2)(random);
+
+        MockJack::Config config;
+        config.bufferSize = r.frames;
+        config.clock = MockJack::Clock_Realtime;
+        config.jitter = std::uniform_real_distribution<float>(0.0f, 0.5f)(random);
+        config.missRate = std::uniform_real_distribution<float>(0.0f, 0.02f)(random);
+        config.seed = (unsigned)random();
+        config.input = FillInput;
+        config.output = CheckOutput;
+        MockJack::Configure(config);
+
+        std::atomic<uint64_t> inputErrors(0), inputBlocks(0);
+        {
+            InternalJackClient client("stress", r.inputs, r.outputs, workers, ThreadConfig(), 0, format);
+            std::atomic<bool> running(true);
+            std::thread output(OutputThread, &client, (unsigned)random(), &running);
+            std::thread input(InputThread, &client, (unsigned)random(), &running, &inputErrors, &inputBlocks);
+            std::this_thread::sleep_for(std::chrono::milliseconds(std::uniform_int_distribution<int>(20, 300)(random)));
+            running = false;
+            output.join();
+            input.join();
+            // the client goes away while the server is still running its cycles
+        }
+
+        MockJack::Stats stats = MockJack::GetStats();
+        uint64_t errors = r.outputErrors + inputErrors;
+        if (stats.cycles >= 8 && r.outputCycles == 0)
+        {
+            printf("  nothing played\n");
+            errors++;
+        }
+        printf("round %3llu: %s, %3d frames, %d in, %d out, %d workers: %4llu cycles (%llu missed), %4llu played, "
+            "%4llu silent, %4llu input blocks, %s\n", (unsigned long long)rounds, formats[format], r.frames, r.inputs,
+            r.outputs, workers, (unsigned long long)stats.cycles, (unsigned long long)stats.missed,
+            (unsigned long long)r.outputCycles.load(), (unsigned long long)r.silentCycles.load(),
+            (unsigned long long)inputBlocks.load(), errors == 0 ? "ok" : "FAILED");
+        if (errors > 0) failures++;
+        rounds++;
+    }
+
+    MockJack::Config idle;
+    MockJack::Configure(idle);
+    printf("%llu rounds, %llu failed\n", (unsigned long long)rounds, (unsigned long long)failures);
+    return failures == 0 ? 0 : 1;
+}
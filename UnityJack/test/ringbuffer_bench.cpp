@@ -0,0 +1,268 @@
+// Copyright (C) 2016  Rodrigo Diaz
+//
+// This file is part of JackAudioUnity.
+//
+// JackAudioUnity is free software: you can redistribute it and/or modify
+// it under the terms of the GNU General Public License as published by
+// the Free Software Foundation, either version 3 of the License, or
+// (at your option) any later version.
+//
+// JackAudioUnity is distributed in the hope that it will be useful,
+// but WITHOUT ANY WARRANTY; without even the implied warranty of
+// MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+// GNU General Public License for more details.
+//
+// You should have received a copy of the GNU General Public License
+// along with JackAudioUnity.  If not, see <http://www.gnu.org/licenses/>.
+//
+
+// Compares the atomic RingBuffer and HistoryBuffer in AudioPluginUtil against the volatile versions they replaced:
+// the cost of the ring's operations on one thread; a producer and a consumer thread passing samples through it one
+// at a time and in blocks, checking every sample arrives in order, which needs two CPUs; and the history buffer
+// fed sample by sample and by block.
+
+#include "../AudioPluginUtil.h"
+
+#include <chrono>
+#include <cstdio>
+#include <memory>
+#include <thread>
+#include <vector>
+
+// RingBuffer as it was before the atomic positions, kept here as the baseline. It overwrites when full, so the
+// producer below waits for room itself.
+template<const int _LENGTH, typename T = float>
+class ReferenceRingBuffer
+{
+public:
+    enum { LENGTH = _LENGTH };
+
+    ReferenceRingBuffer() : readpos(0), writepos(0) {}
+
+    volatile int readpos;
+    volatile int writepos;
+    T buffer[LENGTH];
+
+    inline bool Read(T& val)
+    {
+        int r = readpos;
+        if (r == writepos)
+            return false;
+        r = (r == LENGTH - 1) ? 0 : (r + 1);
+        val = buffer[r];
+        readpos = r;
+        return true;
+    }
+
+    inline bool Feed(const T& input)
+    {
+        int w = (writepos == LENGTH - 1) ? 0 : (writepos + 1);
+        buffer[w] = input;
+        writepos = w;
+        return true;
+    }
+
+    inline int GetNumBuffered() const
+    {
+        int b = writepos - readpos;
+        if (b < 0)
+            b += LENGTH;
+        return b;
+    }
+};
+
+// HistoryBuffer::Feed as it was
+struct ReferenceHistory
+{
+    int length;
+    int writeindex;
+    float* data;
+
+    inline void Feed(float sample)
+    {
+        int w = writeindex + 1;
+        if (w == length)
+            w = 0;
+        data[w] = sample;
+        writeindex = w;
+    }
+};
+
+typedef std::chrono::steady_clock Clock;
+
+static double Seconds(Clock::time_point start)
+{
+    return std::chrono::duration<double>(Clock::now() - start).count();
+}
+
+// Nanoseconds per sample through the ring, or a negative number when a sample came out wrong
+template<typename Producer, typename Consumer> static double Transfer(Producer produce, Consumer consume, int total)
+{
+    bool ok = true;
+    Clock::time_point start = Clock::now();
+    std::thread consumer([&] { ok = consume(total); });
+    produce(total);
+    consumer.join();
+    double ns = Seconds(start) * 1.0e9 / total;
+    return ok ? ns : -ns;
+}
+
+typedef ReferenceRingBuffer<4096> Reference;
+typedef RingBuffer<4096> Atomic;
+
+// Fills half the ring and empties it again, over and over, all on one thread
+static void SingleThread(Reference& reference, Atomic& atomic, int total, int block)
+{
+    const int half = Atomic::LENGTH / 2, rounds = total / half;
+    float sink = 0.0f, v;
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < rounds; i++)
+    {
+        for (int k = 0; k < half; k++)
+            reference.Feed((float)k);
+        while (reference.Read(v))
+            sink += v;
+    }
+    double tref = Seconds(start) * 1.0e9 / total;
+
+    start = Clock::now();
+    for (int i = 0; i < rounds; i++)
+    {
+        for (int k = 0; k < half; k++)
+            atomic.Feed((float)k);
+        while (atomic.Read(v))
+            sink += v;
+    }
+    double tone = Seconds(start) * 1.0e9 / total;
+
+    std::vector<float> src(block, 1.0f), dst(block);
+    start = Clock::now();
+    for (int i = 0; i < rounds; i++)
+    {
+        for (int k = 0; k < half; k += block)
+            atomic.Write(src.data(), block);
+        while (atomic.Read(dst.data(), block) > 0)
+            sink += dst[0];
+    }
+    double tblock = Seconds(start) * 1.0e9 / total;
+
+    printf("RingBuffer, %d samples on one thread (ns per sample written and read, checksum %g)\n", total, sink);
+    printf("  volatile, per sample:  %6.2f\n", tref);
+    printf("  atomic, per sample:    %6.2f\n", tone);
+    printf("  atomic, blocks of %d: %6.2f\n", block, tblock);
+}
+
+// False when a sample came out of the ring wrong
+static bool TwoThreads(Reference& reference, Atomic& atomic, int total, int block)
+{
+    double tref = Transfer(
+        [&](int n) {
+            for (int i = 0; i < n; i++)
+            {
+                while (reference.GetNumBuffered() >= Reference::LENGTH - 1) {}
+                reference.Feed((float)(i & 0xffffff));
+            }
+        },
+        [&](int n) {
+            bool ok = true;
+            float v;
+            for (int i = 0; i < n; i++)
+            {
+                while (!reference.Read(v)) {}
+                ok = ok && v == (float)(i & 0xffffff);
+            }
+            return ok;
+        }, total);
+
+    double tone = Transfer(
+        [&](int n) {
+            for (int i = 0; i < n; i++)
+                while (!atomic.Feed((float)(i & 0xffffff))) {}
+        },
+        [&](int n) {
+            bool ok = true;
+            float v;
+            for (int i = 0; i < n; i++)
+            {
+                while (!atomic.Read(v)) {}
+                ok = ok && v == (float)(i & 0xffffff);
+            }
+            return ok;
+        }, total);
+
+    double tblock = Transfer(
+        [&](int n) {
+            std::vector<float> src(block);
+            for (int i = 0; i < n; i += block)
+            {
+                for (int k = 0; k < block; k++)
+                    src[k] = (float)((i + k) & 0xffffff);
+                for (int done = 0; done < block; )
+                    done += atomic.Write(src.data() + done, block - done);
+            }
+        },
+        [&](int n) {
+            bool ok = true;
+            std::vector<float> dst(block);
+            for (int i = 0; i < n; )
+            {
+                int got = atomic.Read(dst.data(), block);
+                for (int k = 0; k < got; k++)
+                    ok = ok && dst[k] == (float)((i + k) & 0xffffff);
+                i += got;
+            }
+            return ok;
+        }, total);
+
+    printf("RingBuffer, %d samples between two threads (ns per sample, negative when out of order)\n", total);
+    printf("  volatile, per sample:  %6.2f\n", tref);
+    printf("  atomic, per sample:    %6.2f\n", tone);
+    printf("  atomic, blocks of %d: %6.2f\n", block, tblock);
+    return tref > 0.0 && tone > 0.0 && tblock > 0.0;
+}
+
+static void History(int block)
+{
+    const int length = 1 << 14, samples = 1 << 26;
+    std::vector<float> referenceData(length - 3), input(block);
+    ReferenceHistory history = { length - 3, 0, referenceData.data() };
+    HistoryBuffer atomicHistory;
+    atomicHistory.Init(length - 3);
+    for (int i = 0; i < block; i++)
+        input[i] = (float)i;
+
+    Clock::time_point start = Clock::now();
+    for (int i = 0; i < samples; i++)
+        history.Feed(input[i & (block - 1)]);
+    double tref = Seconds(start) * 1.0e9 / samples;
+    start = Clock::now();
+    for (int i = 0; i < samples; i++)
+        atomicHistory.Feed(input[i & (block - 1)]);
+    double tone = Seconds(start) * 1.0e9 / samples;
+    start = Clock::now();
+    for (int i = 0; i < samples; i += block)
+        atomicHistory.FeedBlock(input.data(), block);
+    double tblock = Seconds(start) * 1.0e9 / samples;
+
+    printf("HistoryBuffer, %d samples (ns per sample, last written %g %g)\n", samples, history.data[history.writeindex],
+        atomicHistory.data[atomicHistory.GetWriteIndex()]);
+    printf("  reference Feed:        %6.2f\n", tref);
+    printf("  masked Feed:           %6.2f\n", tone);
+    printf("  FeedBlock of %d:      %6.2f\n", block, tblock);
+}
+
+int main()
+{
+    const int total = 1 << 25, block = 256;
+    std::unique_ptr<Reference> reference(new Reference);
+    std::unique_ptr<Atomic> atomic(new Atomic);
+
+    SingleThread(*reference, *atomic, total, block);
+    bool ok = true;
+    if (std::thread::hardware_concurrency() >= 2)
+        ok = TwoThreads(*reference, *atomic, total, block);
+    else
+        printf("RingBuffer between two threads: skipped, there is only one CPU\n");
+    History(block);
+    return ok ? 0 : 1;
+}
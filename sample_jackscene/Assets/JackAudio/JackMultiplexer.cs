@@ -19,8 +19,10 @@
 
 using UnityEngine;
 using UnityEngine.Assertions;
+using System;
 using System.Collections;
 using System.Linq;
+using System.Runtime.InteropServices;
 
 
 namespace JackAudio
@@ -32,17 +34,30 @@ namespace JackAudio
         // Default unity buffer size per mono block
         private int BUFFER_SIZE = 1024;
         public bool useEffects;
+        // Send the track blocks filled through JackWrapper.AcquireTrackBlock instead of combinedBuffers
+        public bool useNativeBlocks;
 
         [HideInInspector]
         public float[][] combinedBuffers;
 
-        private float[] mixedBufferOut;
-        private float[] mixedBufferIn;
+        // combinedBuffers pinned for the plugin, and the tracks written since the last block
+        private GCHandle[] trackHandles;
+        private IntPtr[] trackPointers;
+        private ulong[] activeTracks;
 
         private bool started = false;
 
         public int INPUTS;
         public int OUTPUTS;
+        // Extra threads the Jack callback spreads per-port processing over, 0 keeps it on the Jack thread
+        public int WORKERS;
+        // Sample format between Unity and Jack, the compact ones save memory bandwidth at high channel counts
+        public RingFormat RING_FORMAT = RingFormat.Float32;
+        // Stream to a UnityJackReceiver on this host instead of a local Jack server; empty for Jack
+        public string NETWORK_HOST;
+        public int NETWORK_PORT = 9500;
+        // Speaker layout file for the Jack Spatializer plugin, relative to the project folder; empty for none
+        public string SPEAKER_LAYOUT;
         // 
         private JackSourceSend[] outSources;
         private JackSourceReceive[] inSources;
@@ -61,6 +76,12 @@ namespace JackAudio
         {
             // if (!useEffects) JackWrapper.DestroyJackClient(); 
             JackWrapper.DestroyJackClient();
+            if (trackHandles != null)
+            {
+                foreach (GCHandle handle in trackHandles)
+                    if (handle.IsAllocated) handle.Free();
+                trackHandles = null;
+            }
         }
 
 
@@ -91,25 +112,35 @@ namespace JackAudio
                 combinedBuffers[i] = new float[BUFFER_SIZE];
             }
 
-            mixedBufferOut = new float[OUTPUTS * BUFFER_SIZE];
-            mixedBufferIn = new float[INPUTS * BUFFER_SIZE];
+            trackHandles = new GCHandle[OUTPUTS];
+            trackPointers = new IntPtr[OUTPUTS];
+            for (int i = 0; i < OUTPUTS; i++)
+            {
+                trackHandles[i] = GCHandle.Alloc(combinedBuffers[i], GCHandleType.Pinned);
+                trackPointers[i] = trackHandles[i].AddrOfPinnedObject();
+            }
+            activeTracks = new ulong[(OUTPUTS + 63) / 64];
 
             // Start Engine
-            JackWrapper.StartJackClient(INPUTS, OUTPUTS);
+            JackWrapper.SetNetworkTarget(NETWORK_HOST, NETWORK_PORT, BUFFER_SIZE);
+            JackWrapper.StartJackClient(INPUTS, OUTPUTS, WORKERS, RING_FORMAT);
+            if (!string.IsNullOrEmpty(SPEAKER_LAYOUT) && !JackWrapper.SetSpeakerLayout(SPEAKER_LAYOUT))
+            {
+                Debug.LogError("Could not load speaker layout " + SPEAKER_LAYOUT);
+            }
             started = true;
         }
 
-        public void GetBuffer(int idx, float[] data)
+        public void SetBuffer(int idx, float[] data)
         {
-            for (int i = 0, j = 0; i < BUFFER_SIZE; i++, j += 2)
-            {
-                data[j] = mixedBufferIn[(i * INPUTS) + idx];
-                data[j + 1] = data[j];
-            }
         }
 
-        public void SetBuffer(int idx, float[] data)
+        /// <summary>
+        /// Flags a track as written for the next block; called by JackSourceSend after filling combinedBuffers[idx]
+        /// </summary>
+        public void MarkTrack(int idx)
         {
+            if (idx >= 0 && idx < OUTPUTS) activeTracks[idx / 64] |= 1UL << (idx % 64);
         }
 
 
@@ -131,19 +162,18 @@ namespace JackAudio
             // JackWrapper.SetAudioBuffer(ref combinedBuffers[0][0]);
             // float[] debugbuffer = combinedBuffers[0];
 
-            // TODO: It is possible to send planar data instead.
-            // That would spare iterating over the samples
-
-            for (int j = 0; j < OUTPUTS; j++)
+            if (useNativeBlocks)
+            {
+                JackWrapper.SendTrackBlock(BUFFER_SIZE);
+            }
+            else
             {
-                for (int i = 0; i < BUFFER_SIZE; i++)
-                {
-                    mixedBufferOut[(i * OUTPUTS) + j] = combinedBuffers[j][i];
-                }
+                // The tracks go to the plugin planar, straight from the pinned buffers
+                JackWrapper.SetPlanarData(trackPointers, activeTracks, BUFFER_SIZE);
+                System.Array.Clear(activeTracks, 0, activeTracks.Length);
             }
 
-            JackWrapper.SetMixedData(mixedBufferOut);
-            JackWrapper.GetMixedData(mixedBufferIn);
+            // Inputs are read natively by the Jack Receive spatializer on each JackSourceReceive
 
             // System.Array.Clear(buffer, 0, buffer.Length);
         }
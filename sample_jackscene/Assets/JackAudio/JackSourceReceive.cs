@@ -24,31 +24,53 @@ using System.Collections;
 namespace JackAudio
 {
 
+// Plays a JACK input port through this AudioSource. The "Jack Receive" spatializer plugin (selected in the
+// project's audio settings) reads the port natively and pans it; the clip only keeps the source playing and
+// feeds Unity's volume and distance attenuation to the plugin as a constant envelope.
+[RequireComponent(typeof(AudioSource))]
 public class JackSourceReceive : MonoBehaviour {
 
 	public JackMultiplexer multiplexer;
 	public int IN_PORT;
+	public float GAIN = 1.0f;
+
+	// Spatializer parameter indices, the same in Jack Receive (PORT, GAIN) and Jack Spatializer (INPUT, GAIN)
+	private const int PARAM_PORT = 0;
+	private const int PARAM_GAIN = 1;
+
+	private static AudioClip envelopeClip;
+	private AudioSource _source;
 
-	// Hack for 3d spatialization
 	void Awake () {
-		AudioClip _clip = AudioClip.Create("_clip", 1024, 2, 44100, true);
-		float[] samples = new float[1024];
-		for (int i = 0; i < 1024; i++)
-		{
-			samples[i] = 1;
-		}
-		_clip.SetData(samples, 0);
-		
-		AudioSource _source = GetComponent<AudioSource>();
-		_source.clip = _clip;
+		_source = GetComponent<AudioSource>();
+		_source.clip = GetEnvelopeClip();
+		_source.loop = true;
+		_source.spatialize = true;
+		ApplyParameters();
 		_source.Play();
 	}
 
-	void OnAudioFilterRead (float[] data, int channels) {
-		System.Array.Clear(data, 0, data.Length);
-		if (multiplexer.isRunning()) {
-			multiplexer.GetBuffer(IN_PORT, data);
+	void OnValidate () {
+		if (_source != null) ApplyParameters();
+	}
+
+	private void ApplyParameters () {
+		_source.SetSpatializerFloat(PARAM_PORT, IN_PORT);
+		_source.SetSpatializerFloat(PARAM_GAIN, GAIN);
+	}
+
+	// One clip of ones shared by every receiver
+	private static AudioClip GetEnvelopeClip () {
+		if (envelopeClip == null) {
+			float[] samples = new float[1024 * 2];
+			for (int i = 0; i < samples.Length; i++)
+			{
+				samples[i] = 1;
+			}
+			envelopeClip = AudioClip.Create("_jackenvelope", 1024, 2, AudioSettings.outputSampleRate, false);
+			envelopeClip.SetData(samples, 0);
 		}
+		return envelopeClip;
 	}
 }
 
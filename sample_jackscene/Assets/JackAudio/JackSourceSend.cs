@@ -29,13 +29,11 @@ public class JackSourceSend : MonoBehaviour {
     public JackMultiplexer multiplexer;
     public int trackNumber;
 	private int BUFFER_SIZE;
-    private float[] monodata;
 
     public bool IsMuted = false;
 
     void Start() {
         BUFFER_SIZE = multiplexer.GetBufferSize();
-        monodata = new float[BUFFER_SIZE]; //this has to be set from options
         // Check if multiplexer is there, and check if id is unique //
         if (multiplexer == null)
         {
@@ -49,15 +47,20 @@ public class JackSourceSend : MonoBehaviour {
     {
         if (multiplexer.isRunning())
         {
-            /* force to mono*/
+            /* force to mono, straight into the multiplexer's track */
+            float[] track = multiplexer.combinedBuffers[trackNumber];
             if (channels == 2)
             {
                 for (int i = 0,j=0; i < BUFFER_SIZE; i++,j+=2)
                 {
-                    monodata[i] = buffer[j] + buffer[j+1];
+                    track[i] = buffer[j] + buffer[j+1];
                 }
             }
-            System.Array.Copy(monodata, multiplexer.combinedBuffers[trackNumber], BUFFER_SIZE);
+            else if (channels == 1)
+            {
+                System.Array.Copy(buffer, track, BUFFER_SIZE);
+            }
+            multiplexer.MarkTrack(trackNumber);
         }
         // We need to zero the buffer after copying it,
         // otherwise it will play in unity as well
@@ -20,23 +20,84 @@ using UnityEngine;
 using System.Collections;
 using System;
 using System.Runtime.InteropServices;
+#if JACKAUDIO_NATIVEARRAY
+using Unity.Collections;
+using Unity.Collections.LowLevel.Unsafe;
+#endif
 
 namespace JackAudio
 {
 
+/// <summary>
+/// How samples travel between Unity and Jack inside the plugin. The compact formats use a half or three quarters
+/// of the memory and bandwidth of Float32, which pays off with many channels.
+/// </summary>
+public enum RingFormat
+{
+    Float32 = 0,
+    Int16 = 1,      // dithered
+    Int24 = 2,      // dithered
+    Float16 = 3
+}
+
+/// <summary>
+/// Filter types of the speaker EQ bands on the Jack outputs, see JackWrapper.SetOutputEq.
+/// </summary>
+public enum EqType
+{
+    Off = 0,
+    Peaking = 1,
+    LowShelf = 2,
+    HighShelf = 3,
+    Lowpass = 4,
+    Highpass = 5
+}
+
+/// <summary>
+/// A block of native memory holding one buffer per Jack output, from JackWrapper.AcquireTrackBlock
+/// </summary>
+public struct TrackBlock
+{
+    public IntPtr data;     // null when no block was free
+    public int stride;      // floats from the start of one track to the next
+    public int tracks;
+
+    public bool IsValid { get { return data != IntPtr.Zero; } }
+
+    public IntPtr Track(int index)
+    {
+        return new IntPtr(data.ToInt64() + (long)index * stride * sizeof(float));
+    }
+}
+
 public class JackWrapper {
 
-    static public void StartJackClient(int inchannels, int outchannels)
+    static public void StartJackClient(int inchannels, int outchannels, int workers = 0, RingFormat format = RingFormat.Float32)
     {
+        SetWorkerThreads(workers);
+        SetRingFormat((int)format);
         Debug.Log("Starting Jack");
         if (!CreateClient(inchannels, outchannels)) {
             Debug.LogError("Jack Server not online");
         }
 
     }
+    /// <summary>
+    /// Makes the next client stream its outputs over UDP to UnityJackReceiver at host:port, in blocks of
+    /// bufferSize frames, instead of using a local Jack server. An empty host goes back to Jack.
+    /// Jack inputs are not available over the network.
+    /// </summary>
+    static public void SetNetworkTarget(string host, int port, int bufferSize)
+    {
+        SetNetworkTargetNative(host ?? "", port, bufferSize);
+    }
+
     static public void DestroyJackClient()
     {
         Debug.Log("Disabling Jack");
+#if JACKAUDIO_NATIVEARRAY && ENABLE_UNITY_COLLECTIONS_CHECKS
+        ReleaseBlockSafety();
+#endif
         DestroyClient();
     }
 
@@ -45,11 +106,204 @@ public class JackWrapper {
         SetAllData(buffer);
     }
 
+    /// <summary>
+    /// Sends one block of many tracks in a single call. tracks holds a pinned pointer to each track's samples
+    /// (see GCHandle.AddrOfPinnedObject), read only where the track's bit is set in activeMask, 64 tracks per ulong.
+    /// The plugin writes them to the Jack outputs natively, so nothing needs interleaving here.
+    /// </summary>
+    static public void SetPlanarData(IntPtr[] tracks, ulong[] activeMask, int bufferSize)
+    {
+        SetPlanarData(tracks, tracks.Length, activeMask, bufferSize);
+    }
+
+    /// <summary>
+    /// A block of native track buffers to fill off the managed heap, from any thread or job, before handing it over
+    /// with SubmitTrackBlock. The same block comes back until it is submitted; IsValid is false while the plugin
+    /// still has blocks queued. The memory belongs to the plugin and is valid until the client is destroyed.
+    /// </summary>
+    static public TrackBlock AcquireTrackBlock()
+    {
+        TrackBlock block;
+        block.data = AcquireTrackBlock(out block.stride, out block.tracks);
+        return block;
+    }
+
+    /// <summary>
+    /// Queues the acquired block. activeMask flags the tracks written, 64 per ulong; null sends all of them.
+    /// </summary>
+    static public bool SubmitTrackBlock(ulong[] activeMask)
+    {
+#if JACKAUDIO_NATIVEARRAY && ENABLE_UNITY_COLLECTIONS_CHECKS
+        ReleaseBlockSafety();
+#endif
+        return SubmitTrackBlockNative(activeMask);
+    }
+
+    /// <summary>
+    /// Audio thread: sends the oldest submitted block to Jack without copying it; false when none is waiting
+    /// </summary>
+    static public bool SendTrackBlock(int bufferSize)
+    {
+        return SendTrackBlockNative(bufferSize);
+    }
+
+#if JACKAUDIO_NATIVEARRAY
+    /// <summary>
+    /// One track of a block as a NativeArray for jobs and Burst. Needs unsafe code allowed in the player settings
+    /// and JACKAUDIO_NATIVEARRAY in the scripting define symbols. The arrays of a block share one safety handle,
+    /// released by SubmitTrackBlock, so complete the jobs using them before submitting; the arrays are invalid after.
+    /// </summary>
+    static public unsafe NativeArray<float> GetTrackArray(TrackBlock block, int track, int length)
+    {
+        NativeArray<float> array = NativeArrayUnsafeUtility.ConvertExistingDataToNativeArray<float>(
+            (void*)block.Track(track), length, Allocator.None);
+#if ENABLE_UNITY_COLLECTIONS_CHECKS
+        if (!hasBlockSafety)
+        {
+            blockSafety = AtomicSafetyHandle.Create();
+            hasBlockSafety = true;
+        }
+        NativeArrayUnsafeUtility.SetAtomicSafetyHandle(ref array, blockSafety);
+#endif
+        return array;
+    }
+
+#if ENABLE_UNITY_COLLECTIONS_CHECKS
+    // Safety handle of the acquired block's arrays, created by the first GetTrackArray of the block
+    static AtomicSafetyHandle blockSafety;
+    static bool hasBlockSafety;
+
+    static void ReleaseBlockSafety()
+    {
+        if (!hasBlockSafety) return;
+        AtomicSafetyHandle.Release(blockSafety);
+        hasBlockSafety = false;
+    }
+#endif
+#endif
+
     static public void GetMixedData(float[] buffer)
     {
         GetAllData(buffer);
     }
 
+    /// <summary>
+    /// Scheduling for the plugin's threads. Worker and memory settings apply to the next client that is started,
+    /// the Unity audio thread settings the next time it sends data.
+    /// workerPriority: -1 follows the Jack thread, 0 unprivileged, otherwise a SCHED_FIFO priority.
+    /// The CPU masks have one bit per core, 0 lets the threads float.
+    /// </summary>
+    static public void SetThreadSettings(int workerPriority, ulong workerCpus, int unityPriority, ulong unityCpus, bool lockMemory)
+    {
+        SetThreadConfig(workerPriority, workerCpus, unityPriority, unityCpus, lockMemory ? 1 : 0);
+    }
+
+    /// <summary>
+    /// Convolves a Jack input port with an impulse response before it reaches Unity.
+    /// The impulse response must be mono and at the Jack sample rate; pass an empty array to remove the insert.
+    /// </summary>
+    static public bool SetInputImpulseResponse(int port, float[] ir)
+    {
+        return SetInputConvolution(port, ir, ir.Length);
+    }
+
+    /// <summary>
+    /// Delays a Jack output port to time-align its speaker with the others, from 0 to 100 ms, in fractions of a
+    /// sample too. Changes crossfade over one Jack cycle, so delays can be adjusted while playing.
+    /// </summary>
+    static public bool SetOutputDelay(int port, float milliseconds)
+    {
+        return SetOutputDelayNative(port, milliseconds);
+    }
+
+    /// <summary>
+    /// Sets one of the 8 EQ bands of a Jack output port, for tuning its speaker. Gain is in dB and only used by
+    /// the peaking and shelving types; EqType.Off removes the band. New settings apply from the next Jack cycle.
+    /// </summary>
+    static public bool SetOutputEq(int port, int band, EqType type, float frequency, float gain, float q)
+    {
+        return SetOutputEqNative(port, band, (int)type, frequency, gain, q);
+    }
+
+    /// <summary>
+    /// Protects a Jack output port, or all of them with port -1, with a DC blocker and a 1 ms lookahead limiter
+    /// at thresholdDb (dBFS, at most 0). Once any port is protected, every port is delayed by the lookahead.
+    /// </summary>
+    static public bool SetOutputProtection(int port, bool enabled, float thresholdDb)
+    {
+        return SetOutputProtectionNative(port, enabled ? 1 : 0, thresholdDb);
+    }
+
+    /// <summary>
+    /// Direct monitoring: mixes a Jack input port into a Jack output port at a linear gain inside the Jack cycle,
+    /// without a trip through Unity. A gain of 0 removes the route; changes ramp over one Jack cycle.
+    /// </summary>
+    static public bool SetMonitorRoute(int input, int output, float gain)
+    {
+        return SetMonitorRouteNative(input, output, gain);
+    }
+
+    /// <summary>
+    /// Removes every direct monitoring route.
+    /// </summary>
+    static public bool ClearMonitorRoutes()
+    {
+        return ClearMonitorRoutesNative();
+    }
+
+    /// <summary>
+    /// Fills reductionDb with the largest limiter gain reduction of each output port since the last call, in dB.
+    /// Returns the number of ports filled.
+    /// </summary>
+    static public int GetOutputGainReduction(float[] reductionDb)
+    {
+        return GetOutputGainReductionNative(reductionDb, reductionDb.Length);
+    }
+
+    /// <summary>
+    /// Records the audio path (Jack callbacks, ringbuffer fill levels, plugin callbacks, underruns and xruns)
+    /// into a Chrome trace at path, viewable in chrome://tracing or ui.perfetto.dev, until StopTrace is called.
+    /// </summary>
+    static public bool StartTrace(string path)
+    {
+        return StartTraceNative(path);
+    }
+
+    /// <summary>
+    /// Stops recording and finishes the trace file.
+    /// </summary>
+    static public void StopTrace()
+    {
+        StopTraceNative();
+    }
+
+    /// <summary>
+    /// Holds back the effect parameter changes made from here on, through mixer or spatializer parameters, until
+    /// EndParameterBatch, so they take effect together. They are applied at dspTime, to the sample, as
+    /// AudioSettings.dspTime counts it; 0 or a time already past applies them at the start of the next block.
+    /// </summary>
+    static public void BeginParameterBatch(double dspTime = 0.0)
+    {
+        BeginParameterBatchNative(dspTime > 0.0 ? (ulong)Math.Round(dspTime * AudioSettings.outputSampleRate) : 0);
+    }
+
+    /// <summary>
+    /// Releases the changes made since BeginParameterBatch to the audio thread.
+    /// </summary>
+    static public void EndParameterBatch()
+    {
+        EndParameterBatchNative();
+    }
+
+    /// <summary>
+    /// Loads the speaker layout the "Jack Spatializer" plugin pans over, one Jack output per speaker.
+    /// The file lists "azimuth elevation [distance]" per line, in degrees and meters, in output port order.
+    /// </summary>
+    static public bool SetSpeakerLayout(string path)
+    {
+        return LoadSpeakerLayout(path);
+    }
+
     #region DllImport
 	[DllImport("AudioPlugin-JackAudioForUnity")]
 	private static extern bool CreateClient(int inchannels, int outchannels);
@@ -59,6 +313,46 @@ public class JackWrapper {
 	private static extern void GetAllData(float[] buffer);
     [DllImport("AudioPlugin-JackAudioForUnity")]
 	private static extern void SetAllData(float[] buffer);
+    [DllImport("AudioPlugin-JackAudioForUnity")]
+    private static extern void SetPlanarData(IntPtr[] tracks, int numtracks, ulong[] mask, int length);
+    [DllImport("AudioPlugin-JackAudioForUnity")]
+    private static extern IntPtr AcquireTrackBlock(out int stride, out int tracks);
+    [DllImport("AudioPlugin-JackAudioForUnity", EntryPoint = "SubmitTrackBlock")]
+    private static extern bool SubmitTrackBlockNative(ulong[] mask);
+    [DllImport("AudioPlugin-JackAudioForUnity", EntryPoint = "SendTrackBlock")]
+    private static extern bool SendTrackBlockNative(int length);
+    [DllImport("AudioPlugin-JackAudioForUnity")]
+    private static extern bool SetInputConvolution(int port, float[] ir, int length);
+    [DllImport("AudioPlugin-JackAudioForUnity", EntryPoint = "SetOutputDelay")]
+    private static extern bool SetOutputDelayNative(int port, float milliseconds);
+    [DllImport("AudioPlugin-JackAudioForUnity", EntryPoint = "SetOutputEq")]
+    private static extern bool SetOutputEqNative(int port, int band, int type, float frequency, float gain, float q);
+    [DllImport("AudioPlugin-JackAudioForUnity", EntryPoint = "SetOutputProtection")]
+    private static extern bool SetOutputProtectionNative(int port, int enabled, float thresholdDb);
+    [DllImport("AudioPlugin-JackAudioForUnity", EntryPoint = "SetMonitorRoute")]
+    private static extern bool SetMonitorRouteNative(int input, int output, float gain);
+    [DllImport("AudioPlugin-JackAudioForUnity", EntryPoint = "ClearMonitorRoutes")]
+    private static extern bool ClearMonitorRoutesNative();
+    [DllImport("AudioPlugin-JackAudioForUnity", EntryPoint = "GetOutputGainReduction")]
+    private static extern int GetOutputGainReductionNative(float[] reductionDb, int count);
+    [DllImport("AudioPlugin-JackAudioForUnity", EntryPoint = "StartTrace")]
+    private static extern bool StartTraceNative(string path);
+    [DllImport("AudioPlugin-JackAudioForUnity", EntryPoint = "StopTrace")]
+    private static extern void StopTraceNative();
+    [DllImport("AudioPlugin-JackAudioForUnity", EntryPoint = "BeginParameterBatch")]
+    private static extern void BeginParameterBatchNative(ulong tick);
+    [DllImport("AudioPlugin-JackAudioForUnity", EntryPoint = "EndParameterBatch")]
+    private static extern void EndParameterBatchNative();
+    [DllImport("AudioPlugin-JackAudioForUnity")]
+    private static extern void SetWorkerThreads(int count);
+    [DllImport("AudioPlugin-JackAudioForUnity")]
+    private static extern void SetRingFormat(int format);
+    [DllImport("AudioPlugin-JackAudioForUnity", EntryPoint = "SetNetworkTarget")]
+    private static extern void SetNetworkTargetNative(string host, int port, int frames);
+    [DllImport("AudioPlugin-JackAudioForUnity")]
+    private static extern void SetThreadConfig(int workerPriority, ulong workerCpus, int unityPriority, ulong unityCpus, int lockMemory);
+    [DllImport("AudioPlugin-JackAudioForUnity")]
+    private static extern bool LoadSpeakerLayout(string path);
 
     // [DllImport("UnityJackAudio")]
     // public static extern void SetDebugFunction(IntPtr fp);